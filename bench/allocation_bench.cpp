@@ -0,0 +1,131 @@
+#include "jdb/database/SqliteDatabase.hpp"
+#include "jdb/database/DataClass.hpp"
+#include "jdb/database/Repository.hpp"
+#include "jdb/database/ResultArena.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace jdb;
+
+namespace {
+  std::atomic<int64_t> allocations{0};
+}
+
+// counts every global allocation, so the per row cost of hydration shows up
+void *operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+
+  if (void *ptr = std::malloc(size == 0 ? 1 : size)) {
+    return ptr;
+  }
+
+  throw std::bad_alloc{};
+}
+
+void operator delete(void *ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, [[maybe_unused]] std::size_t size) noexcept {
+  std::free(ptr);
+}
+
+// the default pmr resource (text of Data) allocates through the aligned forms
+void *operator new(std::size_t size, std::align_val_t align) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+
+  auto alignment = static_cast<std::size_t>(align);
+
+  if (void *ptr = std::aligned_alloc(alignment, (std::max<std::size_t>(size, 1) + alignment - 1) / alignment * alignment)) {
+    return ptr;
+  }
+
+  throw std::bad_alloc{};
+}
+
+void operator delete(void *ptr, [[maybe_unused]] std::align_val_t align) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void *ptr, [[maybe_unused]] std::size_t size, [[maybe_unused]] std::align_val_t align) noexcept {
+  std::free(ptr);
+}
+
+using RowModel = DataClass<"row", Primary<"id">, NoForeign,
+  Field<"id", FieldType::Serial, false>,
+  Field<"group_id", FieldType::Int, false>,
+  Field<"name", FieldType::Text, false>,
+  Field<"description", FieldType::Text, false>,
+  Field<"amount", FieldType::Decimal, false> >;
+
+using BenchDatabase = SqliteDatabase<RowModel>;
+
+namespace {
+  std::shared_ptr<BenchDatabase> make_database(int64_t rows) {
+    auto db = std::make_shared<BenchDatabase>(":memory:");
+    std::vector<RowModel> items;
+
+    for (int64_t i = 0; i < rows; i++) {
+      RowModel item;
+
+      item["group_id"] = i % 2;
+      item["name"] = fmt::format("name {}", i);
+      item["description"] = fmt::format("a description long enough to leave the small buffer {}", i);
+      item["amount"] = static_cast<double>(i) * 0.25;
+
+      items.emplace_back(std::move(item));
+    }
+
+    Repository<RowModel>{db}.save_all(items);
+
+    return db;
+  }
+
+  void set_counters(benchmark::State &state, int64_t allocationsBefore, int64_t rows) {
+    auto total = static_cast<double>(allocations - allocationsBefore);
+
+    state.SetItemsProcessed(state.iterations() * rows);
+    state.counters["allocs_per_row"] = total / static_cast<double>(state.iterations() * rows);
+  }
+}
+
+static void BM_LoadByVector(benchmark::State &state) {
+  auto db = make_database(state.range(0));
+  Repository<RowModel> repository{db};
+  int64_t allocationsBefore = allocations;
+
+  for (auto _: state) {
+    auto items = repository.load_by<"group_id">(1);
+
+    benchmark::DoNotOptimize(items.data());
+  }
+
+  set_counters(state, allocationsBefore, state.range(0) / 2);
+}
+
+static void BM_LoadByArena(benchmark::State &state) {
+  auto db = make_database(state.range(0));
+  Repository<RowModel> repository{db};
+  ResultArena arena{static_cast<std::size_t>(state.range(0)) * sizeof(RowModel)};
+  int64_t allocationsBefore = allocations;
+
+  for (auto _: state) {
+    {
+      auto items = repository.load_by<"group_id">(arena, 1);
+
+      benchmark::DoNotOptimize(items.data());
+    }
+
+    arena.release();
+  }
+
+  set_counters(state, allocationsBefore, state.range(0) / 2);
+}
+
+BENCHMARK(BM_LoadByVector)->Range(1 << 10, 1 << 17);
+BENCHMARK(BM_LoadByArena)->Range(1 << 10, 1 << 17);
@@ -0,0 +1,118 @@
+#include "jdb/database/DataClass.hpp"
+#include "jdb/database/BinaryCodec.hpp"
+#include "jdb/database/JsonWriter.hpp"
+
+#include <benchmark/benchmark.h>
+
+using namespace jdb;
+
+using RowModel = DataClass<"row", Primary<"id">, NoForeign,
+  Field<"id", FieldType::Serial, false>,
+  Field<"group_id", FieldType::Int, false>,
+  Field<"name", FieldType::Text, false>,
+  Field<"description", FieldType::Text, true>,
+  Field<"amount", FieldType::Decimal, false> >;
+
+namespace {
+  std::vector<RowModel> make_rows(int64_t rows) {
+    std::vector<RowModel> items;
+
+    for (int64_t i = 0; i < rows; i++) {
+      RowModel item;
+
+      item["id"] = i + 1;
+      item["group_id"] = i % 16;
+      item["name"] = fmt::format("name {}", i);
+      item["description"] = i % 10 == 0 ? Data{nullptr} : Data{fmt::format("a longer description of row {}", i)};
+      item["amount"] = static_cast<double>(i) * 0.25;
+
+      items.emplace_back(std::move(item));
+    }
+
+    return items;
+  }
+}
+
+// the text dump is the only other built-in serialization
+static void BM_ToString(benchmark::State &state) {
+  auto rows = make_rows(state.range(0));
+
+  for (auto _: state) {
+    std::size_t bytes = 0;
+
+    for (auto const &row: rows) {
+      bytes += row.to_string().size();
+    }
+
+    benchmark::DoNotOptimize(bytes);
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_JsonWriter(benchmark::State &state) {
+  auto rows = make_rows(state.range(0));
+
+  for (auto _: state) {
+    std::size_t bytes = 0;
+    JsonWriter writer{[&](std::string_view chunk) { bytes += chunk.size(); }};
+
+    writer.write_all(rows);
+    writer.close();
+
+    benchmark::DoNotOptimize(bytes);
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_Encode(benchmark::State &state) {
+  auto rows = make_rows(state.range(0));
+  std::string buffer;
+
+  for (auto _: state) {
+    buffer.clear();
+
+    BinaryCodec<RowModel>::encode(rows, buffer);
+
+    benchmark::DoNotOptimize(buffer.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+  state.counters["bytes_per_row"] = static_cast<double>(buffer.size()) / static_cast<double>(state.range(0));
+}
+
+static void BM_DecodeAll(benchmark::State &state) {
+  std::string buffer = BinaryCodec<RowModel>::encode(make_rows(state.range(0)));
+
+  for (auto _: state) {
+    auto rows = BinaryCodec<RowModel>::decode_all(buffer);
+
+    benchmark::DoNotOptimize(rows.data());
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+static void BM_ReaderScan(benchmark::State &state) {
+  std::string buffer = BinaryCodec<RowModel>::encode(make_rows(state.range(0)));
+
+  for (auto _: state) {
+    BinaryReader<RowModel> reader{buffer};
+    double sum = 0.0;
+
+    while (reader.next()) {
+      sum += reader.get_decimal("amount").value();
+    }
+
+    benchmark::DoNotOptimize(sum);
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+
+BENCHMARK(BM_ToString)->Range(1 << 10, 1 << 16);
+BENCHMARK(BM_JsonWriter)->Range(1 << 10, 1 << 16);
+BENCHMARK(BM_Encode)->Range(1 << 10, 1 << 16);
+BENCHMARK(BM_DecodeAll)->Range(1 << 10, 1 << 16);
+BENCHMARK(BM_ReaderScan)->Range(1 << 10, 1 << 16);
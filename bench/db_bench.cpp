@@ -0,0 +1,366 @@
+#include "jdb/database/SqliteDatabase.hpp"
+#include "jdb/database/DataClass.hpp"
+#include "jdb/database/Repository.hpp"
+#include "jdb/database/CompoundModel.hpp"
+#include "jdb/database/BulkLoader.hpp"
+#include "jdb/database/TableExport.hpp"
+#include "jdb/database/ShardedDatabase.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+#include <utility>
+
+using namespace jdb;
+
+using NarrowModel = DataClass<"narrow", Primary<"id">, NoForeign,
+  Field<"id", FieldType::Serial, false>,
+  Field<"group_id", FieldType::Int, false>,
+  Field<"name", FieldType::Text, false> >;
+
+using WideModel = DataClass<"wide", Primary<"id">, NoForeign,
+  Field<"id", FieldType::Serial, false>,
+  Field<"group_id", FieldType::Int, false>,
+  Field<"name", FieldType::Text, false>,
+  Field<"flag", FieldType::Bool, false>,
+  Field<"text_1", FieldType::Text, false>,
+  Field<"text_2", FieldType::Text, false>,
+  Field<"text_3", FieldType::Text, false>,
+  Field<"text_4", FieldType::Text, false>,
+  Field<"text_5", FieldType::Text, false>,
+  Field<"int_1", FieldType::Int, false>,
+  Field<"int_2", FieldType::Int, false>,
+  Field<"int_3", FieldType::Int, false>,
+  Field<"int_4", FieldType::Int, false>,
+  Field<"decimal_1", FieldType::Decimal, false>,
+  Field<"decimal_2", FieldType::Decimal, false>,
+  Field<"decimal_3", FieldType::Decimal, false> >;
+
+using AccountModel = DataClass<"account", Primary<"id">, NoForeign,
+  Field<"id", FieldType::Serial, false>,
+  Field<"group_id", FieldType::Int, false>,
+  Field<"name", FieldType::Text, false> >;
+
+using SessionModel = DataClass<"session", Primary<"id">, Foreign<Refer<AccountModel, "account_id"> >,
+  Field<"id", FieldType::Serial, false>,
+  Field<"account_id", FieldType::Int, false>,
+  Field<"token", FieldType::Text, false> >;
+
+using AccountSession = CompoundModel<AccountModel, SessionModel>;
+
+// narrow rows again, kept in memory by file databases
+using LookupModel = DataClass<"lookup", Primary<"id">, NoForeign,
+  Field<"id", FieldType::Serial, false>,
+  Field<"group_id", FieldType::Int, false>,
+  Field<"name", FieldType::Text, false> >;
+
+template<>
+struct jdb::MemoryPinned<LookupModel> : std::true_type {
+};
+
+using BenchDatabase = SqliteDatabase<NarrowModel, WideModel, AccountModel, SessionModel>;
+
+namespace {
+  template<typename Model>
+  Model make_model(int64_t i) {
+    Model model;
+
+    model.get_fields([&]<typename Field>() {
+      if constexpr (Field::get_type() == FieldType::Serial) {
+        return;
+      } else if constexpr (Field::get_type() == FieldType::Bool) {
+        model[Field::get_name()] = (i % 2) == 0;
+      } else if constexpr (Field::get_type() == FieldType::Int) {
+        model[Field::get_name()] = i % 100;
+      } else if constexpr (Field::get_type() == FieldType::Decimal) {
+        model[Field::get_name()] = static_cast<double>(i) * 0.5;
+      } else {
+        model[Field::get_name()] = fmt::format("{} value {}", Field::get_name(), i);
+      }
+    });
+
+    return model;
+  }
+
+  template<typename Model>
+  std::shared_ptr<BenchDatabase> make_database(int64_t rows) {
+    auto db = std::make_shared<BenchDatabase>(":memory:");
+    std::vector<Model> items;
+
+    for (int64_t i = 0; i < rows; i++) {
+      items.emplace_back(make_model<Model>(i));
+    }
+
+    Repository<Model>{db}.save_all(items);
+
+    return db;
+  }
+
+  void set_rows(benchmark::State &state, int64_t rowsPerIteration) {
+    state.SetItemsProcessed(state.iterations() * rowsPerIteration);
+  }
+}
+
+template<typename Model>
+static void BM_Insert(benchmark::State &state) {
+  auto db = make_database<Model>(state.range(0));
+  Repository<Model> repository{db};
+  int64_t i = 0;
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(repository.save(make_model<Model>(i++)));
+  }
+
+  set_rows(state, 1);
+}
+
+template<typename Model>
+static void BM_SaveAll(benchmark::State &state) {
+  auto db = make_database<Model>(0);
+  Repository<Model> repository{db};
+  std::vector<Model> items;
+
+  for (int64_t i = 0; i < state.range(0); i++) {
+    items.emplace_back(make_model<Model>(i));
+  }
+
+  for (auto _: state) {
+    repository.save_all(items);
+  }
+
+  set_rows(state, state.range(0));
+}
+
+template<typename Model>
+static void BM_Find(benchmark::State &state) {
+  auto db = make_database<Model>(state.range(0));
+  Repository<Model> repository{db};
+  std::mt19937 generator{42};
+  std::uniform_int_distribution<int64_t> ids(1, state.range(0));
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(repository.find(ids(generator)));
+  }
+
+  set_rows(state, 1);
+}
+
+// every group holds 1% of the rows
+template<typename Model>
+static void BM_LoadBy(benchmark::State &state) {
+  auto db = make_database<Model>(state.range(0));
+  Repository<Model> repository{db};
+  int64_t group = 0;
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(repository.template load_by<"group_id">(group++ % 100));
+  }
+
+  set_rows(state, state.range(0) / 100);
+}
+
+template<typename Model>
+static void BM_Update(benchmark::State &state) {
+  auto db = make_database<Model>(state.range(0));
+  Repository<Model> repository{db};
+  auto items = repository.load_all();
+  std::size_t i = 0;
+
+  for (auto _: state) {
+    auto &item = items[i++ % items.size()];
+
+    item["group_id"] = static_cast<int64_t>(i % 100);
+
+    benchmark::DoNotOptimize(repository.update(item));
+  }
+
+  set_rows(state, 1);
+}
+
+template<typename Model>
+static void BM_Remove(benchmark::State &state) {
+  auto db = make_database<Model>(state.range(0));
+  Repository<Model> repository{db};
+  int64_t i = 0;
+
+  for (auto _: state) {
+    state.PauseTiming();
+    auto item = repository.save(make_model<Model>(i++)).value();
+    state.ResumeTiming();
+
+    benchmark::DoNotOptimize(repository.remove(item));
+  }
+
+  set_rows(state, 1);
+}
+
+// mirrors what Repository does for every fetched row
+template<typename Model>
+static void BM_Hydrate(benchmark::State &state) {
+  auto model = make_model<Model>(1);
+  std::vector<std::string> columns;
+  std::vector<Data> values;
+
+  model.get_fields([&]<typename Field>() {
+    columns.emplace_back(Field::get_name());
+    values.emplace_back(std::as_const(model)[Field::get_name()]);
+  });
+
+  for (auto _: state) {
+    Model item;
+
+    for (int i = 0; i < static_cast<int>(columns.size()); i++) {
+      item[columns[i]] = values[i];
+    }
+
+    item.clear_dirty();
+
+    benchmark::DoNotOptimize(item);
+  }
+
+  set_rows(state, 1);
+}
+
+template<typename Model>
+static void BM_ToString(benchmark::State &state) {
+  auto model = make_model<Model>(1);
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(model.to_string());
+  }
+
+  set_rows(state, 1);
+}
+
+static void BM_SelectJoin(benchmark::State &state) {
+  auto db = make_database<AccountModel>(state.range(0));
+  std::vector<SessionModel> sessions;
+
+  for (int64_t i = 0; i < state.range(0); i++) {
+    auto session = make_model<SessionModel>(i);
+
+    session["account_id"] = i + 1;
+
+    sessions.emplace_back(session);
+  }
+
+  Repository<SessionModel>{db}.save_all(sessions);
+
+  Repository<AccountSession> repository{db};
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(repository.select<"ORDER BY session.id", 1000>());
+  }
+
+  set_rows(state, std::min<int64_t>(state.range(0), 1000));
+}
+
+// csv of range(0) narrow rows, parsed on range(1) threads
+static void BM_BulkLoad(benchmark::State &state) {
+  std::string csv = "group_id,name\n";
+
+  for (int64_t i = 0; i < state.range(0); i++) {
+    csv += fmt::format("{},\"name value {}\"\n", i % 100, i);
+  }
+
+  for (auto _: state) {
+    auto db = make_database<NarrowModel>(0);
+    BulkLoader<NarrowModel> loader{db, {.threads = static_cast<std::size_t>(state.range(1)), .chunkSize = 256 * 1024}};
+
+    benchmark::DoNotOptimize(loader.load(csv));
+  }
+
+  set_rows(state, state.range(0));
+}
+
+// range(0): 0 plain, otherwise gzip on that many threads
+static void BM_Export(benchmark::State &state) {
+  auto db = make_database<WideModel>(1 << 15);
+  ExportOptions options;
+
+  if (state.range(0) > 0) {
+    options.compression = ExportCompression::Gzip;
+    options.threads = static_cast<std::size_t>(state.range(0));
+  }
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(export_table<WideModel>(*db, [](std::string_view) {}, ExportFormat::Ndjson, options));
+  }
+
+  set_rows(state, 1 << 15);
+}
+
+// 1 << 14 narrow rows over range(0) in memory shards
+static void BM_ShardedInsertAll(benchmark::State &state) {
+  std::vector<NarrowModel> items;
+
+  for (int64_t i = 0; i < (1 << 14); i++) {
+    items.emplace_back(make_model<NarrowModel>(i));
+  }
+
+  for (auto _: state) {
+    ShardedDatabase<NarrowModel> db{":memory:", static_cast<std::size_t>(state.range(0))};
+
+    db.insert_all(items);
+  }
+
+  set_rows(state, 1 << 14);
+}
+
+// point reads of a 1 << 12 rows file table, range(0) selects the pinned copy
+static void BM_PinnedRead(benchmark::State &state) {
+  std::filesystem::remove("bench_pinned.db");
+  std::filesystem::remove("bench_pinned.db-wal");
+  std::filesystem::remove("bench_pinned.db-shm");
+
+  auto db = std::make_shared<SqliteDatabase<NarrowModel, LookupModel> >("bench_pinned.db");
+  std::vector<NarrowModel> narrow;
+  std::vector<LookupModel> lookup;
+
+  for (int64_t i = 0; i < (1 << 12); i++) {
+    narrow.emplace_back(make_model<NarrowModel>(i));
+    lookup.emplace_back(make_model<LookupModel>(i));
+  }
+
+  db->insert_all(narrow);
+  db->insert_all(lookup);
+
+  std::string table = state.range(0) > 0 ? LookupModel::get_name() : NarrowModel::get_name();
+  std::mt19937 generator{42};
+  std::uniform_int_distribution<int64_t> ids(1, 1 << 12);
+
+  for (auto _: state) {
+    db->read_transaction([&](Database &reader) {
+      reader.query_string(fmt::format("SELECT name FROM {} WHERE id = {};", table, ids(generator)),
+                          [](auto const &, std::vector<Data> const &values) {
+                            benchmark::DoNotOptimize(values);
+
+                            return false;
+                          });
+    });
+  }
+
+  set_rows(state, 1);
+}
+
+BENCHMARK_TEMPLATE(BM_Insert, NarrowModel)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Insert, WideModel)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_SaveAll, NarrowModel)->Range(1 << 6, 1 << 12);
+BENCHMARK_TEMPLATE(BM_SaveAll, WideModel)->Range(1 << 6, 1 << 12);
+BENCHMARK_TEMPLATE(BM_Find, NarrowModel)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Find, WideModel)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_LoadBy, NarrowModel)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_LoadBy, WideModel)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Update, NarrowModel)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Update, WideModel)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Remove, NarrowModel)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Remove, WideModel)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Hydrate, NarrowModel);
+BENCHMARK_TEMPLATE(BM_Hydrate, WideModel);
+BENCHMARK_TEMPLATE(BM_ToString, NarrowModel);
+BENCHMARK_TEMPLATE(BM_ToString, WideModel);
+BENCHMARK(BM_SelectJoin)->Range(1 << 6, 1 << 14);
+BENCHMARK(BM_BulkLoad)->ArgsProduct({{1 << 16, 1 << 18}, {1, 4}})->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ShardedInsertAll)->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Export)->Arg(0)->Arg(1)->Arg(4)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_PinnedRead)->Arg(0)->Arg(1);
@@ -0,0 +1,228 @@
+#include "jdb/database/SqliteDatabase.hpp"
+#include "jdb/database/DataClass.hpp"
+#include "jdb/database/Repository.hpp"
+#include "jdb/database/ColumnKernels.hpp"
+
+#include <benchmark/benchmark.h>
+
+using namespace jdb;
+
+using SampleModel = DataClass<"sample", Primary<"id">, NoForeign,
+  Field<"id", FieldType::Serial, false>,
+  Field<"amount", FieldType::Int, true>,
+  Field<"price", FieldType::Decimal, true> >;
+
+using BenchDatabase = SqliteDatabase<SampleModel>;
+
+namespace {
+  struct Samples {
+    std::vector<SampleModel> models;
+    ColumnBatch<SampleModel, "amount", "price"> batch;
+  };
+
+  // one row in 100 is null
+  Samples const &get_samples(int64_t rows) {
+    static std::map<int64_t, Samples> cache;
+
+    if (auto it = cache.find(rows); it != cache.end()) {
+      return it->second;
+    }
+
+    auto db = std::make_shared<BenchDatabase>(":memory:");
+    Repository<SampleModel> repository{db};
+    std::vector<SampleModel> items;
+
+    for (int64_t i = 0; i < rows; i++) {
+      SampleModel item;
+
+      item["amount"] = i % 100 == 0 ? Data{nullptr} : Data{(i * 7919) % 1000};
+      item["price"] = i % 100 == 0 ? Data{nullptr} : Data{static_cast<double>((i * 7919) % 1000) * 0.25};
+
+      items.emplace_back(std::move(item));
+    }
+
+    repository.save_all(items);
+
+    auto &samples = cache[rows];
+
+    samples.models = repository.select<"ORDER BY id", std::numeric_limits<std::size_t>::max()>();
+    samples.batch = repository.select_columns<"amount", "price">("ORDER BY id");
+
+    return samples;
+  }
+
+  void set_level(benchmark::State &state) {
+    ColumnKernels::set_level(static_cast<SimdLevel>(state.range(1)));
+
+    if (ColumnKernels::get_level() != static_cast<SimdLevel>(state.range(1))) {
+      state.SkipWithError("simd level not supported");
+    }
+  }
+
+  void set_rows(benchmark::State &state) {
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+  }
+}
+
+static void BM_SumModels(benchmark::State &state) {
+  auto const &samples = get_samples(state.range(0));
+
+  for (auto _: state) {
+    int64_t total = 0;
+
+    for (auto const &model: samples.models) {
+      total += model["amount"].get_int().value_or(0);
+    }
+
+    benchmark::DoNotOptimize(total);
+  }
+
+  set_rows(state);
+}
+
+static void BM_SumColumn(benchmark::State &state) {
+  auto const &amount = get_samples(state.range(0)).batch.get<"amount">();
+
+  set_level(state);
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(ColumnKernels::sum(amount));
+  }
+
+  set_rows(state);
+}
+
+static void BM_MaxModels(benchmark::State &state) {
+  auto const &samples = get_samples(state.range(0));
+
+  for (auto _: state) {
+    double result = std::numeric_limits<double>::lowest();
+
+    for (auto const &model: samples.models) {
+      if (auto price = model["price"].get_decimal(); price.has_value()) {
+        result = std::max(result, *price);
+      }
+    }
+
+    benchmark::DoNotOptimize(result);
+  }
+
+  set_rows(state);
+}
+
+static void BM_MaxColumn(benchmark::State &state) {
+  auto const &price = get_samples(state.range(0)).batch.get<"price">();
+
+  set_level(state);
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(ColumnKernels::max(price));
+  }
+
+  set_rows(state);
+}
+
+static void BM_CountIfModels(benchmark::State &state) {
+  auto const &samples = get_samples(state.range(0));
+
+  for (auto _: state) {
+    std::size_t count = 0;
+
+    for (auto const &model: samples.models) {
+      if (auto amount = model["amount"].get_int(); amount.has_value() and *amount < 250) {
+        count++;
+      }
+    }
+
+    benchmark::DoNotOptimize(count);
+  }
+
+  set_rows(state);
+}
+
+static void BM_CountIfColumn(benchmark::State &state) {
+  auto const &amount = get_samples(state.range(0)).batch.get<"amount">();
+
+  set_level(state);
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(ColumnKernels::count_if(amount, Compare::Less, int64_t{250}));
+  }
+
+  set_rows(state);
+}
+
+static void BM_FilterModels(benchmark::State &state) {
+  auto const &samples = get_samples(state.range(0));
+
+  for (auto _: state) {
+    std::vector<uint32_t> selection;
+
+    for (uint32_t i = 0; i < samples.models.size(); i++) {
+      if (auto amount = samples.models[i]["amount"].get_int(); amount.has_value() and *amount < 250) {
+        selection.push_back(i);
+      }
+    }
+
+    benchmark::DoNotOptimize(selection.data());
+  }
+
+  set_rows(state);
+}
+
+static void BM_FilterColumn(benchmark::State &state) {
+  auto const &amount = get_samples(state.range(0)).batch.get<"amount">();
+
+  set_level(state);
+
+  for (auto _: state) {
+    auto selection = ColumnKernels::filter(amount, Compare::Less, int64_t{250});
+
+    benchmark::DoNotOptimize(selection.data());
+  }
+
+  set_rows(state);
+}
+
+static void BM_HistogramModels(benchmark::State &state) {
+  auto const &samples = get_samples(state.range(0));
+
+  for (auto _: state) {
+    std::vector<uint64_t> counts(16);
+
+    for (auto const &model: samples.models) {
+      if (auto price = model["price"].get_decimal(); price.has_value() and *price >= 0.0 and *price < 250.0) {
+        counts[static_cast<std::size_t>(*price * 16.0 / 250.0)]++;
+      }
+    }
+
+    benchmark::DoNotOptimize(counts.data());
+  }
+
+  set_rows(state);
+}
+
+static void BM_HistogramColumn(benchmark::State &state) {
+  auto const &price = get_samples(state.range(0)).batch.get<"price">();
+
+  set_level(state);
+
+  for (auto _: state) {
+    auto counts = ColumnKernels::histogram(price, 0.0, 250.0, 16);
+
+    benchmark::DoNotOptimize(counts.data());
+  }
+
+  set_rows(state);
+}
+
+// second argument: SimdLevel (0 scalar, 1 portable, 2 avx2, 3 avx512)
+#define JDB_KERNEL_BENCH(naive, kernel) \
+  BENCHMARK(naive)->Arg(1 << 16); \
+  BENCHMARK(kernel)->ArgsProduct({{1 << 16}, {0, 1, 2, 3}})
+
+JDB_KERNEL_BENCH(BM_SumModels, BM_SumColumn);
+JDB_KERNEL_BENCH(BM_MaxModels, BM_MaxColumn);
+JDB_KERNEL_BENCH(BM_CountIfModels, BM_CountIfColumn);
+JDB_KERNEL_BENCH(BM_FilterModels, BM_FilterColumn);
+JDB_KERNEL_BENCH(BM_HistogramModels, BM_HistogramColumn);
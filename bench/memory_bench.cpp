@@ -0,0 +1,151 @@
+#include "jdb/database/SqliteDatabase.hpp"
+#include "jdb/database/MemoryDatabase.hpp"
+#include "jdb/database/DataClass.hpp"
+#include "jdb/database/Repository.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <random>
+
+using namespace jdb;
+
+using ItemModel = DataClass<"item", Primary<"id">, NoForeign,
+  Field<"id", FieldType::Serial, false>,
+  Field<"group_id", FieldType::Int, false>,
+  Field<"name", FieldType::Text, false>,
+  Field<"price", FieldType::Decimal, false> >;
+
+namespace {
+  struct Sqlite {
+    static std::shared_ptr<Database> make() {
+      auto db = std::make_shared<SqliteDatabase<ItemModel> >(":memory:");
+
+      db->query_string("CREATE INDEX item_group ON item (group_id);", [](auto...) { return false; });
+
+      return db;
+    }
+  };
+
+  struct Memory {
+    static std::shared_ptr<Database> make() {
+      auto db = std::make_shared<MemoryDatabase<ItemModel> >();
+
+      db->add_index<ItemModel, "group_id">();
+
+      return db;
+    }
+  };
+
+  ItemModel make_item(int64_t i) {
+    ItemModel item;
+
+    item["group_id"] = i % 100;
+    item["name"] = fmt::format("item {}", i);
+    item["price"] = static_cast<double>(i) * 0.5;
+
+    return item;
+  }
+
+  template<typename Backend>
+  std::shared_ptr<Database> make_database(int64_t rows) {
+    auto db = Backend::make();
+    std::vector<ItemModel> items;
+
+    for (int64_t i = 0; i < rows; i++) {
+      items.emplace_back(make_item(i));
+    }
+
+    Repository<ItemModel>{db}.save_all(items);
+
+    return db;
+  }
+}
+
+template<typename Backend>
+static void BM_Insert(benchmark::State &state) {
+  auto db = make_database<Backend>(state.range(0));
+  Repository<ItemModel> repository{db};
+  int64_t i = 0;
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(repository.save(make_item(i++)));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Backend>
+static void BM_Find(benchmark::State &state) {
+  auto db = make_database<Backend>(state.range(0));
+  Repository<ItemModel> repository{db};
+  std::mt19937 generator{42};
+  std::uniform_int_distribution<int64_t> ids(1, state.range(0));
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(repository.find(ids(generator)));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+// every group holds 1% of the rows
+template<typename Backend>
+static void BM_LoadBy(benchmark::State &state) {
+  auto db = make_database<Backend>(state.range(0));
+  Repository<ItemModel> repository{db};
+  int64_t group = 0;
+
+  for (auto _: state) {
+    benchmark::DoNotOptimize(repository.load_by<"group_id">(group++ % 100));
+  }
+
+  state.SetItemsProcessed(state.iterations() * state.range(0) / 100);
+}
+
+template<typename Backend>
+static void BM_Update(benchmark::State &state) {
+  auto db = make_database<Backend>(state.range(0));
+  Repository<ItemModel> repository{db};
+  std::mt19937 generator{42};
+  std::uniform_int_distribution<int64_t> ids(1, state.range(0));
+
+  for (auto _: state) {
+    state.PauseTiming();
+    auto item = repository.find(ids(generator)).value();
+    state.ResumeTiming();
+
+    item["price"] = 1.5;
+
+    repository.update(item);
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+template<typename Backend>
+static void BM_Remove(benchmark::State &state) {
+  auto db = make_database<Backend>(state.range(0));
+  Repository<ItemModel> repository{db};
+  int64_t i = 0;
+
+  for (auto _: state) {
+    state.PauseTiming();
+    auto item = repository.save(make_item(i++)).value();
+    state.ResumeTiming();
+
+    benchmark::DoNotOptimize(repository.remove(item));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_TEMPLATE(BM_Insert, Sqlite)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Insert, Memory)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Find, Sqlite)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Find, Memory)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_LoadBy, Sqlite)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_LoadBy, Memory)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Update, Sqlite)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Update, Memory)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Remove, Sqlite)->Range(1 << 10, 1 << 16);
+BENCHMARK_TEMPLATE(BM_Remove, Memory)->Range(1 << 10, 1 << 16);
@@ -0,0 +1,123 @@
+#include "jdb/database/SqliteDatabase.hpp"
+#include "jdb/database/DataClass.hpp"
+#include "jdb/database/Repository.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+using namespace jdb;
+
+using EventModel = DataClass<"event", Primary<"id">, NoForeign,
+  Field<"id", FieldType::Serial, false>,
+  Field<"kind", FieldType::Int, false>,
+  Field<"payload", FieldType::Text, false> >;
+
+using BenchDatabase = SqliteDatabase<EventModel>;
+
+namespace {
+  std::string const DatabaseName = "transaction_bench.db";
+
+  std::shared_ptr<BenchDatabase> db;
+  std::thread writer;
+  std::atomic<bool> running;
+  std::atomic<int64_t> ingested;
+
+  void remove_database() {
+    std::remove(DatabaseName.c_str());
+    std::remove((DatabaseName + "-wal").c_str());
+    std::remove((DatabaseName + "-shm").c_str());
+  }
+
+  void ingest(Database &db, int64_t rows) {
+    for (int64_t i = 0; i < rows; i++) {
+      EventModel event;
+
+      event["kind"] = i % 8;
+      event["payload"] = fmt::format("event payload {}", i);
+
+      db.insert(event);
+    }
+  }
+
+  // seeds the table and keeps a writer ingesting batches while readers run
+  void start_ingestion([[maybe_unused]] benchmark::State const &state) {
+    remove_database();
+
+    db = std::make_shared<BenchDatabase>(DatabaseName);
+
+    db->write_transaction([](Database &db) { ingest(db, 10000); });
+
+    running = true;
+    ingested = 0;
+
+    writer = std::thread([]() {
+      while (running) {
+        db->write_transaction([](Database &db) { ingest(db, 100); });
+
+        ingested += 100;
+      }
+    });
+  }
+
+  void stop_ingestion([[maybe_unused]] benchmark::State const &state) {
+    running = false;
+
+    writer.join();
+    db.reset();
+
+    remove_database();
+  }
+
+  void report(Database &db) {
+    Repository<EventModel> repository{std::shared_ptr<Database>(&db, [](auto *) {})};
+
+    benchmark::DoNotOptimize(repository.count_by<"kind">(1));
+
+    db.query_string("SELECT kind, COUNT(*), MAX(id) FROM event GROUP BY kind;",
+                    [](std::vector<std::string> const &columns, std::vector<Data> const &values) {
+                      benchmark::DoNotOptimize(values);
+
+                      return true;
+                    });
+  }
+
+  void set_counters(benchmark::State &state, int64_t ingestedBefore) {
+    if (state.thread_index() == 0) {
+      state.counters["ingested"] = benchmark::Counter(
+        static_cast<double>(ingested - ingestedBefore), benchmark::Counter::kIsRate);
+    }
+  }
+}
+
+// reports serialized with the writer through the global transaction lock
+static void BM_ReportInTransaction(benchmark::State &state) {
+  int64_t ingestedBefore = ingested;
+
+  for (auto _: state) {
+    db->transaction([](Database &db) { report(db); });
+  }
+
+  set_counters(state, ingestedBefore);
+}
+
+// reports on pooled reader connections, each over its own snapshot
+static void BM_ReportInReadTransaction(benchmark::State &state) {
+  int64_t ingestedBefore = ingested;
+
+  for (auto _: state) {
+    db->read_transaction([](Database &db) { report(db); });
+  }
+
+  set_counters(state, ingestedBefore);
+}
+
+BENCHMARK(BM_ReportInTransaction)
+  ->Setup(start_ingestion)->Teardown(stop_ingestion)
+  ->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK(BM_ReportInReadTransaction)
+  ->Setup(start_ingestion)->Teardown(stop_ingestion)
+  ->ThreadRange(1, 8)->UseRealTime();
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+
+namespace jdb {
+  struct BackupProgress {
+    int64_t remaining{};
+    int64_t pageCount{};
+    uint64_t steps{};
+    // times the copy went back to the first page because the source changed
+    uint64_t restarts{};
+    bool done{};
+
+    [[nodiscard]] double get_ratio() const {
+      if (pageCount <= 0) {
+        return done ? 1.0 : 0.0;
+      }
+
+      return static_cast<double>(pageCount - remaining) / static_cast<double>(pageCount);
+    }
+  };
+
+  using BackupCallback = std::function<void(BackupProgress const &)>;
+
+  /*
+    Handle of a backup running in the background. wait() blocks until the copy
+    is over and rethrows its failure; cancel() stops it after the current step,
+    leaves the destination untouched and makes wait() throw.
+  */
+  struct BackupJob {
+    void wait() const {
+      std::unique_lock<std::mutex> lk(mMutex);
+
+      mCondition.wait(lk, [&]() { return mFinished; });
+
+      if (mError) {
+        std::rethrow_exception(mError);
+      }
+    }
+
+    void cancel() {
+      mCancelled.store(true, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool is_cancelled() const {
+      return mCancelled.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] bool is_finished() const {
+      std::lock_guard<std::mutex> lk(mMutex);
+
+      return mFinished;
+    }
+
+    [[nodiscard]] BackupProgress get_progress() const {
+      std::lock_guard<std::mutex> lk(mMutex);
+
+      return mProgress;
+    }
+
+    void set_progress(BackupProgress const &progress) {
+      std::lock_guard<std::mutex> lk(mMutex);
+
+      mProgress = progress;
+    }
+
+    void finish(std::exception_ptr error = {}) {
+      {
+        std::lock_guard<std::mutex> lk(mMutex);
+
+        mError = error;
+        mFinished = true;
+      }
+
+      mCondition.notify_all();
+    }
+
+  private:
+    mutable std::mutex mMutex;
+    mutable std::condition_variable mCondition;
+    std::atomic<bool> mCancelled{false};
+    BackupProgress mProgress;
+    std::exception_ptr mError;
+    bool mFinished{false};
+  };
+}
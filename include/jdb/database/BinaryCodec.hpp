@@ -0,0 +1,520 @@
+#pragma once
+
+#include "jdb/database/DataClass.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <bitset>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace jdb {
+  namespace binary {
+    inline void put_varint(std::string &out, uint64_t value) {
+      while (value >= 0x80) {
+        out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+
+        value >>= 7;
+      }
+
+      out.push_back(static_cast<char>(value));
+    }
+
+    inline void put_fixed64(std::string &out, uint64_t value) {
+      for (int i = 0; i < 8; i++) {
+        out.push_back(static_cast<char>(value >> (i * 8)));
+      }
+    }
+
+    inline uint64_t zigzag(int64_t value) {
+      return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+    }
+
+    inline int64_t unzigzag(uint64_t value) {
+      return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+    }
+
+    /*
+      Readers advance offset past the value and return nothing when the buffer
+      ends before it does.
+    */
+    inline std::optional<uint64_t> get_varint(std::string_view buffer, std::size_t &offset) {
+      uint64_t value = 0;
+
+      for (int shift = 0; shift < 64 and offset < buffer.size(); shift += 7) {
+        auto byte = static_cast<uint8_t>(buffer[offset++]);
+
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+        if ((byte & 0x80) == 0) {
+          return value;
+        }
+      }
+
+      return {};
+    }
+
+    inline std::optional<uint64_t> get_fixed64(std::string_view buffer, std::size_t &offset) {
+      if (buffer.size() - offset < 8) {
+        return {};
+      }
+
+      uint64_t value = 0;
+
+      for (int i = 0; i < 8; i++) {
+        value |= static_cast<uint64_t>(static_cast<uint8_t>(buffer[offset++])) << (i * 8);
+      }
+
+      return value;
+    }
+  }
+
+  template<typename Model>
+  struct BinaryCodec;
+
+  /*
+    Compact binary form of models, for caches and result sets spilled to disk:
+
+      header  'j' 'd' 'b' version, schema hash (8 bytes), row count (varint)
+      row     null bitmap (one bit per field, set when null), then each non
+              null field: Serial, Bool and Int as zigzag varints, Decimal as an
+              8 byte IEEE 754 double, Text and Timestamp as a varint length
+              followed by the bytes
+
+    Fixed width values are little endian. Ignored fields are not encoded and
+    restricted (invalid) fields are written as null. Decoding checks the schema
+    hash, so data written for another version of the model is rejected.
+  */
+  template<jmixin::StringLiteral Name, PrimaryConcept PrimaryKeys, ForeignConcept ForeignKeys,
+    FieldConcept... Fields>
+  struct BinaryCodec<DataClass<Name, PrimaryKeys, ForeignKeys, Fields...> > {
+    using Model = DataClass<Name, PrimaryKeys, ForeignKeys, Fields...>;
+
+    static constexpr uint8_t Version = 1;
+
+    static constexpr std::size_t FieldCount = (0 + ... + (Fields::ignore() ? 0 : 1));
+
+    static constexpr std::size_t BitmapSize = (FieldCount + 7) / 8;
+
+    static uint64_t get_schema_hash() {
+      static uint64_t const hash = [] {
+        uint64_t result = 14695981039346656037ULL;
+        auto feed = [&](std::string_view value) {
+          for (unsigned char c: value) {
+            result = (result ^ c) * 1099511628211ULL;
+          }
+
+          result = (result ^ 0xff) * 1099511628211ULL;
+        };
+
+        feed(Model::get_name());
+
+        for_each_field([&]<std::size_t Index, typename Field>(std::size_t) {
+          feed(Field::get_name());
+          feed(fmt::format("{}:{}", static_cast<int>(Field::get_type()), Field::nullable()));
+        });
+
+        return result;
+      }();
+
+      return hash;
+    }
+
+    [[nodiscard]] static std::string encode(Model const &model) {
+      std::string out;
+
+      write_header(out, 1);
+      write_row(out, model);
+
+      return out;
+    }
+
+    /*
+      Appends the whole batch to out, so a caller may reuse its buffer.
+    */
+    static void encode(std::vector<Model> const &models, std::string &out) {
+      write_header(out, models.size());
+
+      for (auto const &model: models) {
+        write_row(out, model);
+      }
+    }
+
+    [[nodiscard]] static std::string encode(std::vector<Model> const &models) {
+      std::string out;
+
+      encode(models, out);
+
+      return out;
+    }
+
+    [[nodiscard]] static Model decode(std::string_view buffer) {
+      Reader reader{buffer};
+
+      if (reader.size() != 1) {
+        throw std::runtime_error(fmt::format(
+          "Expected a single '{}' in binary data, got {}", Model::get_name(), reader.size()));
+      }
+
+      reader.next();
+
+      Model model = reader.get_model();
+
+      reader.next();
+
+      return model;
+    }
+
+    [[nodiscard]] static std::vector<Model> decode_all(std::string_view buffer) {
+      Reader reader{buffer};
+      std::vector<Model> models;
+
+      // the count comes from the buffer, do not trust it further than its size
+      models.reserve(std::min(reader.size(), buffer.size()));
+
+      while (reader.next()) {
+        models.emplace_back(reader.get_model());
+      }
+
+      return models;
+    }
+
+    /*
+      Walks an encoded buffer row by row without copying it: values are read
+      in place when asked for, and text comes back as views into the buffer,
+      which must outlive the reader.
+    */
+    struct Reader {
+      explicit Reader(std::string_view buffer) : mBuffer{buffer} {
+        mOffset = read_header(mBuffer, mCount);
+      }
+
+      [[nodiscard]] std::size_t size() const {
+        return mCount;
+      }
+
+      /*
+        Moves to the next row; false once every row was read.
+      */
+      bool next() {
+        if (mRow == mCount) {
+          if (mOffset != mBuffer.size()) {
+            throw std::runtime_error(fmt::format("Trailing bytes after binary data of '{}'", Model::get_name()));
+          }
+
+          return false;
+        }
+
+        mOffset = scan_row(mBuffer, mOffset, mNulls, mOffsets);
+        mRow++;
+
+        return true;
+      }
+
+      [[nodiscard]] bool is_null(std::string_view name) const {
+        return mNulls.test(get_slot(name));
+      }
+
+      [[nodiscard]] std::optional<int64_t> get_int(std::string_view name) const {
+        std::size_t slot = get_slot(name);
+
+        if (mNulls.test(slot) or !is_integer(get_types()[slot])) {
+          return {};
+        }
+
+        std::size_t offset = mOffsets[slot];
+
+        return binary::unzigzag(*binary::get_varint(mBuffer, offset));
+      }
+
+      [[nodiscard]] std::optional<double> get_decimal(std::string_view name) const {
+        std::size_t slot = get_slot(name);
+
+        if (mNulls.test(slot) or get_types()[slot] != FieldType::Decimal) {
+          return {};
+        }
+
+        std::size_t offset = mOffsets[slot];
+
+        return std::bit_cast<double>(*binary::get_fixed64(mBuffer, offset));
+      }
+
+      [[nodiscard]] std::optional<std::string_view> get_text(std::string_view name) const {
+        std::size_t slot = get_slot(name);
+
+        if (mNulls.test(slot) or !is_text(get_types()[slot])) {
+          return {};
+        }
+
+        std::size_t offset = mOffsets[slot];
+        std::size_t size = *binary::get_varint(mBuffer, offset);
+
+        return mBuffer.substr(offset, size);
+      }
+
+      /*
+        Copies the current row out of the buffer.
+      */
+      [[nodiscard]] Model get_model() const {
+        Model model;
+
+        for_each_field([&]<std::size_t Index, typename Field>(std::size_t slot) {
+          Data &value = model.template get_field<Index>();
+
+          if (mNulls.test(slot)) {
+            value = nullptr;
+
+            return;
+          }
+
+          std::size_t offset = mOffsets[slot];
+
+          if constexpr (is_integer(Field::get_type())) {
+            value = binary::unzigzag(*binary::get_varint(mBuffer, offset));
+          } else if constexpr (Field::get_type() == FieldType::Decimal) {
+            value = std::bit_cast<double>(*binary::get_fixed64(mBuffer, offset));
+          } else {
+            std::size_t size = *binary::get_varint(mBuffer, offset);
+
+            value = std::string{mBuffer.substr(offset, size)};
+          }
+        });
+
+        model.clear_dirty();
+
+        return model;
+      }
+
+    private:
+      std::string_view mBuffer;
+      std::size_t mOffset{};
+      std::size_t mCount{};
+      std::size_t mRow{};
+      std::bitset<FieldCount> mNulls;
+      std::array<std::size_t, FieldCount> mOffsets{};
+    };
+
+  private:
+    static constexpr bool is_integer(FieldType type) {
+      return type == FieldType::Serial or type == FieldType::Bool or type == FieldType::Int;
+    }
+
+    static constexpr bool is_text(FieldType type) {
+      return type == FieldType::Text or type == FieldType::Timestamp;
+    }
+
+    /*
+      Calls callback.template operator()<Index, Field>(slot) for every encoded
+      field, Index being its position in the model and slot its position in
+      the encoded row.
+    */
+    template<typename F>
+    static void for_each_field(F &&callback) {
+      [&]<std::size_t... I>(std::index_sequence<I...>) {
+        std::size_t slot = 0;
+
+        ([&] {
+          using Field = std::tuple_element_t<I, std::tuple<Fields...> >;
+
+          if constexpr (!Field::ignore()) {
+            callback.template operator()<I, Field>(slot++);
+          }
+        }(), ...);
+      }(std::index_sequence_for<Fields...>{});
+    }
+
+    static std::array<FieldType, FieldCount> const &get_types() {
+      static std::array<FieldType, FieldCount> const types = [] {
+        std::array<FieldType, FieldCount> result{};
+
+        for_each_field([&]<std::size_t Index, typename Field>(std::size_t slot) {
+          result[slot] = Field::get_type();
+        });
+
+        return result;
+      }();
+
+      return types;
+    }
+
+    static std::size_t get_slot(std::string_view name) {
+      static std::array<std::string, FieldCount> const names = [] {
+        std::array<std::string, FieldCount> result;
+
+        for_each_field([&]<std::size_t Index, typename Field>(std::size_t slot) {
+          result[slot] = Field::get_name();
+        });
+
+        return result;
+      }();
+
+      for (std::size_t i = 0; i < FieldCount; i++) {
+        if (names[i] == name) {
+          return i;
+        }
+      }
+
+      throw std::runtime_error(fmt::format("Field '{}' not available in '{}'", name, Model::get_name()));
+    }
+
+    [[noreturn]] static void truncated() {
+      throw std::runtime_error(fmt::format("Truncated binary data of '{}'", Model::get_name()));
+    }
+
+    static void write_header(std::string &out, std::size_t count) {
+      out.append({'j', 'd', 'b', static_cast<char>(Version)});
+
+      binary::put_fixed64(out, get_schema_hash());
+      binary::put_varint(out, count);
+    }
+
+    static void write_row(std::string &out, Model const &model) {
+      std::size_t bitmap = out.size();
+
+      out.append(BitmapSize, '\0');
+
+      for_each_field([&]<std::size_t Index, typename Field>(std::size_t slot) {
+        Data const &value = model.template get_field<Index>();
+        constexpr FieldType type = Field::get_type();
+        bool encoded = false;
+
+        value.get_value(overloaded{
+          [&]([[maybe_unused]] InvalidData arg) {
+            out[bitmap + slot / 8] |= static_cast<char>(1 << (slot % 8));
+
+            encoded = true;
+          },
+          [&]([[maybe_unused]] std::nullptr_t arg) {
+            out[bitmap + slot / 8] |= static_cast<char>(1 << (slot % 8));
+
+            encoded = true;
+          },
+          [&](std::integral auto arg) {
+            if constexpr (is_integer(type)) {
+              binary::put_varint(out, binary::zigzag(static_cast<int64_t>(arg)));
+
+              encoded = true;
+            } else if constexpr (type == FieldType::Decimal) {
+              binary::put_fixed64(out, std::bit_cast<uint64_t>(static_cast<double>(arg)));
+
+              encoded = true;
+            }
+          },
+          [&](double arg) {
+            if constexpr (type == FieldType::Decimal) {
+              binary::put_fixed64(out, std::bit_cast<uint64_t>(arg));
+
+              encoded = true;
+            }
+          },
+          [&](std::pmr::string const &arg) {
+            if constexpr (is_text(type)) {
+              binary::put_varint(out, arg.size());
+
+              out.append(arg);
+
+              encoded = true;
+            }
+          }
+        });
+
+        if (!encoded) {
+          throw std::runtime_error(fmt::format(
+            "Unable to encode field '{}' of '{}': value does not match the field type",
+            Field::get_name(), Model::get_name()));
+        }
+      });
+    }
+
+    static std::size_t read_header(std::string_view buffer, std::size_t &count) {
+      std::size_t offset = 4;
+
+      if (buffer.size() < 4 or buffer.substr(0, 3) != "jdb") {
+        throw std::runtime_error(fmt::format("Invalid binary data of '{}'", Model::get_name()));
+      }
+
+      if (static_cast<uint8_t>(buffer[3]) != Version) {
+        throw std::runtime_error(fmt::format(
+          "Unsupported binary version {} of '{}'", static_cast<uint8_t>(buffer[3]), Model::get_name()));
+      }
+
+      auto hash = binary::get_fixed64(buffer, offset);
+
+      if (!hash) {
+        truncated();
+      }
+
+      if (*hash != get_schema_hash()) {
+        throw std::runtime_error(fmt::format(
+          "Binary data was encoded for another schema of '{}'", Model::get_name()));
+      }
+
+      auto rows = binary::get_varint(buffer, offset);
+
+      if (!rows) {
+        truncated();
+      }
+
+      count = *rows;
+
+      return offset;
+    }
+
+    /*
+      Checks the row bounds and records where each value starts.
+    */
+    static std::size_t scan_row(std::string_view buffer, std::size_t offset, std::bitset<FieldCount> &nulls,
+                                std::array<std::size_t, FieldCount> &offsets) {
+      if (buffer.size() - offset < BitmapSize) {
+        truncated();
+      }
+
+      for (std::size_t slot = 0; slot < FieldCount; slot++) {
+        nulls[slot] = (static_cast<uint8_t>(buffer[offset + slot / 8]) >> (slot % 8)) & 1;
+      }
+
+      offset += BitmapSize;
+
+      auto const &types = get_types();
+
+      for (std::size_t slot = 0; slot < FieldCount; slot++) {
+        if (nulls[slot]) {
+          continue;
+        }
+
+        offsets[slot] = offset;
+
+        if (is_integer(types[slot])) {
+          if (!binary::get_varint(buffer, offset)) {
+            truncated();
+          }
+        } else if (types[slot] == FieldType::Decimal) {
+          if (!binary::get_fixed64(buffer, offset)) {
+            truncated();
+          }
+        } else {
+          auto size = binary::get_varint(buffer, offset);
+
+          if (!size or buffer.size() - offset < *size) {
+            truncated();
+          }
+
+          offset += *size;
+        }
+      }
+
+      return offset;
+    }
+  };
+
+  template<typename Model>
+  using BinaryReader = typename BinaryCodec<Model>::Reader;
+}
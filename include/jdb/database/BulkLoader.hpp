@@ -0,0 +1,847 @@
+#pragma once
+
+#include "jdb/database/DataClass.hpp"
+#include "jdb/database/Database.hpp"
+#include "jdb/database/Repository.hpp"
+#include "jdb/utils/Scope.hpp"
+
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include <fmt/format.h>
+
+namespace jdb {
+  enum class ImportFormat { Csv, Ndjson };
+
+  struct ImportOptions {
+    ImportFormat format{ImportFormat::Csv};
+    // parser threads, 0 uses one per hardware thread
+    std::size_t threads{0};
+    // input is split in chunks of about this size, on record boundaries
+    std::size_t chunkSize{4 * 1024 * 1024};
+    std::size_t rowsPerTransaction{50000};
+    std::size_t rowsPerStatement{256};
+    // drops the non unique indexes of the table while loading
+    bool deferIndexes{false};
+    char delimiter{','};
+    // the first CSV record names the columns, otherwise the fields are given in declaration order
+    bool header{true};
+  };
+
+  struct ImportStats {
+    std::size_t rows{};
+    std::size_t chunks{};
+    std::size_t transactions{};
+    std::chrono::milliseconds elapsed{};
+  };
+
+  struct ImportError : public std::runtime_error {
+    ImportError(std::size_t offset, std::string const &message)
+      : std::runtime_error(fmt::format("record at byte {}: {}", offset, message)), mOffset{offset} {
+    }
+
+    [[nodiscard]] std::size_t get_offset() const {
+      return mOffset;
+    }
+
+  private:
+    std::size_t mOffset;
+  };
+
+  template<typename Model>
+  struct BulkLoader;
+
+  /*
+    Loads CSV (RFC 4180: quoted fields, "" escapes, CRLF or LF) or NDJSON (one
+    flat object per line) into the table of a model. The input is cut in
+    chunks on record boundaries, parsed into typed models on a Scope and
+    written by the calling thread alone, in input order, with multi-row
+    inserts grouped in transactions of about rowsPerTransaction rows; parsing
+    runs ahead of the writer by at most two chunks per thread. Values are
+    checked against the fields (type, not null) while parsing, so a bad
+    record fails with its byte offset before anything past its chunk is
+    written. Transactions already committed are kept: the import is not
+    atomic as a whole.
+
+    In CSV an empty unquoted field is null and an empty quoted one is the
+    empty string. Bool fields take true/false or 1/0.
+  */
+  template<jmixin::StringLiteral Name, PrimaryConcept PrimaryKeys, ForeignConcept ForeignKeys,
+    FieldConcept... Fields>
+  struct BulkLoader<DataClass<Name, PrimaryKeys, ForeignKeys, Fields...> > {
+    using Model = DataClass<Name, PrimaryKeys, ForeignKeys, Fields...>;
+
+    static constexpr std::size_t FieldCount = (0 + ... + (Fields::ignore() ? 0 : 1));
+
+    explicit BulkLoader(std::shared_ptr<Database> db, ImportOptions options = {})
+      : mDb{std::move(db)}, mOptions{options} {
+      if (mOptions.threads == 0) {
+        mOptions.threads = std::max<std::size_t>(std::thread::hardware_concurrency(), 1);
+      }
+
+      mOptions.chunkSize = std::max<std::size_t>(mOptions.chunkSize, 1);
+      mOptions.rowsPerTransaction = std::max<std::size_t>(mOptions.rowsPerTransaction, 1);
+      mOptions.rowsPerStatement = std::max<std::size_t>(mOptions.rowsPerStatement, 1);
+    }
+
+    explicit BulkLoader(Repository<Model> &repository, ImportOptions options = {})
+      : BulkLoader(repository.get_database(), options) {
+    }
+
+    /*
+      The file is memory mapped, not read.
+    */
+    ImportStats load_file(std::filesystem::path const &path) {
+      std::error_code error;
+
+      if (auto size = std::filesystem::file_size(path, error); error) {
+        throw std::runtime_error(fmt::format("Unable to open '{}': {}", path.string(), error.message()));
+      } else if (size == 0) {
+        return load({});
+      }
+
+      boost::iostreams::mapped_file_source file;
+
+      try {
+        file.open(path.string());
+      } catch (std::exception const &e) {
+        throw std::runtime_error(fmt::format("Unable to map '{}': {}", path.string(), e.what()));
+      }
+
+      return load({file.data(), file.size()});
+    }
+
+    ImportStats load(std::string_view input) {
+      auto start = std::chrono::steady_clock::now();
+      ImportStats stats;
+      std::size_t position = 0;
+
+      mColumns.clear();
+
+      if (mOptions.format == ImportFormat::Csv) {
+        read_columns(input, position);
+      }
+
+      with_deferred_indexes([&] {
+        Scope scope{mOptions.threads};
+        std::deque<std::future<std::vector<Model> > > pending;
+
+        auto fill = [&] {
+          while (position < input.size() and pending.size() < mOptions.threads * 2) {
+            std::size_t end = next_boundary(input, position);
+
+            pending.push_back(scope.post([this, chunk = input.substr(position, end - position), offset = position] {
+              return parse(chunk, offset);
+            }));
+
+            position = end;
+            stats.chunks++;
+          }
+        };
+
+        fill();
+
+        while (!pending.empty()) {
+          std::size_t rows = 0;
+
+          mDb->write_transaction([&](Database &db) {
+            while (!pending.empty() and rows < mOptions.rowsPerTransaction) {
+              std::vector<Model> batch = pending.front().get();
+
+              pending.pop_front();
+              fill();
+
+              db.insert_all(batch, mOptions.rowsPerStatement);
+
+              rows += batch.size();
+            }
+          });
+
+          stats.rows += rows;
+          stats.transactions++;
+        }
+      });
+
+      stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+
+      return stats;
+    }
+
+  private:
+    struct Column {
+      std::string name;
+      FieldType type;
+      // accepts null: nullable, serial or with a default value
+      bool optional;
+      Data &(*get)(Model &);
+    };
+
+    struct Token {
+      std::string_view view;
+      std::string owned;
+      bool quoted{false};
+      bool escaped{false};
+      bool null{false};
+
+      [[nodiscard]] std::string_view get_text() const {
+        return escaped ? std::string_view{owned} : view;
+      }
+    };
+
+    std::shared_ptr<Database> mDb;
+    ImportOptions mOptions;
+    // slot of each CSV column
+    std::vector<std::size_t> mColumns;
+
+    template<typename F>
+    static void for_each_field(F &&callback) {
+      [&]<std::size_t... I>(std::index_sequence<I...>) {
+        std::size_t slot = 0;
+
+        ([&] {
+          using Field = std::tuple_element_t<I, std::tuple<Fields...> >;
+
+          if constexpr (!Field::ignore()) {
+            callback.template operator()<I, Field>(slot++);
+          }
+        }(), ...);
+      }(std::index_sequence_for<Fields...>{});
+    }
+
+    static std::array<Column, FieldCount> const &get_schema() {
+      static std::array<Column, FieldCount> const schema = [] {
+        std::array<Column, FieldCount> result;
+
+        for_each_field([&]<std::size_t Index, typename Field>(std::size_t slot) {
+          result[slot] = {
+            Field::get_name(), Field::get_type(),
+            Field::nullable() or Field::get_default().has_value() or Field::get_type() == FieldType::Serial,
+            [](Model &model) -> Data & { return model.template get_field<Index>(); }
+          };
+        });
+
+        return result;
+      }();
+
+      return schema;
+    }
+
+    static std::optional<std::size_t> find_slot(std::string_view name) {
+      auto const &schema = get_schema();
+
+      for (std::size_t slot = 0; slot < FieldCount; slot++) {
+        if (schema[slot].name == name) {
+          return slot;
+        }
+      }
+
+      return {};
+    }
+
+    // copied per row: a fresh model would check its field list every time
+    static Model const &get_prototype() {
+      static Model const prototype;
+
+      return prototype;
+    }
+
+    void read_columns(std::string_view input, std::size_t &position) {
+      std::vector<bool> seen(FieldCount);
+
+      if (!mOptions.header) {
+        for (std::size_t slot = 0; slot < FieldCount; slot++) {
+          mColumns.push_back(slot);
+        }
+
+        return;
+      }
+
+      std::vector<Token> tokens;
+
+      if (!read_csv_record(input, position, 0, tokens)) {
+        return;
+      }
+
+      for (auto const &token: tokens) {
+        auto slot = find_slot(token.get_text());
+
+        if (!slot) {
+          throw ImportError(0, fmt::format("unknown column '{}' in '{}'", token.get_text(), Model::get_name()));
+        }
+
+        if (seen[*slot]) {
+          throw ImportError(0, fmt::format("duplicated column '{}'", token.get_text()));
+        }
+
+        seen[*slot] = true;
+
+        mColumns.push_back(*slot);
+      }
+
+      for (std::size_t slot = 0; slot < FieldCount; slot++) {
+        if (!seen[slot] and !get_schema()[slot].optional) {
+          throw ImportError(0, fmt::format("missing column '{}' of '{}'", get_schema()[slot].name, Model::get_name()));
+        }
+      }
+    }
+
+    /*
+      End of the chunk starting at position: the first record boundary past
+      chunkSize bytes. Quotes are counted from the start of the chunk, so a
+      line break inside a quoted CSV field never splits it.
+    */
+    std::size_t next_boundary(std::string_view input, std::size_t position) const {
+      if (input.size() - position <= mOptions.chunkSize) {
+        return input.size();
+      }
+
+      std::size_t end = position + mOptions.chunkSize;
+
+      if (mOptions.format == ImportFormat::Ndjson) {
+        auto newline = input.find('\n', end);
+
+        return newline == std::string_view::npos ? input.size() : newline + 1;
+      }
+
+      bool quoted = std::count(input.begin() + position, input.begin() + end, '"') % 2 != 0;
+
+      for (; end < input.size(); end++) {
+        if (input[end] == '"') {
+          quoted = !quoted;
+        } else if (input[end] == '\n' and !quoted) {
+          return end + 1;
+        }
+      }
+
+      return input.size();
+    }
+
+    std::vector<Model> parse(std::string_view chunk, std::size_t offset) const {
+      std::vector<Model> rows;
+      std::vector<Token> tokens;
+      std::size_t position = 0;
+
+      rows.reserve(chunk.size() / 64);
+
+      if (mOptions.format == ImportFormat::Csv) {
+        for (;;) {
+          std::size_t record = position;
+
+          if (!read_csv_record(chunk, position, offset, tokens)) {
+            break;
+          }
+
+          if (tokens.size() != mColumns.size()) {
+            throw ImportError(offset + record,
+                              fmt::format("expected {} fields, got {}", mColumns.size(), tokens.size()));
+          }
+
+          Model &row = rows.emplace_back(get_prototype());
+
+          for (std::size_t i = 0; i < tokens.size(); i++) {
+            set_value(row, mColumns[i], tokens[i], offset + record);
+          }
+        }
+      } else {
+        std::vector<bool> seen(FieldCount);
+
+        while (position < chunk.size()) {
+          std::size_t record = position;
+          std::size_t end = chunk.find('\n', position);
+
+          if (end == std::string_view::npos) {
+            end = chunk.size();
+          }
+
+          std::string_view line = chunk.substr(position, end - position);
+
+          position = end + 1;
+
+          if (line.find_first_not_of(" \t\r") == std::string_view::npos) {
+            continue;
+          }
+
+          Model &row = rows.emplace_back(get_prototype());
+
+          read_json_record(line, offset + record, row, seen, tokens);
+        }
+      }
+
+      return rows;
+    }
+
+    void set_value(Model &row, std::size_t slot, Token const &token, std::size_t offset) const {
+      auto const &column = get_schema()[slot];
+      Data &value = column.get(row);
+
+      if (token.null) {
+        if (!column.optional) {
+          throw ImportError(offset, fmt::format("field '{}' is not null", column.name));
+        }
+
+        value = nullptr;
+
+        return;
+      }
+
+      std::string_view text = token.get_text();
+
+      auto invalid = [&](std::string_view expected) {
+        return ImportError(offset, fmt::format("field '{}' expects {}, got '{}'", column.name, expected, text));
+      };
+
+      switch (column.type) {
+        case FieldType::Serial:
+        case FieldType::Int: {
+          int64_t number{};
+          auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+
+          if (error != std::errc{} or end != text.data() + text.size()) {
+            throw invalid("an integer");
+          }
+
+          value = number;
+
+          break;
+        }
+        case FieldType::Bool:
+          if (text == "true" or text == "1") {
+            value = true;
+          } else if (text == "false" or text == "0") {
+            value = false;
+          } else {
+            throw invalid("a boolean");
+          }
+
+          break;
+        case FieldType::Decimal: {
+          double number{};
+          auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+
+          if (error != std::errc{} or end != text.data() + text.size()) {
+            throw invalid("a number");
+          }
+
+          value = number;
+
+          break;
+        }
+        case FieldType::Text:
+        case FieldType::Timestamp:
+          value = std::string{text};
+
+          break;
+      }
+    }
+
+    /*
+      Reads the record at position, which is left past its line break.
+      Returns false once the input is over; blank lines are skipped.
+    */
+    bool read_csv_record(std::string_view input, std::size_t &position, std::size_t offset,
+                         std::vector<Token> &tokens) const {
+      while (position < input.size() and (input[position] == '\n' or input[position] == '\r')) {
+        position++;
+      }
+
+      if (position >= input.size()) {
+        return false;
+      }
+
+      std::size_t record = position;
+      std::size_t count = 0;
+
+      for (;;) {
+        if (count == tokens.size()) {
+          tokens.emplace_back();
+        }
+
+        Token &token = tokens[count++];
+
+        token.owned.clear();
+        token.quoted = false;
+        token.escaped = false;
+
+        if (position < input.size() and input[position] == '"') {
+          std::size_t start = ++position;
+
+          token.quoted = true;
+
+          for (;;) {
+            auto quote = input.find('"', position);
+
+            if (quote == std::string_view::npos) {
+              throw ImportError(offset + record, "unterminated quoted field");
+            }
+
+            if (quote + 1 < input.size() and input[quote + 1] == '"') {
+              token.owned.append(input.substr(position, quote + 1 - position));
+              token.escaped = true;
+              position = quote + 2;
+
+              continue;
+            }
+
+            if (token.escaped) {
+              token.owned.append(input.substr(position, quote - position));
+            } else {
+              token.view = input.substr(start, quote - start);
+            }
+
+            position = quote + 1;
+
+            break;
+          }
+        } else {
+          std::size_t start = position;
+
+          while (position < input.size() and input[position] != mOptions.delimiter and input[position] != '\n') {
+            position++;
+          }
+
+          token.view = input.substr(start, position - start);
+
+          if (!token.view.empty() and token.view.back() == '\r') {
+            token.view.remove_suffix(1);
+          }
+        }
+
+        token.null = !token.quoted and token.view.empty();
+
+        if (position >= input.size()) {
+          break;
+        }
+
+        char c = input[position];
+
+        if (c == mOptions.delimiter) {
+          position++;
+
+          continue;
+        }
+
+        if (c == '\r' and position + 1 < input.size() and input[position + 1] == '\n') {
+          position++;
+        }
+
+        if (input[position] != '\n') {
+          throw ImportError(offset + record, "unexpected character after quoted field");
+        }
+
+        position++;
+
+        break;
+      }
+
+      tokens.resize(count);
+
+      return true;
+    }
+
+    void read_json_record(std::string_view line, std::size_t offset, Model &row, std::vector<bool> &seen,
+                          std::vector<Token> &tokens) const {
+      std::size_t position = 0;
+
+      auto fail = [&](std::string_view message) {
+        return ImportError(offset, fmt::format("{} at column {}", message, position + 1));
+      };
+
+      auto skip = [&] {
+        while (position < line.size() and (line[position] == ' ' or line[position] == '\t' or line[position] == '\r')) {
+          position++;
+        }
+      };
+
+      auto expect = [&](char c) {
+        skip();
+
+        if (position >= line.size() or line[position] != c) {
+          throw fail(fmt::format("expected '{}'", c));
+        }
+
+        position++;
+      };
+
+      if (tokens.size() < 2) {
+        tokens.resize(2);
+      }
+
+      Token &key = tokens[0];
+      Token &value = tokens[1];
+
+      seen.assign(FieldCount, false);
+
+      expect('{');
+      skip();
+
+      if (position < line.size() and line[position] == '}') {
+        position++;
+      } else {
+        for (;;) {
+          skip();
+
+          if (position >= line.size() or line[position] != '"') {
+            throw fail("expected a key");
+          }
+
+          read_json_string(line, position, key, fail);
+          expect(':');
+          skip();
+
+          if (position >= line.size()) {
+            throw fail("expected a value");
+          }
+
+          value.owned.clear();
+          value.escaped = false;
+          value.quoted = false;
+          value.null = false;
+
+          char c = line[position];
+
+          if (c == '"') {
+            read_json_string(line, position, value, fail);
+          } else if (c == '{' or c == '[') {
+            throw fail("nested values are not supported");
+          } else {
+            std::size_t start = position;
+
+            while (position < line.size() and line[position] != ',' and line[position] != '}' and
+                   line[position] != ' ' and line[position] != '\t' and line[position] != '\r') {
+              position++;
+            }
+
+            value.view = line.substr(start, position - start);
+
+            if (value.view == "null") {
+              value.null = true;
+            } else if (value.view.empty()) {
+              throw fail("expected a value");
+            }
+          }
+
+          auto slot = find_slot(key.get_text());
+
+          if (!slot) {
+            throw ImportError(offset, fmt::format("unknown field '{}' in '{}'", key.get_text(), Model::get_name()));
+          }
+
+          seen[*slot] = true;
+
+          set_value(row, *slot, value, offset);
+
+          skip();
+
+          if (position < line.size() and line[position] == ',') {
+            position++;
+
+            continue;
+          }
+
+          expect('}');
+
+          break;
+        }
+      }
+
+      skip();
+
+      if (position != line.size()) {
+        throw fail("trailing characters");
+      }
+
+      for (std::size_t slot = 0; slot < FieldCount; slot++) {
+        if (!seen[slot] and !get_schema()[slot].optional) {
+          throw ImportError(offset, fmt::format("missing field '{}'", get_schema()[slot].name));
+        }
+      }
+    }
+
+    static void read_json_string(std::string_view line, std::size_t &position, Token &token, auto const &fail) {
+      std::size_t start = ++position;
+
+      token.owned.clear();
+      token.quoted = true;
+      token.escaped = false;
+      token.null = false;
+
+      for (;;) {
+        auto stop = line.find_first_of("\"\\", position);
+
+        if (stop == std::string_view::npos) {
+          throw fail("unterminated string");
+        }
+
+        if (line[stop] == '"') {
+          if (token.escaped) {
+            token.owned.append(line.substr(position, stop - position));
+          } else {
+            token.view = line.substr(start, stop - start);
+          }
+
+          position = stop + 1;
+
+          return;
+        }
+
+        if (!token.escaped) {
+          token.owned.assign(line.substr(start, stop - start));
+          token.escaped = true;
+        } else {
+          token.owned.append(line.substr(position, stop - position));
+        }
+
+        position = stop + 1;
+
+        if (position >= line.size()) {
+          throw fail("unterminated string");
+        }
+
+        switch (char c = line[position++]) {
+          case '"':
+          case '\\':
+          case '/':
+            token.owned.push_back(c);
+            break;
+          case 'b':
+            token.owned.push_back('\b');
+            break;
+          case 'f':
+            token.owned.push_back('\f');
+            break;
+          case 'n':
+            token.owned.push_back('\n');
+            break;
+          case 'r':
+            token.owned.push_back('\r');
+            break;
+          case 't':
+            token.owned.push_back('\t');
+            break;
+          case 'u': {
+            uint32_t code = read_hex(line, position, fail);
+
+            if (code >= 0xd800 and code < 0xdc00 and line.substr(position, 2) == "\\u") {
+              position += 2;
+
+              uint32_t low = read_hex(line, position, fail);
+
+              if (low < 0xdc00 or low >= 0xe000) {
+                throw fail("invalid surrogate pair");
+              }
+
+              code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+            }
+
+            append_utf8(token.owned, code);
+
+            break;
+          }
+          default:
+            throw fail("invalid escape");
+        }
+      }
+    }
+
+    static uint32_t read_hex(std::string_view line, std::size_t &position, auto const &fail) {
+      uint32_t code{};
+      std::string_view digits = line.substr(position, 4);
+      auto [end, error] = std::from_chars(digits.data(), digits.data() + digits.size(), code, 16);
+
+      if (digits.size() != 4 or error != std::errc{} or end != digits.data() + 4) {
+        throw fail("invalid unicode escape");
+      }
+
+      position += 4;
+
+      return code;
+    }
+
+    static void append_utf8(std::string &out, uint32_t code) {
+      if (code < 0x80) {
+        out.push_back(static_cast<char>(code));
+      } else if (code < 0x800) {
+        out.push_back(static_cast<char>(0xc0 | (code >> 6)));
+        out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+      } else if (code < 0x10000) {
+        out.push_back(static_cast<char>(0xe0 | (code >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+      } else {
+        out.push_back(static_cast<char>(0xf0 | (code >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3f)));
+        out.push_back(static_cast<char>(0x80 | (code & 0x3f)));
+      }
+    }
+
+    /*
+      Runs the load with the non unique indexes of the table dropped, then
+      builds them again in one pass, whether the load succeeded or not.
+    */
+    template<typename F>
+    void with_deferred_indexes(F &&load) {
+      if (!mOptions.deferIndexes) {
+        load();
+
+        return;
+      }
+
+      std::vector<std::pair<std::string, std::string> > indexes;
+
+      mDb->query_string(
+        fmt::format("SELECT name, sql FROM sqlite_master WHERE type = 'index' AND tbl_name = '{}' AND sql IS NOT NULL "
+                    "AND sql NOT LIKE 'CREATE UNIQUE%';", Model::get_name()),
+        [&](std::vector<std::string> const &, std::vector<Data> const &values) {
+          indexes.emplace_back(values[0].get_text().value_or(""), values[1].get_text().value_or(""));
+
+          return true;
+        });
+
+      if (indexes.empty()) {
+        load();
+
+        return;
+      }
+
+      mDb->write_transaction([&](Database &db) {
+        for (auto const &[name, sql]: indexes) {
+          db.query_string(fmt::format("DROP INDEX \"{}\";", name), [](auto...) { return false; });
+        }
+      });
+
+      auto restore = [&] {
+        mDb->write_transaction([&](Database &db) {
+          for (auto const &[name, sql]: indexes) {
+            db.query_string(sql + ";", [](auto...) { return false; });
+          }
+        });
+      };
+
+      try {
+        load();
+      } catch (...) {
+        restore();
+
+        throw;
+      }
+
+      restore();
+    }
+  };
+}
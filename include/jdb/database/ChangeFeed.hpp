@@ -0,0 +1,281 @@
+#pragma once
+
+#include "jdb/utils/State.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sqlite3.h>
+
+namespace jdb {
+  enum class ChangeOperation { Insert, Update, Delete };
+
+  struct Change {
+    ChangeOperation operation;
+    std::string table;
+    int64_t rowId;
+
+    bool operator==(Change const &) const = default;
+  };
+
+  /*
+    Rows changed by one committed transaction, in the order they were written.
+  */
+  using ChangeSet = std::vector<Change>;
+
+  /*
+    Collects the rows touched through a connection from the sqlite update,
+    commit and rollback hooks and hands them to observers once committed, one
+    ChangeSet per transaction. Nothing is collected while there are no
+    observers. sqlite does not report changes to WITHOUT ROWID tables, nor
+    rows removed by truncating DELETEs or DROP TABLE.
+  */
+  struct ChangeFeed {
+    using Observer = std::function<void(ChangeSet const &)>;
+
+    using ErrorHandler = std::function<void(std::exception_ptr)>;
+
+    ChangeFeed() = default;
+
+    ChangeFeed(ChangeFeed const &) = delete;
+
+    ChangeFeed &operator=(ChangeFeed const &) = delete;
+
+    void attach(sqlite3 *handle) {
+      sqlite3_update_hook(handle, &on_update, this);
+      sqlite3_commit_hook(handle, &on_commit, this);
+      sqlite3_rollback_hook(handle, &on_rollback, this);
+    }
+
+    /*
+      Observes every table; the returned id is given back to unsubscribe().
+    */
+    uint64_t subscribe(Observer observer) {
+      std::lock_guard<std::mutex> lk(mMutex);
+
+      mObservers.emplace(++mLastId, std::make_shared<Observer>(std::move(observer)));
+      mActive.store(true, std::memory_order_relaxed);
+
+      return mLastId;
+    }
+
+    void unsubscribe(uint64_t id) {
+      std::lock_guard<std::mutex> lk(mMutex);
+
+      mObservers.erase(id);
+      mActive.store(!mObservers.empty() or !mStates.empty(), std::memory_order_relaxed);
+    }
+
+    /*
+      State notified with the changes of a single table, for each transaction
+      that touched it.
+    */
+    VolatileState<ChangeSet> &get_state(std::string const &table) {
+      std::lock_guard<std::mutex> lk(mMutex);
+
+      auto &state = mStates[table];
+
+      if (!state) {
+        state = std::make_unique<VolatileState<ChangeSet> >();
+      }
+
+      mActive.store(true, std::memory_order_relaxed);
+
+      return *state;
+    }
+
+    template<typename Model>
+    VolatileState<ChangeSet> &get_state() {
+      return get_state(Model::get_name());
+    }
+
+    /*
+      Receives what an observer throws; by default it is written to std::clog.
+    */
+    void set_error_handler(ErrorHandler handler) {
+      std::lock_guard<std::mutex> lk(mMutex);
+
+      mErrorHandler = std::make_shared<ErrorHandler>(std::move(handler));
+    }
+
+    /*
+      Observer calls that threw so far.
+    */
+    [[nodiscard]] uint64_t get_failures() const {
+      return mFailures.load(std::memory_order_relaxed);
+    }
+
+    /*
+      Position of the changes collected so far in the open transaction, so a
+      rolled back savepoint may drop its own.
+    */
+    [[nodiscard]] std::size_t mark() {
+      std::lock_guard<std::mutex> lk(mMutex);
+
+      return mPending.size();
+    }
+
+    void rollback_to(std::size_t mark) {
+      std::lock_guard<std::mutex> lk(mMutex);
+
+      if (mark < mPending.size()) {
+        mPending.resize(mark);
+      }
+    }
+
+    /*
+      Called once a statement or COMMIT that may have fired the commit hook has
+      returned successfully: its batch can no longer be rolled back.
+    */
+    void settle() {
+      std::lock_guard<std::mutex> lk(mMutex);
+
+      mInFlight = false;
+    }
+
+    /*
+      Delivers the committed transactions. Observers run outside of sqlite
+      callbacks, so they may use the database; a call made while another one
+      is delivering returns at once and its batches go out in commit order.
+      The transactions are already committed, so nothing an observer throws
+      reaches the writer: it is counted, handed to the error handler and the
+      remaining observers still get the batch.
+    */
+    void publish() {
+      std::unique_lock<std::mutex> lk(mMutex);
+
+      if (mPublishing or mCommitted.empty()) {
+        return;
+      }
+
+      mPublishing = true;
+
+      while (!mCommitted.empty()) {
+        ChangeSet changes = std::move(mCommitted.front());
+
+        mCommitted.pop_front();
+
+        std::vector<std::shared_ptr<Observer> > observers;
+        std::map<std::string_view, std::pair<VolatileState<ChangeSet> *, ChangeSet> > tables;
+        std::shared_ptr<ErrorHandler> handler = mErrorHandler;
+
+        for (auto const &[id, observer]: mObservers) {
+          observers.push_back(observer);
+        }
+
+        for (auto const &change: changes) {
+          if (auto it = mStates.find(change.table); it != mStates.end()) {
+            auto &[state, subset] = tables[it->first];
+
+            state = it->second.get();
+            subset.push_back(change);
+          }
+        }
+
+        lk.unlock();
+
+        for (auto const &observer: observers) {
+          deliver(handler, [&] { (*observer)(changes); });
+        }
+
+        for (auto &[table, item]: tables) {
+          deliver(handler, [&] { item.first->notify(item.second); });
+        }
+
+        lk.lock();
+      }
+
+      mPublishing = false;
+    }
+
+  private:
+    std::mutex mMutex;
+    std::atomic<bool> mActive{false};
+    std::map<uint64_t, std::shared_ptr<Observer> > mObservers;
+    std::map<std::string, std::unique_ptr<VolatileState<ChangeSet> >, std::less<> > mStates;
+    uint64_t mLastId{};
+    ChangeSet mPending;
+    std::deque<ChangeSet> mCommitted;
+    std::shared_ptr<ErrorHandler> mErrorHandler;
+    std::atomic<uint64_t> mFailures{0};
+    // the last committed batch may still be undone by a failing commit
+    bool mInFlight{false};
+    bool mPublishing{false};
+
+    void deliver(std::shared_ptr<ErrorHandler> const &handler, auto &&callback) {
+      try {
+        callback();
+      } catch (...) {
+        mFailures.fetch_add(1, std::memory_order_relaxed);
+
+        try {
+          if (handler and *handler) {
+            (*handler)(std::current_exception());
+          } else {
+            std::rethrow_exception(std::current_exception());
+          }
+        } catch (std::exception const &e) {
+          std::clog << "change feed observer failed: " << e.what() << std::endl;
+        } catch (...) {
+          std::clog << "change feed observer failed" << std::endl;
+        }
+      }
+    }
+
+    static void on_update(void *self, int operation, char const *, char const *table, sqlite3_int64 rowId) {
+      auto &feed = *static_cast<ChangeFeed *>(self);
+
+      if (!feed.mActive.load(std::memory_order_relaxed)) {
+        return;
+      }
+
+      std::lock_guard<std::mutex> lk(feed.mMutex);
+
+      feed.mPending.push_back({
+        operation == SQLITE_INSERT
+          ? ChangeOperation::Insert
+          : operation == SQLITE_DELETE
+          ? ChangeOperation::Delete
+          : ChangeOperation::Update,
+        table, rowId
+      });
+    }
+
+    static int on_commit(void *self) {
+      auto &feed = *static_cast<ChangeFeed *>(self);
+      std::lock_guard<std::mutex> lk(feed.mMutex);
+
+      feed.mInFlight = false;
+
+      if (!feed.mPending.empty()) {
+        feed.mCommitted.push_back(std::move(feed.mPending));
+        feed.mPending.clear();
+        feed.mInFlight = true;
+      }
+
+      return 0;
+    }
+
+    static void on_rollback(void *self) {
+      auto &feed = *static_cast<ChangeFeed *>(self);
+      std::lock_guard<std::mutex> lk(feed.mMutex);
+
+      feed.mPending.clear();
+
+      if (feed.mInFlight) {
+        feed.mCommitted.pop_back();
+        feed.mInFlight = false;
+      }
+    }
+  };
+}
@@ -0,0 +1,251 @@
+#pragma once
+
+#include "jdb/database/DataClass.hpp"
+
+#include <bit>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+#include "jmixin/jstringliteral.h"
+
+#include <fmt/format.h>
+
+namespace jdb {
+  /*
+    One bit per row, set when the row holds a value (not null).
+  */
+  struct ValidityBitmap {
+    void push_back(bool valid) {
+      if (mSize % 64 == 0) {
+        mWords.push_back(0);
+      }
+
+      if (valid) {
+        mWords.back() |= uint64_t{1} << (mSize % 64);
+      }
+
+      mSize++;
+    }
+
+    [[nodiscard]] bool is_valid(std::size_t index) const {
+      return (mWords[index / 64] >> (index % 64)) & 1;
+    }
+
+    [[nodiscard]] bool is_null(std::size_t index) const {
+      return !is_valid(index);
+    }
+
+    [[nodiscard]] std::size_t null_count() const {
+      std::size_t valid = 0;
+
+      for (auto word: mWords) {
+        valid += std::popcount(word);
+      }
+
+      return mSize - valid;
+    }
+
+    [[nodiscard]] std::size_t size() const {
+      return mSize;
+    }
+
+    /*
+      Bits past size() are always zero.
+    */
+    [[nodiscard]] std::vector<uint64_t> const &get_words() const {
+      return mWords;
+    }
+
+    void reserve(std::size_t size) {
+      mWords.reserve((size + 63) / 64);
+    }
+
+  private:
+    std::vector<uint64_t> mWords;
+    std::size_t mSize{};
+  };
+
+  /*
+    Contiguous values of an Int (also Serial and Bool) or Decimal column. Null
+    rows hold a zero, so loops may run over every value and mask the result with
+    the validity bitmap.
+  */
+  template<typename T>
+  struct NumericColumn {
+    using Type = T;
+
+    std::vector<T> values;
+    ValidityBitmap validity;
+
+    void push_back(Data const &value) {
+      if (auto item = value.get_int(); item.has_value()) {
+        values.push_back(static_cast<T>(*item));
+      } else if (auto item = value.get_decimal(); item.has_value()) {
+        values.push_back(static_cast<T>(*item));
+      } else {
+        values.push_back(T{});
+        validity.push_back(false);
+
+        return;
+      }
+
+      validity.push_back(true);
+    }
+
+    [[nodiscard]] std::size_t size() const {
+      return values.size();
+    }
+
+    [[nodiscard]] T operator[](std::size_t index) const {
+      return values[index];
+    }
+
+    void reserve(std::size_t size) {
+      values.reserve(size);
+      validity.reserve(size);
+    }
+  };
+
+  using IntColumn = NumericColumn<int64_t>;
+
+  using DecimalColumn = NumericColumn<double>;
+
+  /*
+    Text column as one byte buffer: row i spans [offsets[i], offsets[i + 1]).
+  */
+  struct TextColumn {
+    std::vector<uint64_t> offsets{0};
+    std::string bytes;
+    ValidityBitmap validity;
+
+    void push_back(Data const &value) {
+      if (value.is_null() or value.is_invalid()) {
+        validity.push_back(false);
+      } else {
+        if (auto item = value.get_text(); item.has_value()) {
+          bytes += *item;
+        } else {
+          bytes += jdb::to_string(value);
+        }
+
+        validity.push_back(true);
+      }
+
+      offsets.push_back(bytes.size());
+    }
+
+    [[nodiscard]] std::size_t size() const {
+      return offsets.size() - 1;
+    }
+
+    [[nodiscard]] std::string_view operator[](std::size_t index) const {
+      return std::string_view{bytes}.substr(offsets[index], offsets[index + 1] - offsets[index]);
+    }
+
+    void reserve(std::size_t size) {
+      offsets.reserve(size + 1);
+      validity.reserve(size);
+    }
+  };
+
+  template<FieldType Type>
+  using ColumnOf = std::conditional_t<
+    Type == FieldType::Decimal, DecimalColumn,
+    std::conditional_t<Type == FieldType::Text or Type == FieldType::Timestamp, TextColumn, IntColumn> >;
+
+  template<typename Model, jmixin::StringLiteral Column>
+  struct ColumnField;
+
+  template<jmixin::StringLiteral Name, PrimaryConcept PrimaryKeys, ForeignConcept ForeignKeys,
+    FieldConcept... Fields, jmixin::StringLiteral Column>
+  struct ColumnField<DataClass<Name, PrimaryKeys, ForeignKeys, Fields...>, Column> {
+    static constexpr int get_index() {
+      int index = 0;
+
+      for (bool found: {(Fields::get_name() == Column.to_string())...}) {
+        if (found) {
+          return index;
+        }
+
+        index++;
+      }
+
+      return -1;
+    }
+
+    static_assert(get_index() >= 0, "column is not a field of the model");
+
+    using Type = std::tuple_element_t<get_index(), std::tuple<Fields...> >;
+
+    static_assert(!Type::ignore(), "ignored fields have no column");
+  };
+
+  /*
+    Struct of arrays holding a few columns of a query result, in the order of
+    Columns. Each column is typed after its field in Model.
+  */
+  template<typename Model, jmixin::StringLiteral... Columns>
+  struct ColumnBatch {
+    template<jmixin::StringLiteral Column>
+    [[nodiscard]] auto const &get() const {
+      return std::get<index_of<Column>()>(mColumns);
+    }
+
+    template<jmixin::StringLiteral Column>
+    [[nodiscard]] auto &get() {
+      return std::get<index_of<Column>()>(mColumns);
+    }
+
+    [[nodiscard]] std::size_t size() const {
+      return mSize;
+    }
+
+    [[nodiscard]] bool empty() const {
+      return mSize == 0;
+    }
+
+    void reserve(std::size_t size) {
+      std::apply([&](auto &... column) { (column.reserve(size), ...); }, mColumns);
+    }
+
+    /*
+      Appends a row given in the order of Columns.
+    */
+    void push_back(std::vector<Data> const &values) {
+      if (values.size() != sizeof...(Columns)) {
+        throw std::runtime_error(fmt::format("Expected {} columns, got {}", sizeof...(Columns), values.size()));
+      }
+
+      std::apply([&](auto &... column) {
+        std::size_t i = 0;
+
+        (column.push_back(values[i++]), ...);
+      }, mColumns);
+
+      mSize++;
+    }
+
+  private:
+    std::tuple<ColumnOf<ColumnField<Model, Columns>::Type::get_type()>...> mColumns;
+    std::size_t mSize{};
+
+    template<jmixin::StringLiteral Column>
+    static constexpr std::size_t index_of() {
+      std::size_t index = 0;
+
+      for (bool found: {(Columns.to_string() == Column.to_string())...}) {
+        if (found) {
+          return index;
+        }
+
+        index++;
+      }
+
+      throw std::runtime_error("column is not part of the batch");
+    }
+  };
+}
@@ -0,0 +1,476 @@
+#pragma once
+
+#include "jdb/database/ColumnBatch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <vector>
+
+#if defined(__x86_64__) and (defined(__GNUC__) or defined(__clang__))
+#define JDB_SIMD_X86 1
+#endif
+
+namespace jdb {
+  /*
+    Portable uses 16 byte compiler vectors (SSE2, NEON), Avx2 and Avx512 the
+    32 and 64 byte ones, each compiled for its own target and picked at run time.
+  */
+  enum class SimdLevel { Scalar, Portable, Avx2, Avx512 };
+
+  enum class Compare { Equal, NotEqual, Less, LessEqual, Greater, GreaterEqual };
+
+  /*
+    Aggregations over numeric columns that skip null rows. Work goes in blocks
+    of 64 rows, one validity word each: whole blocks run in vectors, with null
+    lanes masked out, and the tail in a scalar loop.
+  */
+  struct ColumnKernels {
+    [[nodiscard]] static SimdLevel get_supported_level() {
+      static SimdLevel const level = detect_level();
+
+      return level;
+    }
+
+    [[nodiscard]] static SimdLevel get_level() {
+      return get_active_level().load(std::memory_order_relaxed);
+    }
+
+    /*
+      Levels above the supported one are clamped, so a benchmark may lower the
+      level but never make the process fault.
+    */
+    static void set_level(SimdLevel level) {
+      get_active_level().store(std::min(level, get_supported_level()), std::memory_order_relaxed);
+    }
+
+    /*
+      Sum of the non null values. Decimal sums are reassociated across lanes, so
+      they may differ from a sequential loop in the last bits.
+    */
+    template<typename T>
+    [[nodiscard]] static T sum(NumericColumn<T> const &column) {
+      return dispatch([&]<std::size_t Bytes>() __attribute__((always_inline)) {
+        return sum_of<Bytes>(column);
+      });
+    }
+
+    template<typename T>
+    [[nodiscard]] static std::optional<T> min(NumericColumn<T> const &column) {
+      return dispatch([&]<std::size_t Bytes>() __attribute__((always_inline)) {
+        return extreme_of<Bytes, true>(column);
+      });
+    }
+
+    template<typename T>
+    [[nodiscard]] static std::optional<T> max(NumericColumn<T> const &column) {
+      return dispatch([&]<std::size_t Bytes>() __attribute__((always_inline)) {
+        return extreme_of<Bytes, false>(column);
+      });
+    }
+
+    /*
+      Number of non null rows where "row op value" holds.
+    */
+    template<typename T>
+    [[nodiscard]] static std::size_t count_if(NumericColumn<T> const &column, Compare op, T value) {
+      return with_compare(op, [&]<Compare Op>() {
+        return dispatch([&]<std::size_t Bytes>() __attribute__((always_inline)) {
+          std::size_t count = 0;
+
+          for_each_match<Bytes, Op>(column, value, [&](std::size_t, uint64_t word) {
+            count += std::popcount(word);
+          });
+
+          return count;
+        });
+      });
+    }
+
+    /*
+      Ascending indexes of the non null rows where "row op value" holds.
+    */
+    template<typename T>
+    [[nodiscard]] static std::vector<uint32_t> filter(NumericColumn<T> const &column, Compare op, T value) {
+      if (column.size() > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Column too large for a selection vector");
+      }
+
+      return with_compare(op, [&]<Compare Op>() {
+        return dispatch([&]<std::size_t Bytes>() __attribute__((always_inline)) {
+          std::vector<uint32_t> selection;
+
+          for_each_match<Bytes, Op>(column, value, [&](std::size_t base, uint64_t word) {
+            for (; word != 0; word &= word - 1) {
+              selection.push_back(static_cast<uint32_t>(base + std::countr_zero(word)));
+            }
+          });
+
+          return selection;
+        });
+      });
+    }
+
+    /*
+      Counts of the non null values in buckets of equal width over
+      [lower, upper); values outside the range are left out.
+    */
+    template<typename T>
+    [[nodiscard]] static std::vector<uint64_t> histogram(NumericColumn<T> const &column, T lower, T upper,
+                                                         std::size_t buckets) {
+      if (buckets == 0 or !(lower < upper)) {
+        throw std::runtime_error("Invalid histogram range");
+      }
+
+      return dispatch([&]<std::size_t Bytes>() __attribute__((always_inline)) {
+        return histogram_of<Bytes>(column, lower, upper, buckets);
+      });
+    }
+
+  private:
+    static constexpr std::size_t BlockSize = 64;
+
+    template<typename T, std::size_t Bytes>
+    using Vector [[gnu::vector_size(Bytes)]] = T;
+
+    static std::atomic<SimdLevel> &get_active_level() {
+      static std::atomic<SimdLevel> level{get_supported_level()};
+
+      return level;
+    }
+
+    static SimdLevel detect_level() {
+#ifdef JDB_SIMD_X86
+      __builtin_cpu_init();
+
+      if (__builtin_cpu_supports("avx512f")) {
+        return SimdLevel::Avx512;
+      }
+
+      if (__builtin_cpu_supports("avx2")) {
+        return SimdLevel::Avx2;
+      }
+#endif
+
+      return SimdLevel::Portable;
+    }
+
+    template<typename F>
+    static decltype(auto) dispatch(F &&kernel) {
+      switch (get_level()) {
+#ifdef JDB_SIMD_X86
+        case SimdLevel::Avx512:
+          return run_avx512(kernel);
+        case SimdLevel::Avx2:
+          return run_avx2(kernel);
+#endif
+        case SimdLevel::Scalar:
+          return kernel.template operator()<0>();
+        default:
+          return kernel.template operator()<16>();
+      }
+    }
+
+#ifdef JDB_SIMD_X86
+    // the kernels are always inlined, so they are compiled for the target here
+    template<typename F>
+    [[gnu::target("avx2")]] static decltype(auto) run_avx2(F &kernel) {
+      return kernel.template operator()<32>();
+    }
+
+    template<typename F>
+    [[gnu::target("avx512f")]] static decltype(auto) run_avx512(F &kernel) {
+      return kernel.template operator()<64>();
+    }
+#endif
+
+    template<typename F>
+    static decltype(auto) with_compare(Compare op, F &&callback) {
+      switch (op) {
+        case Compare::Equal:
+          return callback.template operator()<Compare::Equal>();
+        case Compare::NotEqual:
+          return callback.template operator()<Compare::NotEqual>();
+        case Compare::Less:
+          return callback.template operator()<Compare::Less>();
+        case Compare::LessEqual:
+          return callback.template operator()<Compare::LessEqual>();
+        case Compare::Greater:
+          return callback.template operator()<Compare::Greater>();
+        default:
+          return callback.template operator()<Compare::GreaterEqual>();
+      }
+    }
+
+    // vectors go through out parameters, as returning them by value warns about the ABI (-Wpsabi)
+    template<Compare Op>
+    [[gnu::always_inline]] static void compare(auto const &a, auto const &b, auto &result) {
+      if constexpr (Op == Compare::Equal) {
+        result = a == b;
+      } else if constexpr (Op == Compare::NotEqual) {
+        result = a != b;
+      } else if constexpr (Op == Compare::Less) {
+        result = a < b;
+      } else if constexpr (Op == Compare::LessEqual) {
+        result = a <= b;
+      } else if constexpr (Op == Compare::Greater) {
+        result = a > b;
+      } else {
+        result = a >= b;
+      }
+    }
+
+    [[gnu::always_inline]] static void load(auto &vector, auto const *values) {
+      __builtin_memcpy(&vector, values, sizeof(vector));
+    }
+
+    /*
+      Calls visit(row, valid) for the rows of a block that can not run in
+      vectors.
+    */
+    [[gnu::always_inline]] static void for_each_valid(uint64_t word, std::size_t count, auto &&visit) {
+      for (std::size_t i = 0; i < count; i++) {
+        if ((word >> i) & 1) {
+          visit(i);
+        }
+      }
+    }
+
+    /*
+      Lane mask of the Bytes / 8 rows whose validity bits start at bits: all
+      ones for valid rows, zero for null ones.
+    */
+    template<std::size_t Bytes>
+    [[gnu::always_inline]] static void lane_mask(uint64_t bits, Vector<int64_t, Bytes> &mask) {
+      Vector<int64_t, Bytes> lanes;
+
+      for (std::size_t lane = 0; lane < Bytes / sizeof(int64_t); lane++) {
+        lanes[lane] = static_cast<int64_t>(lane);
+      }
+
+      mask = ((Vector<int64_t, Bytes>{} + static_cast<int64_t>(bits)) >> lanes) & 1;
+      mask = mask != 0;
+    }
+
+    template<std::size_t Bytes, typename T>
+    [[gnu::always_inline]] static T sum_of(NumericColumn<T> const &column) {
+      auto const &words = column.validity.get_words();
+      T const *values = column.values.data();
+      std::size_t size = column.size();
+      std::size_t base = 0;
+      T total{};
+
+      if constexpr (Bytes > 0) {
+        static_assert(sizeof(T) == sizeof(int64_t), "lane masks are 64 bits wide");
+
+        constexpr std::size_t Lanes = Bytes / sizeof(T);
+
+        Vector<T, Bytes> acc{}, item, zero{};
+        Vector<int64_t, Bytes> mask;
+
+        for (; base + BlockSize <= size; base += BlockSize) {
+          uint64_t word = words[base / BlockSize];
+
+          for (std::size_t i = 0; i < BlockSize; i += Lanes) {
+            load(item, values + base + i);
+
+            if (word != ~uint64_t{0}) {
+              lane_mask<Bytes>(word >> i, mask);
+
+              item = mask ? item : zero;
+            }
+
+            acc += item;
+          }
+        }
+
+        for (std::size_t lane = 0; lane < Lanes; lane++) {
+          total += acc[lane];
+        }
+      }
+
+      for (; base < size; base += BlockSize) {
+        for_each_valid(words[base / BlockSize], std::min(BlockSize, size - base), [&](std::size_t i) {
+          total += values[base + i];
+        });
+      }
+
+      return total;
+    }
+
+    template<std::size_t Bytes, bool Min, typename T>
+    [[gnu::always_inline]] static std::optional<T> extreme_of(NumericColumn<T> const &column) {
+      constexpr T Identity = Min ? std::numeric_limits<T>::max() : std::numeric_limits<T>::lowest();
+
+      auto const &words = column.validity.get_words();
+      T const *values = column.values.data();
+      std::size_t size = column.size();
+      std::size_t base = 0;
+      T result = Identity;
+
+      if constexpr (Bytes > 0) {
+        static_assert(sizeof(T) == sizeof(int64_t), "lane masks are 64 bits wide");
+
+        constexpr std::size_t Lanes = Bytes / sizeof(T);
+
+        Vector<T, Bytes> identity = Vector<T, Bytes>{} + Identity, acc = identity, item;
+        Vector<int64_t, Bytes> mask;
+
+        for (; base + BlockSize <= size; base += BlockSize) {
+          uint64_t word = words[base / BlockSize];
+
+          for (std::size_t i = 0; i < BlockSize; i += Lanes) {
+            load(item, values + base + i);
+
+            if (word != ~uint64_t{0}) {
+              lane_mask<Bytes>(word >> i, mask);
+
+              item = mask ? item : identity;
+            }
+
+            if constexpr (Min) {
+              acc = item < acc ? item : acc;
+            } else {
+              acc = item > acc ? item : acc;
+            }
+          }
+        }
+
+        for (std::size_t lane = 0; lane < Lanes; lane++) {
+          result = Min ? std::min<T>(result, acc[lane]) : std::max<T>(result, acc[lane]);
+        }
+      }
+
+      for (; base < size; base += BlockSize) {
+        for_each_valid(words[base / BlockSize], std::min(BlockSize, size - base), [&](std::size_t i) {
+          result = Min ? std::min(result, values[base + i]) : std::max(result, values[base + i]);
+        });
+      }
+
+      // only nulls, the identity may not tell it as it is a valid value too
+      if (column.validity.null_count() == size) {
+        return {};
+      }
+
+      return result;
+    }
+
+    /*
+      Calls visit(base, word) for every block, with the bits of the valid rows
+      matching "row op value" set in word.
+    */
+    template<std::size_t Bytes, Compare Op, typename T>
+    [[gnu::always_inline]] static void for_each_match(NumericColumn<T> const &column, T value, auto &&visit) {
+      auto const &words = column.validity.get_words();
+      T const *values = column.values.data();
+      std::size_t size = column.size();
+
+      for (std::size_t base = 0, block = 0; base < size; base += BlockSize, block++) {
+        std::size_t count = std::min(BlockSize, size - base);
+        uint64_t match = 0;
+
+        // null rows hold a zero, so the whole block is compared and masked after
+        if constexpr (Bytes > 0) {
+          constexpr std::size_t Lanes = Bytes / sizeof(T);
+
+          if (count == BlockSize) {
+            Vector<T, Bytes> splat = Vector<T, Bytes>{} + value, item;
+            decltype(splat < splat) mask;
+
+            for (std::size_t i = 0; i < BlockSize; i += Lanes) {
+              load(item, values + base + i);
+              compare<Op>(item, splat, mask);
+
+              for (std::size_t lane = 0; lane < Lanes; lane++) {
+                match |= static_cast<uint64_t>(mask[lane] & 1) << (i + lane);
+              }
+            }
+
+            visit(base, match & words[block]);
+
+            continue;
+          }
+        }
+
+        for (std::size_t i = 0; i < count; i++) {
+          bool result;
+
+          compare<Op>(values[base + i], value, result);
+
+          match |= static_cast<uint64_t>(result) << i;
+        }
+
+        visit(base, match & words[block]);
+      }
+    }
+
+    template<std::size_t Bytes, typename T>
+    [[gnu::always_inline]] static std::vector<uint64_t> histogram_of(NumericColumn<T> const &column, T lower,
+                                                                      T upper, std::size_t buckets) {
+      auto const &words = column.validity.get_words();
+      T const *values = column.values.data();
+      std::size_t size = column.size();
+      double scale = static_cast<double>(buckets) / (static_cast<double>(upper) - static_cast<double>(lower));
+      std::vector<uint64_t> counts(buckets);
+      int64_t indexes[BlockSize];
+
+      for (std::size_t base = 0, block = 0; base < size; base += BlockSize, block++) {
+        std::size_t count = std::min(BlockSize, size - base);
+        bool vectorized = false;
+
+        if constexpr (Bytes > 0) {
+          constexpr std::size_t Lanes = Bytes / sizeof(double);
+
+          if (count == BlockSize) {
+            using Doubles = Vector<double, Bytes>;
+            using Indexes = Vector<int64_t, Bytes>;
+
+            Doubles offset = Doubles{} + static_cast<double>(lower);
+            Doubles factor = Doubles{} + scale;
+            Doubles last = Doubles{} + static_cast<double>(buckets - 1);
+            Doubles zero{};
+
+            Vector<T, Bytes> source;
+
+            for (std::size_t i = 0; i < BlockSize; i += Lanes) {
+              load(source, values + base + i);
+
+              Doubles item = __builtin_convertvector(source, Doubles);
+              Doubles position = (item - offset) * factor;
+
+              // clamped before the conversion, rows out of range are dropped below
+              position = position >= zero ? position : zero;
+              position = position <= last ? position : last;
+
+              Indexes index = __builtin_convertvector(position, Indexes);
+
+              __builtin_memcpy(indexes + i, &index, sizeof(index));
+            }
+
+            vectorized = true;
+          }
+        }
+
+        for_each_valid(words[block], count, [&](std::size_t i) {
+          T item = values[base + i];
+
+          if (item < lower or !(item < upper)) {
+            return;
+          }
+
+          int64_t index = vectorized
+                            ? indexes[i]
+                            : static_cast<int64_t>((static_cast<double>(item) - static_cast<double>(lower)) * scale);
+
+          counts[std::min<std::size_t>(static_cast<std::size_t>(index), buckets - 1)]++;
+        });
+      }
+
+      return counts;
+    }
+  };
+}
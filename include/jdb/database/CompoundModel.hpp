@@ -32,15 +32,33 @@ namespace jdb {
     }
 
     [[nodiscard]] std::string to_string() const {
-      std::ostringstream o;
+      fmt::memory_buffer buffer;
 
-      o << "{";
+      format_to(fmt::appender(buffer));
 
-      for_each<0, Models...>(o, *this);
+      return fmt::to_string(buffer);
+    }
+
+    [[nodiscard]] std::string to_json() const {
+      fmt::memory_buffer buffer;
+
+      format_to(fmt::appender(buffer), ModelFormat::Json);
+
+      return fmt::to_string(buffer);
+    }
 
-      o << "}";
+    /*
+      Each model nested under its table name, see DataClass::format_to().
+    */
+    template<typename OutputIt>
+    OutputIt format_to(OutputIt out, ModelFormat format = ModelFormat::Text) const {
+      *out++ = '{';
 
-      return o.str();
+      for_each<0, Models...>(out, format, *this);
+
+      *out++ = '}';
+
+      return out;
     }
 
     [[nodiscard]] bool is_valid() const {
@@ -50,24 +68,32 @@ namespace jdb {
   private:
     bool mValid = true;
 
-    template<std::size_t Index, typename Arg, typename... Args>
-    static constexpr void for_each(std::ostream &out,
+    template<std::size_t Index, typename Arg, typename... Args, typename OutputIt>
+    static constexpr void for_each(OutputIt &out, ModelFormat format,
                                    CompoundModel const &value) {
-      if constexpr (Index > 0) {
-        out << ", ";
+      if (format == ModelFormat::Json) {
+        if constexpr (Index > 0) {
+          *out++ = ',';
+        }
+
+        out = write_json_string(out, Arg::get_name());
+        *out++ = ':';
+      } else {
+        if constexpr (Index > 0) {
+          out = fmt::format_to(out, ", ");
+        }
+
+        out = write_quoted(out, Arg::get_name());
+        out = fmt::format_to(out, ": ");
       }
 
-      out << std::quoted(Arg::get_name(), '\'') << ": " << value.get<Arg>().to_string();
+      out = static_cast<Arg const &>(value).format_to(out, format);
 
       if constexpr (sizeof...(Args) > 0) {
-        return for_each<Index + 1, Args...>(out, value);
+        return for_each<Index + 1, Args...>(out, format, value);
       }
     }
 
-    template<std::size_t Index>
-    static constexpr void for_each(std::ostream &out) {
-    }
-
     template<std::size_t RestrictedValue, typename Arg, typename... Args>
     static constexpr void restricted_for_each(CompoundModel const &value) {
       value.get<Arg>() = value.get<Arg>().template restrict<RestrictedValue>();
@@ -84,7 +110,30 @@ namespace jdb {
 }
 
 template<typename... Models>
-struct fmt::formatter<jdb::CompoundModel<Models...> > : fmt::ostream_formatter {
+struct fmt::formatter<jdb::CompoundModel<Models...> > {
+  // {} is the to_string() form and {:j} is JSON
+  constexpr auto parse(fmt::format_parse_context &ctx) {
+    auto it = ctx.begin();
+
+    if (it != ctx.end() and *it == 'j') {
+      mFormat = jdb::ModelFormat::Json;
+
+      it++;
+    }
+
+    if (it != ctx.end() and *it != '}') {
+      throw fmt::format_error("invalid format for a model, expected {} or {:j}");
+    }
+
+    return it;
+  }
+
+  template<typename FormatContext>
+  auto format(jdb::CompoundModel<Models...> const &model, FormatContext &ctx) const {
+    return model.format_to(ctx.out(), mFormat);
+  }
+
+  jdb::ModelFormat mFormat = jdb::ModelFormat::Text;
 };
 
 namespace jinject {
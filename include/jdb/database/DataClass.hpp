@@ -3,12 +3,19 @@
 #include "jinject/jinject.h"
 #include "jmixin/jstringliteral.h"
 
+#include <algorithm>
+#include <bitset>
 #include <chrono>
+#include <cmath>
 #include <functional>
 #include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <memory_resource>
 #include <optional>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <variant>
 
 #include <fmt/format.h>
@@ -220,18 +227,33 @@ namespace jdb {
     bool operator==(const InvalidData &) const = default;
   };
 
+  /*
+    Text is held in a std::pmr::string: values hydrated into a ResultArena
+    allocate from it, the others from the default (heap) resource. Copies
+    always go to the default resource; moves keep the source allocator, so a
+    value moved out of an arena result must not outlive the arena.
+  */
   struct Data {
-    using MyData = std::variant<InvalidData, std::nullptr_t, bool, int64_t, double, std::string>;
+    using MyData = std::variant<InvalidData, std::nullptr_t, bool, int64_t, double, std::pmr::string>;
 
     Data() = default;
 
-    template<typename T>
+    template<typename T> requires (!std::same_as<std::remove_cvref_t<T>, Data> and
+                                   !std::same_as<std::remove_cvref_t<T>, std::string> and
+                                   !std::same_as<std::remove_cvref_t<T>, std::string_view>)
     Data(T &&data) : mData{std::forward<T>(data)} {
     }
 
+    Data(std::string_view text, std::pmr::memory_resource *resource = std::pmr::get_default_resource())
+      : mData{std::in_place_type<std::pmr::string>, text, resource} {
+    }
+
+    Data(std::string const &text) : Data(std::string_view{text}) {
+    }
+
     template<typename T>
     constexpr Data &operator=(T const &data) {
-      mData = data;
+      mData = Data{data}.mData;
 
       return *this;
     }
@@ -239,7 +261,7 @@ namespace jdb {
     template<typename T>
     constexpr Data &operator=(std::optional<T> data) {
       if (data.has_value()) {
-        mData = data.value();
+        mData = Data{data.value()}.mData;
       }
 
       return *this;
@@ -276,8 +298,8 @@ namespace jdb {
     }
 
     [[nodiscard]] std::optional<std::string> get_text() const {
-      if (auto *value = std::get_if<std::string>(&mData); value != nullptr) {
-        return {*value};
+      if (auto *value = std::get_if<std::pmr::string>(&mData); value != nullptr) {
+        return std::string{*value};
       }
 
       return {};
@@ -309,18 +331,22 @@ namespace jdb {
 
     template <std::size_t N>
     bool operator==(char const (&other)[N]) const {
-      if (std::string const *value = std::get_if<std::string>(&mData); value == nullptr) {
-        return false;
-      } else {
-        return std::string_view{other} == *value;
-      }
+      return *this == std::string_view{other};
     }
 
     bool operator==(char *other) const {
-      if (std::string const *value = std::get_if<std::string>(&mData); value == nullptr) {
+      return *this == std::string_view{other};
+    }
+
+    bool operator==(std::string const &other) const {
+      return *this == std::string_view{other};
+    }
+
+    bool operator==(std::string_view other) const {
+      if (std::pmr::string const *value = std::get_if<std::pmr::string>(&mData); value == nullptr) {
         return false;
       } else {
-        return std::string_view{other} == *value;
+        return other == *value;
       }
     }
 
@@ -344,7 +370,7 @@ namespace jdb {
       [&](bool arg) { out << (arg ? "true" : "false"); },
       [&](int64_t arg) { out << std::to_string(arg); },
       [&](double arg) { out << std::to_string(arg); },
-      [&](std::string const &arg) { out << arg; }
+      [&](std::pmr::string const &arg) { out << arg; }
     });
 
     return out;
@@ -358,6 +384,67 @@ namespace jdb {
     return o.str();
   }
 
+  /*
+    Text is the to_string() form, with single quoted names and strings; Json
+    is a JSON object.
+  */
+  enum class ModelFormat { Text, Json };
+
+  /*
+    Same escaping as std::quoted: quote and backslash get a backslash.
+  */
+  template<typename OutputIt>
+  OutputIt write_quoted(OutputIt out, std::string_view value, char quote = '\'') {
+    *out++ = quote;
+
+    for (char c: value) {
+      if (c == quote or c == '\\') {
+        *out++ = '\\';
+      }
+
+      *out++ = c;
+    }
+
+    *out++ = quote;
+
+    return out;
+  }
+
+  template<typename OutputIt>
+  OutputIt write_json_string(OutputIt out, std::string_view value) {
+    std::size_t start = 0;
+
+    *out++ = '"';
+
+    for (std::size_t i = 0; i < value.size(); i++) {
+      auto c = static_cast<unsigned char>(value[i]);
+
+      if (c >= 0x20 and c != '"' and c != '\\') {
+        continue;
+      }
+
+      out = std::copy(value.begin() + start, value.begin() + i, out);
+      start = i + 1;
+
+      switch (c) {
+        case '"': out = fmt::format_to(out, "\\\""); break;
+        case '\\': out = fmt::format_to(out, "\\\\"); break;
+        case '\n': out = fmt::format_to(out, "\\n"); break;
+        case '\r': out = fmt::format_to(out, "\\r"); break;
+        case '\t': out = fmt::format_to(out, "\\t"); break;
+        case '\b': out = fmt::format_to(out, "\\b"); break;
+        case '\f': out = fmt::format_to(out, "\\f"); break;
+        default: out = fmt::format_to(out, "\\u{:04x}", c);
+      }
+    }
+
+    out = std::copy(value.begin() + start, value.end(), out);
+
+    *out++ = '"';
+
+    return out;
+  }
+
   template<jmixin::StringLiteral Name, PrimaryConcept PrimaryKeys,
     ForeignConcept ForeignKeys, FieldConcept... Fields>
   struct DataClass {
@@ -378,8 +465,16 @@ namespace jdb {
       }
     }
 
+    DataClass(DataClass const &) = default;
+
+    DataClass(DataClass &&) noexcept = default;
+
     virtual ~DataClass() = default;
 
+    DataClass &operator=(DataClass const &) = default;
+
+    DataClass &operator=(DataClass &&) noexcept = default;
+
     static constexpr std::string get_name() { return Name.to_string(); }
 
     template<typename F>
@@ -430,6 +525,10 @@ namespace jdb {
       return mFields[index];
     }
 
+    /*
+      Mutable access marks the field as dirty, so update() only writes back the
+      columns touched since the model was loaded.
+    */
     constexpr Data &operator[](std::string_view name) {
       int index = index_of<0, Fields...>(name);
 
@@ -438,9 +537,45 @@ namespace jdb {
           fmt::format("Field '{}' not available in '{}'", name, get_name()));
       }
 
+      mDirty.set(index);
+
       return mFields[index];
     }
 
+    /*
+      Field by its position in Fields, with no name lookup.
+    */
+    template<std::size_t Index>
+    constexpr Data const &get_field() const {
+      return std::get<Index>(mFields);
+    }
+
+    template<std::size_t Index>
+    constexpr Data &get_field() {
+      mDirty.set(Index);
+
+      return std::get<Index>(mFields);
+    }
+
+    [[nodiscard]] bool is_dirty() const {
+      return mDirty.any();
+    }
+
+    [[nodiscard]] bool is_dirty(std::string_view name) const {
+      int index = index_of<0, Fields...>(name);
+
+      if (index < 0) {
+        throw std::runtime_error(
+          fmt::format("Field '{}' not available in '{}'", name, get_name()));
+      }
+
+      return mDirty.test(index);
+    }
+
+    void clear_dirty() {
+      mDirty.reset();
+    }
+
     template<std::size_t RestrictedLevel>
     [[nodiscard]] DataClass restrict() const {
       if (!is_valid()) {
@@ -461,37 +596,39 @@ namespace jdb {
     }
 
     [[nodiscard]] std::string to_string() const {
-      std::ostringstream o;
-      bool first = true;
+      fmt::memory_buffer buffer;
 
-      o << "{";
+      format_to(fmt::appender(buffer));
 
-      get_fields([&]<typename Field>() {
-        if (this->operator[](Field::get_name()).is_invalid()) {
-          return;
-        }
+      return fmt::to_string(buffer);
+    }
 
-        if (!first) {
-          o << ", ";
-        }
+    [[nodiscard]] std::string to_json() const {
+      fmt::memory_buffer buffer;
 
-        first = false;
+      format_to(fmt::appender(buffer), ModelFormat::Json);
 
-        o << std::quoted(Field::get_name(), '\'') << ":";
+      return fmt::to_string(buffer);
+    }
 
-        this->operator[](Field::get_name())
-            .get_value(overloaded{
-              [&]([[maybe_unused]] InvalidData arg) { },
-              [&]([[maybe_unused]] std::nullptr_t arg) { o << "null"; },
-              [&](bool arg) { o << (arg ? "true" : "false"); },
-              [&](int64_t arg) { o << arg; }, [&](double arg) { o << arg; },
-              [&](std::string arg) { o << std::quoted(arg, '\''); }
-            });
-      });
+    /*
+      Writes the model straight into out, fields walked at compile time and
+      restricted (invalid) ones left out, e.g. into a reused fmt::memory_buffer
+      through fmt::appender.
+    */
+    template<typename OutputIt>
+    OutputIt format_to(OutputIt out, ModelFormat format = ModelFormat::Text) const {
+      bool first = true;
 
-      o << "}";
+      *out++ = '{';
 
-      return o.str();
+      [&]<std::size_t... I>(std::index_sequence<I...>) {
+        (write_field<I, Fields>(out, first, format), ...);
+      }(std::index_sequence_for<Fields...>{});
+
+      *out++ = '}';
+
+      return out;
     }
 
     [[nodiscard]] bool is_valid() const {
@@ -510,8 +647,72 @@ namespace jdb {
 
   private:
     std::array<Data, sizeof...(Fields)> mFields;
+    std::bitset<sizeof...(Fields)> mDirty;
     bool mValid = true;
 
+    template<std::size_t Index, typename Field, typename OutputIt>
+    void write_field(OutputIt &out, bool &first, ModelFormat format) const {
+      if constexpr (!Field::ignore()) {
+        Data const &value = std::get<Index>(mFields);
+
+        if (value.is_invalid()) {
+          return;
+        }
+
+        // the quoted name and separator are built once per field
+        static std::string const textKey = [] {
+          std::string key;
+
+          write_quoted(std::back_inserter(key), Field::get_name());
+
+          return key + ":";
+        }();
+        static std::string const jsonKey = [] {
+          std::string key;
+
+          write_json_string(std::back_inserter(key), Field::get_name());
+
+          return key + ":";
+        }();
+
+        bool json = format == ModelFormat::Json;
+
+        if (!first) {
+          out = json ? fmt::format_to(out, ",") : fmt::format_to(out, ", ");
+        }
+
+        first = false;
+
+        out = json ? std::copy(jsonKey.begin(), jsonKey.end(), out) : std::copy(textKey.begin(), textKey.end(), out);
+
+        value.get_value(overloaded{
+          [&]([[maybe_unused]] InvalidData arg) { },
+          [&]([[maybe_unused]] std::nullptr_t arg) { out = fmt::format_to(out, "null"); },
+          [&](bool arg) { out = fmt::format_to(out, "{}", arg); },
+          [&](int64_t arg) {
+            if (json and Field::get_type() == FieldType::Bool) {
+              out = fmt::format_to(out, "{}", arg != 0);
+            } else {
+              out = fmt::format_to(out, "{}", arg);
+            }
+          },
+          [&](double arg) {
+            if (!json) {
+              // as an ostream prints it
+              out = fmt::format_to(out, "{:g}", arg);
+            } else if (std::isfinite(arg)) {
+              out = fmt::format_to(out, "{}", arg);
+            } else {
+              out = fmt::format_to(out, "null");
+            }
+          },
+          [&](std::pmr::string const &arg) {
+            out = json ? write_json_string(out, arg) : write_quoted(out, arg);
+          }
+        });
+      }
+    }
+
     template<typename Arg, typename... Args, typename F>
     static void for_each(F callback) {
       if (!Arg::ignore()) {
@@ -554,8 +755,30 @@ namespace jdb {
 
 template<jmixin::StringLiteral Name, jdb::PrimaryConcept PrimaryKeys,
   jdb::ForeignConcept ForeignKeys, jdb::FieldConcept... Fields>
-struct fmt::formatter<jdb::DataClass<Name, PrimaryKeys, ForeignKeys, Fields...> >
-    : fmt::ostream_formatter {
+struct fmt::formatter<jdb::DataClass<Name, PrimaryKeys, ForeignKeys, Fields...> > {
+  // {} is the to_string() form and {:j} is JSON
+  constexpr auto parse(fmt::format_parse_context &ctx) {
+    auto it = ctx.begin();
+
+    if (it != ctx.end() and *it == 'j') {
+      mFormat = jdb::ModelFormat::Json;
+
+      it++;
+    }
+
+    if (it != ctx.end() and *it != '}') {
+      throw fmt::format_error("invalid format for a model, expected {} or {:j}");
+    }
+
+    return it;
+  }
+
+  template<typename FormatContext>
+  auto format(jdb::DataClass<Name, PrimaryKeys, ForeignKeys, Fields...> const &model, FormatContext &ctx) const {
+    return model.format_to(ctx.out(), mFormat);
+  }
+
+  jdb::ModelFormat mFormat = jdb::ModelFormat::Text;
 };
 
 namespace jinject {
@@ -4,9 +4,14 @@
 #include "jdb/database/Migration.hpp"
 
 #include <chrono>
+#include <cmath>
 #include <functional>
+#include <memory_resource>
 #include <optional>
 #include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
 #include <vector>
 
 #include <fmt/format.h>
@@ -14,17 +19,122 @@
 namespace jdb {
   using QueryCallback = std::function<bool(std::vector<std::string> const &, std::vector<Data> const &)>;
 
+  /*
+    Row callback of Database::query_rows(), free to move the values out.
+  */
+  using RowCallback = std::function<bool(std::vector<std::string> const &, std::vector<Data> &)>;
+
+  /*
+    Specialize to std::true_type for small, hot tables (lookups, settings,
+    permissions): file databases keep a copy of them in memory on each read
+    connection, see SqliteDatabase::read_transaction(). Writes to a pinned
+    table, from any connection or process, bump its row in jdb_pinned_version
+    (kept up by triggers), and each read connection reloads only the copies
+    whose version moved. Reads in read_transaction() callbacks, and the typed
+    reads of Repository<Model>, are served from the copies.
+  */
+  template<typename Model>
+  struct MemoryPinned : std::false_type {
+  };
+
+  /*
+    Pairs of field name and value, all of them required to match (see
+    Repository::load_by).
+  */
+  using Conditions = std::vector<std::pair<std::string, Data> >;
+
+  /*
+    Typed storage of a model kept by a backend outside of SQL. When a backend
+    provides one, the typed operations of Database and Repository go through
+    it instead of building statements.
+  */
+  template<typename Model>
+  struct ModelStore {
+    virtual ~ModelStore() = default;
+
+    virtual Model insert(Model const &model) = 0;
+
+    virtual Model upsert(Model const &model) = 0;
+
+    virtual void update(Model const &model) = 0;
+
+    virtual bool remove(Model const &model) = 0;
+
+    virtual std::optional<Model> find_by_rowid(int64_t rowId) = 0;
+
+    virtual std::vector<Model> load_by(Conditions const &conditions) = 0;
+
+    /*
+      Bulk writes of Database::insert_all() and upsert_all(), which open no
+      transaction around them: a store that wants them atomic opens its own.
+    */
+    virtual void insert_all(std::vector<Model> const &models) {
+      for (auto const &model: models) {
+        insert(model);
+      }
+    }
+
+    virtual void upsert_all(std::vector<Model> const &models) {
+      for (auto const &model: models) {
+        upsert(model);
+      }
+    }
+  };
+
   struct Database {
     virtual ~Database() = default;
 
     virtual int64_t query_string(std::string const &sql, QueryCallback const &callback) = 0;
 
+    /*
+      Same as query_string(), with the text of each row allocated from
+      resource, so the callback can move the values into arena backed models.
+      Backends that cannot build rows there copy the text into it.
+    */
+    virtual int64_t query_rows(std::string const &sql, std::pmr::memory_resource *resource,
+                               RowCallback const &callback) {
+      std::vector<Data> row;
+
+      return query_string(sql, [&](std::vector<std::string> const &columns, std::vector<Data> const &values) {
+        row.clear();
+
+        for (auto const &value: values) {
+          value.get_value(overloaded{
+            [&](std::pmr::string const &arg) { row.emplace_back(std::string_view{arg}, resource); },
+            [&](auto const &arg) { row.emplace_back(arg); }
+          });
+        }
+
+        return callback(columns, row);
+      });
+    }
+
     virtual void transaction(std::function<void(Database &)> callback) = 0;
 
+    virtual void read_transaction(std::function<void(Database &)> callback) {
+      transaction(std::move(callback));
+    }
+
+    virtual void write_transaction(std::function<void(Database &)> callback) {
+      transaction(std::move(callback));
+    }
+
     virtual int64_t get_last_rowid() = 0;
 
+    /*
+      ModelStore<Model> of the backend, or null when the model lives in SQL.
+    */
+    template<typename Model>
+    ModelStore<Model> *get_store() {
+      return static_cast<ModelStore<Model> *>(get_model_store(typeid(Model)));
+    }
+
     template<typename Model, jmixin::StringLiteral... Fields>
     std::optional<Model> find_by_rowid(int64_t rowId) {
+      if (auto *store = get_store<Model>(); store != nullptr) {
+        return store->find_by_rowid(rowId);
+      }
+
       std::optional<Model> item;
       std::ostringstream o;
 
@@ -40,6 +150,8 @@ namespace jdb {
           model[column] = values[i];
         }
 
+        model.clear_dirty();
+
         item = model;
 
         return false;
@@ -73,32 +185,199 @@ namespace jdb {
         throw std::invalid_argument("invalid or restricted model");
       }
 
+      if (auto *store = get_store<Model>(); store != nullptr) {
+        return store->insert(model);
+      }
+
       std::ostringstream o;
-      int first = 0;
 
-      o << "INSERT INTO " << Model::get_name() << " (";
+      o << "INSERT INTO " << Model::get_name() << " " << get_insert_columns(model) << " VALUES ";
 
-      model.get_fields([&]<typename Field>() {
-        auto const &value = model[Field::get_name()];
+      get_insert_values(o, model);
 
-        if (default_with_null_value<Field>(value)) {
-          return;
+      o << ";";
+
+      query_string(o.str(), [](auto...) { return false; });
+
+      int64_t lastRowId = get_last_rowid();
+      auto result = find_by_rowid<Model>(lastRowId);
+
+      if (!result.has_value()) {
+        throw std::runtime_error("unable to recover model sequence");
+      }
+
+      return result.value();
+    }
+
+    /*
+      Inserts the model or, if a row with the same primary keys already exists,
+      updates its non-key columns in the same statement.
+    */
+    template<typename Model>
+    Model upsert(Model const &model) {
+      if (!model.is_valid()) {
+        throw std::invalid_argument("invalid or restricted model");
+      }
+
+      if (auto *store = get_store<Model>(); store != nullptr) {
+        return store->upsert(model);
+      }
+
+      std::optional<Model> item;
+      std::ostringstream o;
+
+      o << "INSERT INTO " << Model::get_name() << " " << get_insert_columns(model) << " VALUES ";
+
+      get_insert_values(o, model);
+      get_upsert_conflict(o, model);
+
+      o << " RETURNING *;";
+
+      query_string(o.str(), [&](std::vector<std::string> const &columns,
+                                std::vector<Data> const &values) {
+        Model result;
+
+        for (int i = 0; i < static_cast<int>(columns.size()); i++) {
+          result[columns[i]] = values[i];
         }
 
-        if (first++) {
-          o << ", ";
+        result.clear_dirty();
+
+        item = result;
+
+        return false;
+      });
+
+      if (!item.has_value()) {
+        throw std::runtime_error("unable to recover upserted model");
+      }
+
+      return item.value();
+    }
+
+    /*
+      Bulk variant of insert(): consecutive models sharing the same column set
+      are grouped in multi-row statements inside a single transaction (or the
+      caller's one). Inserted rows are not read back.
+    */
+    template<typename Model>
+    void insert_all(std::vector<Model> const &models, std::size_t rowsPerStatement = 256) {
+      if (auto *store = get_store<Model>(); store != nullptr) {
+        store->insert_all(models);
+
+        return;
+      }
+
+      transaction([&](Database &db) {
+        auto it = models.begin();
+
+        while (it != models.end()) {
+          std::string columns = get_insert_columns(*it);
+          std::ostringstream o;
+          std::size_t rows = 0;
+
+          o << "INSERT INTO " << Model::get_name() << " " << columns << " VALUES ";
+
+          for (; it != models.end() and rows < rowsPerStatement; ++it, ++rows) {
+            if (!it->is_valid()) {
+              throw std::invalid_argument("invalid or restricted model");
+            }
+
+            if (rows > 0 and get_insert_columns(*it) != columns) {
+              break;
+            }
+
+            if (rows > 0) {
+              o << ", ";
+            }
+
+            get_insert_values(o, *it);
+          }
+
+          o << ";";
+
+          query_string(o.str(), [](auto...) { return false; });
         }
+      });
+    }
 
-        o << Field::get_name();
+    /*
+      Bulk variant of upsert(): consecutive models sharing the same column set
+      are grouped in multi-row statements inside a single transaction.
+    */
+    template<typename Model>
+    void upsert_all(std::vector<Model> const &models, std::size_t rowsPerStatement = 256) {
+      if (auto *store = get_store<Model>(); store != nullptr) {
+        store->upsert_all(models);
+
+        return;
+      }
+
+      transaction([&](Database &db) {
+        auto it = models.begin();
+
+        while (it != models.end()) {
+          std::string columns = get_insert_columns(*it);
+          std::ostringstream o;
+          std::size_t rows = 0;
+
+          o << "INSERT INTO " << Model::get_name() << " " << columns << " VALUES ";
+
+          auto const &model = *it;
+
+          for (; it != models.end() and rows < rowsPerStatement; ++it, ++rows) {
+            if (!it->is_valid()) {
+              throw std::invalid_argument("invalid or restricted model");
+            }
+
+            if (rows > 0 and get_insert_columns(*it) != columns) {
+              break;
+            }
+
+            if (rows > 0) {
+              o << ", ";
+            }
+
+            get_insert_values(o, *it);
+          }
+
+          get_upsert_conflict(o, model);
+
+          o << ";";
+
+          query_string(o.str(), [](auto...) { return false; });
+        }
       });
+    }
 
-      o << ") VALUES (";
+    /*
+      Writes back only the fields marked as dirty in the model, primary keys
+      excluded. No statement is executed if nothing has changed.
+    */
+    template<typename Model>
+    void update(Model const &model) {
+      if (!model.is_valid()) {
+        throw std::invalid_argument("invalid or restricted model");
+      }
 
-      first = 0;
+      if (auto *store = get_store<Model>(); store != nullptr) {
+        store->update(model);
+
+        return;
+      }
+
+      std::ostringstream o;
+      int first = 0;
+
+      o << "UPDATE " << Model::get_name() << " SET ";
 
       model.get_fields([&]<typename Field>() {
         auto const &value = model[Field::get_name()];
 
+        if (!model.is_dirty(Field::get_name()) or is_primary_key<Model, Field>()) {
+          return;
+        }
+
         if (default_with_null_value<Field>(value)) {
           return;
         }
@@ -107,18 +386,16 @@ namespace jdb {
           o << ", ";
         }
 
+        o << Field::get_name() << " = ";
+
         value.get_value(overloaded{
           [&]([[maybe_unused]] InvalidData arg) {
-            o << "null";
           },
           [&]([[maybe_unused]] std::nullptr_t arg) {
-            if (!Field::nullable() and Field::get_default().has_value()) {
-              return;
-            }
             if (!Field::nullable() and
                 Field::get_type() != FieldType::Serial) {
               throw std::runtime_error(
-                fmt::format("unable to insert '{}', field '{}' is not null",
+                fmt::format("unable to update '{}', field '{}' is not null",
                             Model::get_name(), Field::get_name()));
             }
             o << "null";
@@ -127,7 +404,7 @@ namespace jdb {
             if (Field::get_type() != FieldType::Bool and
                 Field::get_type() != FieldType::Int) {
               throw std::runtime_error(
-                fmt::format("unable to insert '{}', field '{}' is not "
+                fmt::format("unable to update '{}', field '{}' is not "
                             "convertible to boolean",
                             Model::get_name(), Field::get_name()));
             }
@@ -139,7 +416,7 @@ namespace jdb {
                 Field::get_type() != FieldType::Timestamp and
                 Field::get_type() != FieldType::Bool) {
               throw std::runtime_error(
-                fmt::format("unable to insert '{}', field '{}' is not "
+                fmt::format("unable to update '{}', field '{}' is not "
                             "convertible to integer",
                             Model::get_name(), Field::get_name()));
             }
@@ -148,48 +425,71 @@ namespace jdb {
           [&](double arg) {
             if (Field::get_type() != FieldType::Decimal) {
               throw std::runtime_error(
-                fmt::format("unable to insert '{}', field '{}' is not "
+                fmt::format("unable to update '{}', field '{}' is not "
                             "convertible to double",
                             Model::get_name(), Field::get_name()));
             }
             o << arg;
           },
-          [&](std::string arg) {
+          [&](std::pmr::string const &arg) {
             if (Field::get_type() != FieldType::Text and
                 Field::get_type() != FieldType::Timestamp) {
               throw std::runtime_error(fmt::format(
-                "unable to insert '{}', field '{}' is not a text value",
+                "unable to update '{}', field '{}' is not a text value",
                 Model::get_name(), Field::get_name()));
             }
-            o << std::quoted(arg, '\"');
+            o << std::quoted(arg, '\'', '\'');
           }
         });
       });
 
-      o << ");";
-
-      query_string(o.str(), [](auto...) { return false; });
-
-      int64_t lastRowId = get_last_rowid();
-      auto result = find_by_rowid<Model>(lastRowId);
-
-      if (!result.has_value()) {
-        throw std::runtime_error("unable to recover model sequence");
+      if (first == 0) {
+        return;
       }
 
-      return result.value();
+      get_where_from_primary_keys<Model>(o, model);
+
+      o << ";";
+      query_string(o.str(), [](auto...) { return false; });
     }
 
     template<typename Model>
-    void update(Model const &model) {
+    bool remove(Model const &model) {
       if (!model.is_valid()) {
         throw std::invalid_argument("invalid or restricted model");
       }
 
+      if (auto *store = get_store<Model>(); store != nullptr) {
+        return store->remove(model);
+      }
+
+      std::ostringstream o;
+      // bool first = true;
+
+      o << "DELETE FROM " << Model::get_name();
+
+      get_where_from_primary_keys<Model>(o, model);
+
+      o << ";";
+
+      query_string(o.str(), [](auto...) { return false; });
+
+      return true;
+    }
+
+    virtual Database &add_migration(Migration migration) = 0;
+
+  protected:
+    virtual void *get_model_store([[maybe_unused]] std::type_info const &type) {
+      return nullptr;
+    }
+
+    template<typename Model>
+    std::string get_insert_columns(Model const &model) {
       std::ostringstream o;
       int first = 0;
 
-      o << "UPDATE " << Model::get_name() << " SET ";
+      o << "(";
 
       model.get_fields([&]<typename Field>() {
         auto const &value = model[Field::get_name()];
@@ -202,16 +502,43 @@ namespace jdb {
           o << ", ";
         }
 
-        o << Field::get_name() << " = ";
+        o << Field::get_name();
+      });
+
+      o << ")";
+
+      return o.str();
+    }
+
+    template<typename Model>
+    void get_insert_values(std::ostream &o, Model const &model) {
+      int first = 0;
+
+      o << "(";
+
+      model.get_fields([&]<typename Field>() {
+        auto const &value = model[Field::get_name()];
+
+        if (default_with_null_value<Field>(value)) {
+          return;
+        }
+
+        if (first++) {
+          o << ", ";
+        }
 
         value.get_value(overloaded{
           [&]([[maybe_unused]] InvalidData arg) {
+            o << "null";
           },
           [&]([[maybe_unused]] std::nullptr_t arg) {
+            if (!Field::nullable() and Field::get_default().has_value()) {
+              return;
+            }
             if (!Field::nullable() and
                 Field::get_type() != FieldType::Serial) {
               throw std::runtime_error(
-                fmt::format("unable to update '{}', field '{}' is not null",
+                fmt::format("unable to insert '{}', field '{}' is not null",
                             Model::get_name(), Field::get_name()));
             }
             o << "null";
@@ -220,7 +547,7 @@ namespace jdb {
             if (Field::get_type() != FieldType::Bool and
                 Field::get_type() != FieldType::Int) {
               throw std::runtime_error(
-                fmt::format("unable to update '{}', field '{}' is not "
+                fmt::format("unable to insert '{}', field '{}' is not "
                             "convertible to boolean",
                             Model::get_name(), Field::get_name()));
             }
@@ -232,7 +559,7 @@ namespace jdb {
                 Field::get_type() != FieldType::Timestamp and
                 Field::get_type() != FieldType::Bool) {
               throw std::runtime_error(
-                fmt::format("unable to update '{}', field '{}' is not "
+                fmt::format("unable to insert '{}', field '{}' is not "
                             "convertible to integer",
                             Model::get_name(), Field::get_name()));
             }
@@ -241,53 +568,108 @@ namespace jdb {
           [&](double arg) {
             if (Field::get_type() != FieldType::Decimal) {
               throw std::runtime_error(
-                fmt::format("unable to update '{}', field '{}' is not "
+                fmt::format("unable to insert '{}', field '{}' is not "
                             "convertible to double",
                             Model::get_name(), Field::get_name()));
             }
             o << arg;
           },
-          [&](std::string arg) {
+          [&](std::pmr::string const &arg) {
             if (Field::get_type() != FieldType::Text and
                 Field::get_type() != FieldType::Timestamp) {
               throw std::runtime_error(fmt::format(
-                "unable to update '{}', field '{}' is not a text value",
+                "unable to insert '{}', field '{}' is not a text value",
                 Model::get_name(), Field::get_name()));
             }
-            o << std::quoted(arg, '\"');
+            o << std::quoted(arg, '\'', '\'');
           }
         });
       });
 
-      get_where_from_primary_keys<Model>(o, model);
-
-      o << ";";
-      query_string(o.str(), [](auto...) { return false; });
+      o << ")";
     }
 
     template<typename Model>
-    bool remove(Model const &model) {
-      if (!model.is_valid()) {
-        throw std::invalid_argument("invalid or restricted model");
+    void get_upsert_conflict(std::ostream &o, Model const &model) {
+      if (Model::Keys::get_size() == 0) {
+        return;
       }
 
-      std::ostringstream o;
-      // bool first = true;
+      std::ostringstream keys, sets;
+      int first = 0;
 
-      o << "DELETE FROM " << Model::get_name();
+      model.get_keys([&]<typename Field>() {
+        if (first++) {
+          keys << ", ";
+        }
 
-      get_where_from_primary_keys<Model>(o, model);
+        keys << Field::get_name();
+      });
 
-      o << ";";
+      first = 0;
 
-      query_string(o.str(), [](auto...) { return false; });
+      model.get_fields([&]<typename Field>() {
+        if (is_primary_key<Model, Field>() or
+            default_with_null_value<Field>(model[Field::get_name()])) {
+          return;
+        }
 
-      return true;
+        if (first++) {
+          sets << ", ";
+        }
+
+        sets << Field::get_name() << " = excluded." << Field::get_name();
+      });
+
+      if (first == 0) {
+        // keeps RETURNING working when there is nothing but keys to update
+        model.get_keys([&]<typename Field>() {
+          if (first++ == 0) {
+            sets << Field::get_name() << " = excluded." << Field::get_name();
+          }
+        });
+      }
+
+      o << " ON CONFLICT(" << keys.str() << ") DO UPDATE SET " << sets.str();
     }
 
-    virtual Database &add_migration(Migration migration) = 0;
+    /*
+      Values as SQLite keeps them: booleans as integers, integers in decimal
+      fields as reals, integral reals in integer fields as integers.
+    */
+    static Data normalize(FieldType type, Data const &value) {
+      Data result = value;
+
+      value.get_value(overloaded{
+        [&](bool arg) { result = static_cast<int64_t>(arg); },
+        [&](int64_t arg) {
+          if (type == FieldType::Decimal) {
+            result = static_cast<double>(arg);
+          }
+        },
+        [&](double arg) {
+          if (type != FieldType::Decimal and type != FieldType::Text and std::isfinite(arg) and
+              arg == std::trunc(arg) and std::abs(arg) < 9.2e18) {
+            result = static_cast<int64_t>(arg);
+          }
+        },
+        [&]([[maybe_unused]] auto const &arg) { }
+      });
+
+      return result;
+    }
+
+    template<typename Model, typename Field>
+    static bool is_primary_key() {
+      bool found = false;
+
+      Model::get_keys([&]<typename Key>() {
+        found = found or Key::get_name() == Field::get_name();
+      });
+
+      return found;
+    }
 
-  private:
     template<typename Model>
     void get_where_from_primary_keys(std::ostream &out, Model const &model) {
       std::ostringstream o;
@@ -320,7 +702,7 @@ namespace jdb {
           [&](double arg) {
             out << "(" << Field::get_name() << " = " << arg << ")";
           },
-          [&](std::string arg) {
+          [&](std::pmr::string const &arg) {
             out << "(" << Field::get_name() << " LIKE '%" << arg << "%')";
           }
         });
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "jdb/database/DataClass.hpp"
+
+#include <functional>
+#include <ostream>
+#include <ranges>
+#include <string_view>
+
+#include <fmt/format.h>
+
+namespace jdb {
+  /*
+    Streams models as a single JSON array. Models are formatted into one reused
+    buffer that is handed to the sink whenever it grows past flushSize, so a
+    result set of any size is rendered without a string per model. close()
+    ends the array and flushes the rest; the destructor closes a writer left
+    open.
+  */
+  struct JsonWriter {
+    using Sink = std::function<void(std::string_view)>;
+
+    explicit JsonWriter(Sink sink, std::size_t flushSize = 64 * 1024)
+      : mSink{std::move(sink)}, mFlushSize{flushSize} {
+      mBuffer.push_back('[');
+    }
+
+    explicit JsonWriter(std::ostream &out, std::size_t flushSize = 64 * 1024)
+      : JsonWriter([&out](std::string_view chunk) {
+        out.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+      }, flushSize) {
+    }
+
+    JsonWriter(JsonWriter const &) = delete;
+
+    JsonWriter &operator=(JsonWriter const &) = delete;
+
+    ~JsonWriter() {
+      try {
+        close();
+      } catch (...) {
+      }
+    }
+
+    template<typename Model>
+    JsonWriter &write(Model const &model) {
+      if (mClosed) {
+        throw std::runtime_error("JsonWriter already closed");
+      }
+
+      if (mCount++ > 0) {
+        mBuffer.push_back(',');
+      }
+
+      model.format_to(fmt::appender(mBuffer), ModelFormat::Json);
+
+      if (mBuffer.size() >= mFlushSize) {
+        flush();
+      }
+
+      return *this;
+    }
+
+    template<std::ranges::input_range Range>
+    JsonWriter &write_all(Range const &models) {
+      for (auto const &model: models) {
+        write(model);
+      }
+
+      return *this;
+    }
+
+    void close() {
+      if (mClosed) {
+        return;
+      }
+
+      mClosed = true;
+
+      mBuffer.push_back(']');
+
+      flush();
+    }
+
+    [[nodiscard]] std::size_t size() const {
+      return mCount;
+    }
+
+  private:
+    Sink mSink;
+    std::size_t mFlushSize;
+    fmt::memory_buffer mBuffer;
+    std::size_t mCount{};
+    bool mClosed{false};
+
+    void flush() {
+      mSink({mBuffer.data(), mBuffer.size()});
+
+      mBuffer.clear();
+    }
+  };
+}
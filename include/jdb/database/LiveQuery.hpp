@@ -0,0 +1,230 @@
+#pragma once
+
+#include "jdb/database/ChangeFeed.hpp"
+#include "jdb/database/Database.hpp"
+#include "jdb/utils/State.hpp"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace jdb {
+  /*
+    One row entering (Insert), changing inside (Update) or leaving (Delete) the
+    result of a live query. Deletes carry the last row seen.
+  */
+  template<typename Model>
+  struct RowDiff {
+    ChangeOperation operation;
+    int64_t rowId;
+    Model row;
+  };
+
+  template<typename Model>
+  using ResultDiff = std::vector<RowDiff<Model> >;
+
+  /*
+    Result of "SELECT * FROM <Model> WHERE <where>" kept up to date from the
+    change feed: the query runs once, then each committed transaction that
+    touches the table refetches only the rowids it changed, tests them against
+    where and notifies observers with the resulting diff (nothing is notified
+    when no row of the result moved). where is an SQL predicate over the
+    table, an empty one selects every row. When a refetch fails the error goes
+    to the change feed and its rowids are fetched again with the next commit.
+  */
+  template<typename Model>
+  struct LiveQuery {
+    template<typename Db> requires requires(Db &db) { { db.get_change_feed() } -> std::same_as<ChangeFeed &>; }
+    explicit LiveQuery(std::shared_ptr<Db> db, std::string where = {})
+      : LiveQuery(db, db->get_change_feed(), std::move(where)) {
+    }
+
+    LiveQuery(std::shared_ptr<Database> db, ChangeFeed &feed, std::string where = {})
+      : mFeed{feed}, mSnapshot{std::make_shared<Snapshot>(std::move(db), std::move(where))} {
+      // subscribes first, so no commit made while loading is missed
+      mSubscription = mFeed.subscribe([snapshot = std::weak_ptr<Snapshot>{mSnapshot}](ChangeSet const &changes) {
+        if (auto item = snapshot.lock(); item) {
+          item->apply(changes);
+        }
+      });
+
+      try {
+        mSnapshot->load();
+      } catch (...) {
+        mFeed.unsubscribe(mSubscription);
+
+        throw;
+      }
+    }
+
+    LiveQuery(LiveQuery const &) = delete;
+
+    LiveQuery &operator=(LiveQuery const &) = delete;
+
+    ~LiveQuery() {
+      mFeed.unsubscribe(mSubscription);
+    }
+
+    void observe(std::function<void(ResultDiff<Model> const &)> callback) {
+      mSnapshot->mState.observe(std::move(callback));
+    }
+
+    /*
+      Current result, in rowid order.
+    */
+    [[nodiscard]] std::vector<Model> get_rows() const {
+      std::lock_guard<std::mutex> lk(mSnapshot->mMutex);
+      std::vector<Model> rows;
+
+      rows.reserve(mSnapshot->mRows.size());
+
+      for (auto const &[rowId, row]: mSnapshot->mRows) {
+        rows.push_back(row);
+      }
+
+      return rows;
+    }
+
+    [[nodiscard]] std::size_t size() const {
+      std::lock_guard<std::mutex> lk(mSnapshot->mMutex);
+
+      return mSnapshot->mRows.size();
+    }
+
+  private:
+    // outlives the query while the feed is delivering to it
+    struct Snapshot {
+      Snapshot(std::shared_ptr<Database> db, std::string where)
+        : mDb{std::move(db)}, mWhere{std::move(where)} {
+      }
+
+      void load() {
+        std::lock_guard<std::mutex> lk(mMutex);
+
+        mRows = fetch(mWhere.empty() ? std::string{} : fmt::format("WHERE ({})", mWhere));
+      }
+
+      void apply(ChangeSet const &changes) {
+        std::vector<int64_t> rowIds;
+
+        for (auto const &change: changes) {
+          if (change.table == Model::get_name()) {
+            rowIds.push_back(change.rowId);
+          }
+        }
+
+        if (rowIds.empty()) {
+          return;
+        }
+
+        ResultDiff<Model> diff;
+
+        {
+          std::lock_guard<std::mutex> lk(mMutex);
+
+          rowIds.insert(rowIds.end(), mRetry.begin(), mRetry.end());
+          mRetry.clear();
+
+          std::sort(rowIds.begin(), rowIds.end());
+          rowIds.erase(std::unique(rowIds.begin(), rowIds.end()), rowIds.end());
+
+          std::map<int64_t, Model> matches;
+
+          try {
+            // keeps the statement short on large transactions
+            for (std::size_t i = 0; i < rowIds.size(); i += 500) {
+              std::string ids;
+
+              for (std::size_t j = i; j < std::min(i + 500, rowIds.size()); j++) {
+                ids += (j == i ? "" : ", ") + std::to_string(rowIds[j]);
+              }
+
+              matches.merge(fetch(mWhere.empty()
+                                    ? fmt::format("WHERE ROWID IN ({})", ids)
+                                    : fmt::format("WHERE ROWID IN ({}) AND ({})", ids, mWhere)));
+            }
+          } catch (...) {
+            mRetry = std::move(rowIds);
+
+            throw;
+          }
+
+          for (int64_t rowId: rowIds) {
+            auto current = mRows.find(rowId);
+            auto match = matches.find(rowId);
+
+            if (match == matches.end()) {
+              if (current != mRows.end()) {
+                diff.push_back({ChangeOperation::Delete, rowId, std::move(current->second)});
+
+                mRows.erase(current);
+              }
+            } else if (current == mRows.end()) {
+              diff.push_back({ChangeOperation::Insert, rowId, match->second});
+
+              mRows.emplace(rowId, std::move(match->second));
+            } else if (!is_same(current->second, match->second)) {
+              diff.push_back({ChangeOperation::Update, rowId, match->second});
+
+              current->second = std::move(match->second);
+            }
+          }
+        }
+
+        if (!diff.empty()) {
+          mState.notify(diff);
+        }
+      }
+
+      std::map<int64_t, Model> fetch(std::string const &where) {
+        std::map<int64_t, Model> rows;
+
+        mDb->read_transaction([&](Database &db) {
+          db.query_string(fmt::format("SELECT ROWID AS jdb_rowid, * FROM {} {};", Model::get_name(), where),
+                          [&](std::vector<std::string> const &columns, std::vector<Data> const &values) {
+                            Model row;
+
+                            for (std::size_t i = 1; i < columns.size(); i++) {
+                              row[columns[i]] = values[i];
+                            }
+
+                            row.clear_dirty();
+
+                            rows.emplace(values[0].get_int().value(), std::move(row));
+
+                            return true;
+                          });
+        });
+
+        return rows;
+      }
+
+      static bool is_same(Model const &a, Model const &b) {
+        bool same = true;
+
+        Model::get_fields([&]<typename Field>() {
+          same = same and a[Field::get_name()] == b[Field::get_name()];
+        });
+
+        return same;
+      }
+
+      std::shared_ptr<Database> mDb;
+      std::string mWhere;
+      std::map<int64_t, Model> mRows;
+      // rowids of a failed refetch
+      std::vector<int64_t> mRetry;
+      mutable std::mutex mMutex;
+      VolatileState<ResultDiff<Model> > mState;
+    };
+
+    ChangeFeed &mFeed;
+    std::shared_ptr<Snapshot> mSnapshot;
+    uint64_t mSubscription{};
+  };
+}
@@ -0,0 +1,960 @@
+#pragma once
+
+#include "jdb/database/ColumnBatch.hpp"
+#include "jdb/database/Database.hpp"
+#include "jdb/database/SqliteDatabase.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace jdb {
+  enum class IndexType { Hash, Ordered };
+
+  struct DataHash {
+    std::size_t operator()(Data const &value) const {
+      std::size_t hash = 0;
+
+      value.get_value(overloaded{
+        [&]([[maybe_unused]] InvalidData arg) { hash = 1; },
+        [&]([[maybe_unused]] std::nullptr_t arg) { hash = 2; },
+        [&](bool arg) { hash = std::hash<bool>{}(arg); },
+        [&](int64_t arg) { hash = std::hash<int64_t>{}(arg); },
+        [&](double arg) { hash = std::hash<double>{}(arg); },
+        [&](std::pmr::string const &arg) { hash = std::hash<std::string_view>{}(arg); }
+      });
+
+      return hash;
+    }
+
+    std::size_t operator()(std::vector<Data> const &values) const {
+      std::size_t hash = values.size();
+
+      for (auto const &value: values) {
+        hash ^= (*this)(value) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+      }
+
+      return hash;
+    }
+  };
+
+  /*
+    Same order as SQLite: nulls, then numbers, then text.
+  */
+  struct DataLess {
+    bool operator()(Data const &a, Data const &b) const {
+      int rankA = get_rank(a), rankB = get_rank(b);
+
+      if (rankA != rankB) {
+        return rankA < rankB;
+      }
+
+      if (rankA == 1) {
+        if (auto intA = a.get_int(), intB = b.get_int(); intA.has_value() and intB.has_value()) {
+          return *intA < *intB;
+        }
+
+        return get_number(a) < get_number(b);
+      }
+
+      if (rankA == 2) {
+        return *get_text(a) < *get_text(b);
+      }
+
+      return false;
+    }
+
+  private:
+    static std::pmr::string const *get_text(Data const &value) {
+      std::pmr::string const *text = nullptr;
+
+      value.get_value(overloaded{
+        [&](std::pmr::string const &arg) { text = &arg; },
+        [&]([[maybe_unused]] auto const &arg) { }
+      });
+
+      return text;
+    }
+
+    static int get_rank(Data const &value) {
+      int rank = 0;
+
+      value.get_value(overloaded{
+        [&]([[maybe_unused]] std::pmr::string const &arg) { rank = 2; },
+        [&]([[maybe_unused]] bool arg) { rank = 1; },
+        [&]([[maybe_unused]] int64_t arg) { rank = 1; },
+        [&]([[maybe_unused]] double arg) { rank = 1; },
+        [&]([[maybe_unused]] auto arg) { rank = 0; }
+      });
+
+      return rank;
+    }
+
+    static double get_number(Data const &value) {
+      double number = 0.0;
+
+      value.get_value(overloaded{
+        [&](bool arg) { number = arg; },
+        [&](int64_t arg) { number = static_cast<double>(arg); },
+        [&](double arg) { number = arg; },
+        [&]([[maybe_unused]] auto const &arg) { }
+      });
+
+      return number;
+    }
+  };
+
+  /*
+    Keeps every table in hash maps, so the typed operations (insert, upsert,
+    update, remove, find_by_rowid and Repository::load_by) skip SQL entirely.
+    Indexes declared through add_index() serve load_by() and load_between().
+
+    Raw statements given to query_string() run over an in memory SQLite copy:
+    the rows changed by the typed operations are written to it first and, if
+    the statement changes anything, the tables are loaded back from it.
+  */
+  template<typename... Tables>
+  struct MemoryDatabase : public Database {
+    MemoryDatabase() : mSql{":memory:"}, mTables{Table<Tables>{this}...} {
+    }
+
+    MemoryDatabase(MemoryDatabase const &) = delete;
+
+    MemoryDatabase &operator=(MemoryDatabase const &) = delete;
+
+    int64_t query_string(std::string const &sql, QueryCallback const &callback) override {
+      std::lock_guard<std::recursive_mutex> lk(mMutex);
+
+      sync_tables();
+
+      int64_t changes = mSql.get_total_changes();
+      int64_t lastRowId = mSql.get_last_rowid();
+      int64_t result = mSql.query_string(sql, callback);
+
+      if (mSql.get_total_changes() != changes) {
+        mSqlWrites++;
+
+        load_tables();
+      }
+
+      if (mSql.get_last_rowid() != lastRowId) {
+        mLastRowId = mSql.get_last_rowid();
+      }
+
+      return result;
+    }
+
+    /*
+      Typed changes are undone in memory on failure. A level that also ran
+      changing statements is reloaded from the SQLite copy instead, which is
+      rolled back by its own transaction.
+    */
+    void transaction(std::function<void(Database &)> callback) override {
+      std::lock_guard<std::recursive_mutex> lk(mMutex);
+
+      sync_tables();
+
+      std::size_t mark = mUndo.size();
+      uint64_t sqlWrites = mSqlWrites;
+
+      mDepth++;
+
+      try {
+        mSql.transaction([&]([[maybe_unused]] Database &db) {
+          callback(*this);
+        });
+      } catch (...) {
+        mDepth--;
+
+        if (mSqlWrites != sqlWrites) {
+          mUndo.resize(mark);
+
+          load_tables();
+        } else {
+          while (mUndo.size() > mark) {
+            mUndo.back()();
+            mUndo.pop_back();
+          }
+        }
+
+        throw;
+      }
+
+      if (--mDepth == 0) {
+        mUndo.clear();
+      }
+    }
+
+    int64_t get_last_rowid() override {
+      std::lock_guard<std::recursive_mutex> lk(mMutex);
+
+      return mLastRowId;
+    }
+
+    Database &add_migration(Migration migration) override {
+      std::lock_guard<std::recursive_mutex> lk(mMutex);
+
+      mSql.add_migration(std::move(migration));
+
+      return *this;
+    }
+
+    void build() {
+      std::lock_guard<std::recursive_mutex> lk(mMutex);
+
+      sync_tables();
+
+      mSql.build();
+
+      load_tables();
+    }
+
+    template<typename Model, jmixin::StringLiteral Field>
+    MemoryDatabase &add_index(IndexType type = IndexType::Hash) {
+      using Column = typename ColumnField<Model, Field>::Type;
+
+      std::lock_guard<std::recursive_mutex> lk(mMutex);
+
+      std::get<Table<Model> >(mTables).add_index(Column::get_name(), type);
+
+      return *this;
+    }
+
+    /*
+      Exact lookup by primary keys, in the order they are declared.
+    */
+    template<typename Model>
+    std::optional<Model> find(auto... keys) {
+      std::lock_guard<std::recursive_mutex> lk(mMutex);
+
+      return std::get<Table<Model> >(mTables).find(std::vector<Data>{Data{keys}...});
+    }
+
+    /*
+      Rows whose Field lies in [lower, upper], ordered by Field, through an
+      ordered index when there is one.
+    */
+    template<typename Model, jmixin::StringLiteral Field>
+    std::vector<Model> load_between(Data const &lower, Data const &upper) {
+      using Column = typename ColumnField<Model, Field>::Type;
+
+      std::lock_guard<std::recursive_mutex> lk(mMutex);
+
+      return std::get<Table<Model> >(mTables).load_between(Column::get_name(), lower, upper);
+    }
+
+  protected:
+    void *get_model_store(std::type_info const &type) override {
+      void *store = nullptr;
+
+      std::apply([&](auto &... table) { (find_store(table, type, store), ...); }, mTables);
+
+      return store;
+    }
+
+  private:
+    template<typename T>
+    struct Table : public ModelStore<T> {
+      using Model = T;
+
+      explicit Table(MemoryDatabase *owner) : mOwner{owner} {
+      }
+
+      Model insert(Model const &model) override {
+        std::lock_guard<std::recursive_mutex> lk(mOwner->mMutex);
+
+        validate(model);
+
+        Model row = materialize(model);
+        int64_t rowId = mSequence + 1;
+
+        Model::get_fields([&]<typename Field>() {
+          if constexpr (Field::get_type() == FieldType::Serial) {
+            if (auto id = row[Field::get_name()].get_int(); id.has_value()) {
+              rowId = *id;
+            }
+
+            row[Field::get_name()] = rowId;
+          }
+        });
+
+        if (Model::Keys::get_size() > 0 and mPrimary.contains(get_keys(row))) {
+          throw std::runtime_error(fmt::format("UNIQUE constraint failed: {}", Model::get_name()));
+        }
+
+        if (mRows.contains(rowId)) {
+          throw std::runtime_error(fmt::format("UNIQUE constraint failed: {}.rowid", Model::get_name()));
+        }
+
+        row.clear_dirty();
+
+        link(rowId, row);
+
+        mSequence = std::max(mSequence, rowId);
+        mOwner->mLastRowId = rowId;
+        mOwner->record([this, rowId]() { unlink(rowId); });
+
+        return row;
+      }
+
+      Model upsert(Model const &model) override {
+        std::lock_guard<std::recursive_mutex> lk(mOwner->mMutex);
+
+        validate(model);
+
+        auto it = Model::Keys::get_size() > 0 ? mPrimary.find(get_keys(normalize_model(model))) : mPrimary.end();
+
+        if (it == mPrimary.end()) {
+          return insert(model);
+        }
+
+        Model row = mRows.at(it->second);
+
+        Model::get_fields([&]<typename Field>() {
+          auto const &value = model[Field::get_name()];
+
+          if (Database::is_primary_key<Model, Field>() or mOwner->template default_with_null_value<Field>(value)) {
+            return;
+          }
+
+          row[Field::get_name()] = normalize(Field::get_type(), value.is_invalid() ? Data{nullptr} : value);
+        });
+
+        validate(row);
+        replace(it->second, row);
+
+        return mRows.at(it->second);
+      }
+
+      void update(Model const &model) override {
+        std::lock_guard<std::recursive_mutex> lk(mOwner->mMutex);
+
+        int64_t rowId = get_rowid(model);
+
+        if (rowId < 0) {
+          return;
+        }
+
+        Model row = mRows.at(rowId);
+        bool changed = false;
+
+        Model::get_fields([&]<typename Field>() {
+          auto const &value = model[Field::get_name()];
+
+          if (!model.is_dirty(Field::get_name()) or Database::is_primary_key<Model, Field>() or
+              value.is_invalid() or mOwner->template default_with_null_value<Field>(value)) {
+            return;
+          }
+
+          row[Field::get_name()] = normalize(Field::get_type(), value);
+          changed = true;
+        });
+
+        if (!changed) {
+          return;
+        }
+
+        validate(row);
+        replace(rowId, row);
+      }
+
+      bool remove(Model const &model) override {
+        std::lock_guard<std::recursive_mutex> lk(mOwner->mMutex);
+
+        int64_t rowId = get_rowid(model);
+
+        if (rowId >= 0) {
+          Model row = mRows.at(rowId);
+
+          unlink(rowId);
+
+          mOwner->record([this, rowId, row]() { link(rowId, row); });
+        }
+
+        return true;
+      }
+
+      void insert_all(std::vector<Model> const &models) override {
+        mOwner->transaction([&](Database &) {
+          ModelStore<Model>::insert_all(models);
+        });
+      }
+
+      void upsert_all(std::vector<Model> const &models) override {
+        mOwner->transaction([&](Database &) {
+          ModelStore<Model>::upsert_all(models);
+        });
+      }
+
+      std::optional<Model> find_by_rowid(int64_t rowId) override {
+        std::lock_guard<std::recursive_mutex> lk(mOwner->mMutex);
+
+        if (auto it = mRows.find(rowId); it != mRows.end()) {
+          return it->second;
+        }
+
+        return {};
+      }
+
+      /*
+        Same predicates as the statements of Repository::load_by: equality for
+        numbers and null, a case insensitive substring match (LIKE '%v%') for
+        text, which is why text never goes through an index.
+      */
+      std::vector<Model> load_by(Conditions const &conditions) override {
+        std::lock_guard<std::recursive_mutex> lk(mOwner->mMutex);
+
+        Conditions where;
+
+        for (auto const &[name, value]: conditions) {
+          if (!value.is_invalid()) {
+            where.emplace_back(name, normalize(get_type(name), value));
+          }
+        }
+
+        auto matches = [&](Model const &row) {
+          return std::ranges::all_of(where, [&](auto const &condition) {
+            return match(row[condition.first], condition.second);
+          });
+        };
+
+        std::vector<Model> items;
+
+        if (auto rowIds = get_candidates(where); rowIds != nullptr) {
+          for (auto rowId: *rowIds) {
+            if (auto const &row = mRows.at(rowId); matches(row)) {
+              items.push_back(row);
+            }
+          }
+
+          return items;
+        }
+
+        for (auto rowId: get_rowids()) {
+          if (auto const &row = mRows.at(rowId); matches(row)) {
+            items.push_back(row);
+          }
+        }
+
+        return items;
+      }
+
+      std::optional<Model> find(std::vector<Data> keys) {
+        std::size_t i = 0;
+
+        Model::get_keys([&]<typename Field>() {
+          keys.at(i) = normalize(Field::get_type(), keys.at(i));
+          i++;
+        });
+
+        if (auto it = mPrimary.find(keys); i == keys.size() and it != mPrimary.end()) {
+          return mRows.at(it->second);
+        }
+
+        return {};
+      }
+
+      std::vector<Model> load_between(std::string const &name, Data lower, Data upper) {
+        FieldType type = get_type(name);
+        std::vector<Model> items;
+
+        lower = normalize(type, lower);
+        upper = normalize(type, upper);
+
+        if (auto it = mIndexes.find(name); it != mIndexes.end() and it->second.type == IndexType::Ordered) {
+          auto &ordered = it->second.ordered;
+
+          for (auto entry = ordered.lower_bound(lower); entry != ordered.end() and
+                                                        !DataLess{}(upper, entry->first); ++entry) {
+            for (auto rowId: entry->second) {
+              items.push_back(mRows.at(rowId));
+            }
+          }
+
+          return items;
+        }
+
+        std::vector<std::pair<Data, int64_t> > found;
+
+        for (auto const &[rowId, row]: mRows) {
+          auto const &value = row[name];
+
+          if (!value.is_null() and !DataLess{}(value, lower) and !DataLess{}(upper, value)) {
+            found.emplace_back(value, rowId);
+          }
+        }
+
+        std::ranges::sort(found, [](auto const &a, auto const &b) {
+          return DataLess{}(a.first, b.first) or (!DataLess{}(b.first, a.first) and a.second < b.second);
+        });
+
+        for (auto const &[value, rowId]: found) {
+          items.push_back(mRows.at(rowId));
+        }
+
+        return items;
+      }
+
+      void add_index(std::string const &name, IndexType type) {
+        Index &index = mIndexes[name];
+
+        index = Index{type};
+
+        for (auto const &[rowId, row]: mRows) {
+          index.add(row[name], rowId);
+        }
+      }
+
+      /*
+        Writes the pending rows to the SQLite copy.
+      */
+      void sync(SqliteDatabase<Tables...> &sql) {
+        if (!mStale and mPending.empty()) {
+          return;
+        }
+
+        std::vector<int64_t> rowIds;
+
+        if (mStale) {
+          sql.query_string(fmt::format("DELETE FROM {};", Model::get_name()), [](auto...) { return false; });
+
+          rowIds = get_rowids();
+        } else {
+          std::ostringstream o;
+          bool first = true;
+
+          o << "DELETE FROM " << Model::get_name() << " WHERE _rowid_ IN (";
+
+          for (auto rowId: mPending) {
+            o << (first ? "" : ", ") << rowId;
+
+            first = false;
+
+            if (mRows.contains(rowId)) {
+              rowIds.push_back(rowId);
+            }
+          }
+
+          o << ");";
+
+          sql.query_string(o.str(), [](auto...) { return false; });
+        }
+
+        for (std::size_t i = 0; i < rowIds.size(); i += 256) {
+          std::ostringstream o;
+
+          o << "INSERT INTO " << Model::get_name() << " (_rowid_";
+
+          Model::get_fields([&]<typename Field>() {
+            o << ", " << Field::get_name();
+          });
+
+          o << ") VALUES ";
+
+          for (std::size_t j = i; j < std::min(i + 256, rowIds.size()); j++) {
+            auto const &row = mRows.at(rowIds[j]);
+
+            o << (j == i ? "(" : ", (") << rowIds[j];
+
+            Model::get_fields([&]<typename Field>() {
+              o << ", " << to_literal(row[Field::get_name()]);
+            });
+
+            o << ")";
+          }
+
+          o << ";";
+
+          sql.query_string(o.str(), [](auto...) { return false; });
+        }
+
+        mPending.clear();
+        mStale = false;
+      }
+
+      /*
+        Replaces every row by the content of the SQLite copy.
+      */
+      void load(SqliteDatabase<Tables...> &sql) {
+        mRows.clear();
+        mPrimary.clear();
+        mPending.clear();
+        mStale = false;
+
+        for (auto &[name, index]: mIndexes) {
+          index = Index{index.type};
+        }
+
+        sql.query_string(fmt::format("SELECT _rowid_ AS jdb_rowid, * FROM {};", Model::get_name()),
+                         [&](std::vector<std::string> const &columns, std::vector<Data> const &values) {
+                           Model row;
+                           int64_t rowId = values[0].get_int().value();
+
+                           for (std::size_t i = 1; i < columns.size(); i++) {
+                             row[columns[i]] = values[i];
+                           }
+
+                           row.clear_dirty();
+
+                           link(rowId, row);
+
+                           mSequence = std::max(mSequence, rowId);
+
+                           return true;
+                         });
+
+        mPending.clear();
+      }
+
+      void mark_stale() {
+        mStale = true;
+      }
+
+    private:
+      struct Index {
+        IndexType type{IndexType::Hash};
+        std::unordered_map<Data, std::set<int64_t>, DataHash> hash;
+        std::map<Data, std::set<int64_t>, DataLess> ordered;
+
+        void add(Data const &value, int64_t rowId) {
+          if (type == IndexType::Hash) {
+            hash[value].insert(rowId);
+          } else {
+            ordered[value].insert(rowId);
+          }
+        }
+
+        void remove(Data const &value, int64_t rowId) {
+          if (type == IndexType::Hash) {
+            if (auto it = hash.find(value); it != hash.end() and it->second.erase(rowId) and it->second.empty()) {
+              hash.erase(it);
+            }
+          } else {
+            if (auto it = ordered.find(value); it != ordered.end() and it->second.erase(rowId) and
+                                               it->second.empty()) {
+              ordered.erase(it);
+            }
+          }
+        }
+
+        std::set<int64_t> const *find(Data const &value) const {
+          static std::set<int64_t> const empty;
+
+          if (type == IndexType::Hash) {
+            auto it = hash.find(value);
+
+            return it == hash.end() ? &empty : &it->second;
+          }
+
+          auto it = ordered.find(value);
+
+          return it == ordered.end() ? &empty : &it->second;
+        }
+      };
+
+      MemoryDatabase *mOwner;
+      std::unordered_map<int64_t, Model> mRows;
+      std::unordered_map<std::vector<Data>, int64_t, DataHash> mPrimary;
+      std::map<std::string, Index> mIndexes;
+      std::set<int64_t> mPending;
+      std::set<int64_t> mSingle;
+      int64_t mSequence{};
+      bool mStale{false};
+
+      void link(int64_t rowId, Model const &row) {
+        auto [it, inserted] = mRows.insert_or_assign(rowId, row);
+
+        if (Model::Keys::get_size() > 0) {
+          mPrimary[get_keys(it->second)] = rowId;
+        }
+
+        for (auto &[name, index]: mIndexes) {
+          index.add(it->second[name], rowId);
+        }
+
+        mPending.insert(rowId);
+      }
+
+      void unlink(int64_t rowId) {
+        auto it = mRows.find(rowId);
+
+        if (it == mRows.end()) {
+          return;
+        }
+
+        if (Model::Keys::get_size() > 0) {
+          mPrimary.erase(get_keys(it->second));
+        }
+
+        for (auto &[name, index]: mIndexes) {
+          index.remove(it->second[name], rowId);
+        }
+
+        mRows.erase(it);
+        mPending.insert(rowId);
+      }
+
+      void replace(int64_t rowId, Model row) {
+        Model previous = mRows.at(rowId);
+
+        row.clear_dirty();
+
+        unlink(rowId);
+        link(rowId, row);
+
+        mOwner->record([this, rowId, previous]() {
+          unlink(rowId);
+          link(rowId, previous);
+        });
+      }
+
+      /*
+        The checks of an INSERT statement: values convertible to the field
+        types and no null in a not null field without a default.
+      */
+      void validate(Model const &model) {
+        std::ostringstream discard;
+
+        mOwner->get_insert_values(discard, model);
+      }
+
+      Model materialize(Model const &model) {
+        Model row;
+
+        Model::get_fields([&]<typename Field>() {
+          auto const &value = model[Field::get_name()];
+
+          if (mOwner->template default_with_null_value<Field>(value)) {
+            row[Field::get_name()] = normalize(Field::get_type(), mOwner->evaluate(Field::get_default().value()));
+          } else if (value.is_invalid() or value.is_null()) {
+            if (!Field::nullable() and Field::get_type() != FieldType::Serial) {
+              throw std::runtime_error(
+                fmt::format("NOT NULL constraint failed: {}.{}", Model::get_name(), Field::get_name()));
+            }
+
+            row[Field::get_name()] = nullptr;
+          } else {
+            row[Field::get_name()] = normalize(Field::get_type(), value);
+          }
+        });
+
+        return row;
+      }
+
+      static Model normalize_model(Model const &model) {
+        Model row;
+
+        Model::get_fields([&]<typename Field>() {
+          row[Field::get_name()] = normalize(Field::get_type(), model[Field::get_name()]);
+        });
+
+        return row;
+      }
+
+      static std::vector<Data> get_keys(Model const &row) {
+        std::vector<Data> keys;
+
+        Model::get_keys([&]<typename Field>() {
+          keys.push_back(row[Field::get_name()]);
+        });
+
+        return keys;
+      }
+
+      int64_t get_rowid(Model const &model) {
+        if constexpr (Model::Keys::get_size() == 0) {
+          throw std::runtime_error(fmt::format("'{}' has no primary keys", Model::get_name()));
+        }
+
+        if (auto it = mPrimary.find(get_keys(normalize_model(model))); it != mPrimary.end()) {
+          return it->second;
+        }
+
+        return -1;
+      }
+
+      std::vector<int64_t> get_rowids() const {
+        std::vector<int64_t> rowIds;
+
+        rowIds.reserve(mRows.size());
+
+        for (auto const &[rowId, row]: mRows) {
+          rowIds.push_back(rowId);
+        }
+
+        std::ranges::sort(rowIds);
+
+        return rowIds;
+      }
+
+      /*
+        Rows that may match, in ROWID order: the one with the given primary
+        keys or the rows of the first indexed condition; null means a scan.
+      */
+      std::set<int64_t> const *get_candidates(Conditions const &where) {
+        if (Model::Keys::get_size() > 0 and where.size() >= Model::Keys::get_size()) {
+          std::vector<Data> keys;
+
+          Model::get_keys([&]<typename Field>() {
+            for (auto const &[name, value]: where) {
+              if (name == Field::get_name() and !value.get_text().has_value()) {
+                keys.push_back(value);
+
+                break;
+              }
+            }
+          });
+
+          if (keys.size() == Model::Keys::get_size()) {
+            mSingle.clear();
+
+            if (auto it = mPrimary.find(keys); it != mPrimary.end()) {
+              mSingle.insert(it->second);
+            }
+
+            return &mSingle;
+          }
+        }
+
+        for (auto const &[name, value]: where) {
+          if (auto it = mIndexes.find(name); it != mIndexes.end() and !value.get_text().has_value()) {
+            return it->second.find(value);
+          }
+        }
+
+        return nullptr;
+      }
+
+      static FieldType get_type(std::string const &name) {
+        std::optional<FieldType> type;
+
+        Model::get_fields([&]<typename Field>() {
+          if (Field::get_name() == name) {
+            type = Field::get_type();
+          }
+        });
+
+        if (!type.has_value()) {
+          throw std::runtime_error(fmt::format("no such column: {}", name));
+        }
+
+        return *type;
+      }
+    };
+
+    std::recursive_mutex mMutex;
+    SqliteDatabase<Tables...> mSql;
+    std::tuple<Table<Tables>...> mTables;
+    std::vector<std::function<void()> > mUndo;
+    int mDepth{};
+    uint64_t mSqlWrites{};
+    int64_t mLastRowId{};
+
+    template<typename Model>
+    static void find_store(Table<Model> &table, std::type_info const &type, void *&store) {
+      if (typeid(Model) == type) {
+        store = static_cast<ModelStore<Model> *>(&table);
+      }
+    }
+
+    void record(std::function<void()> undo) {
+      if (mDepth > 0) {
+        mUndo.push_back(std::move(undo));
+      }
+    }
+
+    void sync_tables() {
+      std::apply([&](auto &... table) { (table.sync(mSql), ...); }, mTables);
+    }
+
+    void load_tables() {
+      std::apply([&](auto &... table) { (table.load(mSql), ...); }, mTables);
+    }
+
+    Data evaluate(std::string const &expression) {
+      Data result{nullptr};
+
+      mSql.query_string("SELECT " + expression + ";", [&](auto const &columns, auto const &values) {
+        result = values[0];
+
+        return false;
+      });
+
+      return result;
+    }
+
+    static bool like(std::string const &text, std::string const &pattern) {
+      auto it = std::ranges::search(text, pattern, [](unsigned char a, unsigned char b) {
+        return std::tolower(a) == std::tolower(b);
+      });
+
+      return pattern.empty() or !it.empty();
+    }
+
+    static bool match(Data const &stored, Data const &value) {
+      if (value.is_null()) {
+        return stored.is_null();
+      }
+
+      if (stored.is_null() or stored.is_invalid()) {
+        return false;
+      }
+
+      if (auto pattern = value.get_text(); pattern.has_value()) {
+        return like(stored.get_text().value_or(jdb::to_string(stored)), *pattern);
+      }
+
+      if (stored.get_text().has_value()) {
+        return false;
+      }
+
+      return !DataLess{}(stored, value) and !DataLess{}(value, stored);
+    }
+
+    static std::string to_literal(Data const &value) {
+      std::string literal = "NULL";
+
+      value.get_value(overloaded{
+        [&](bool arg) { literal = arg ? "1" : "0"; },
+        [&](int64_t arg) { literal = std::to_string(arg); },
+        [&](double arg) {
+          if (std::isnan(arg)) {
+            literal = "NULL";
+          } else if (std::isinf(arg)) {
+            literal = arg > 0 ? "9e999" : "-9e999";
+          } else {
+            literal = fmt::format("{}", arg);
+
+            if (literal.find_first_of(".e") == std::string::npos) {
+              literal += ".0";
+            }
+          }
+        },
+        [&](std::pmr::string const &arg) {
+          literal = "'";
+
+          for (char c: arg) {
+            literal += c == '\'' ? "''" : std::string(1, c);
+          }
+
+          literal += "'";
+        },
+        [&]([[maybe_unused]] auto const &arg) { }
+      });
+
+      return literal;
+    }
+  };
+}
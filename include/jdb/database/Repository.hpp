@@ -1,8 +1,11 @@
 #pragma once
 
 #include "jdb/database/Database.hpp"
+#include "jdb/database/ColumnBatch.hpp"
 #include "jdb/database/CompoundModel.hpp"
+#include "jdb/database/ResultArena.hpp"
 
+#include <limits>
 #include <optional>
 #include <sstream>
 #include <string>
@@ -30,7 +33,7 @@ namespace jdb {
       o << "SELECT * from " << Model::get_name() << " "
           << fmt::vformat(Extras.to_string(), fmt::make_format_args(values...));
 
-      mDb->query_string(o.str(), callback);
+      query(o.str(), callback);
 
       return items;
     }
@@ -43,30 +46,67 @@ namespace jdb {
       o << "SELECT * from " << Model::get_name() << " "
           << fmt::vformat(Extras.to_string(), fmt::make_format_args(values...));
 
-      mDb->query_string(o.str(), [&](std::vector<std::string> const &columns,
-                                     std::vector<Data> const &values) {
-        Model item;
+      fill(items, o.str(), Limit);
 
-        if (items.size() >= Limit) {
-          return false;
-        }
+      return items;
+    }
 
-        for (int i = 0; i < static_cast<int>(columns.size()); i++) {
-          std::string const &column = columns[i];
+    /*
+      Same as select(), but the result set lives in the arena.
+    */
+    template<jmixin::StringLiteral Extras, std::size_t Limit = 100>
+    ResultSet<Model> select(ResultArena &arena, auto... values) const {
+      ResultSet<Model> items{arena.get_resource()};
+      std::ostringstream o;
 
-          item[column] = values[i];
+      o << "SELECT * from " << Model::get_name() << " "
+          << fmt::vformat(Extras.to_string(), fmt::make_format_args(values...));
+
+      fill(items, o.str(), Limit);
+
+      return items;
+    }
+
+    std::vector<Model> load_all() const { return select<"ORDER BY ROWID">(); }
+
+    ResultSet<Model> load_all(ResultArena &arena) const { return select<"ORDER BY ROWID">(arena); }
+
+    /*
+      Reads only the given columns, into contiguous per column arrays. Extras
+      is formatted with values, as in select():
+
+        repository.select_columns<"hits", "label">("WHERE hits > {}", 10);
+    */
+    template<jmixin::StringLiteral... Columns>
+    ColumnBatch<Model, Columns...> select_columns(std::string_view extras = {}, auto... values) const {
+      ColumnBatch<Model, Columns...> batch;
+      std::ostringstream o;
+      bool first = true;
+
+      o << "SELECT ";
+
+      for (auto const &column: {Columns.to_string()...}) {
+        if (!first) {
+          o << ", ";
         }
 
-        items.emplace_back(item);
+        first = false;
+
+        o << column;
+      }
+
+      o << " from " << Model::get_name() << " " << fmt::vformat(extras, fmt::make_format_args(values...));
+
+      query(o.str(), [&](std::vector<std::string> const &columns,
+                         std::vector<Data> const &values) {
+        batch.push_back(values);
 
         return true;
       });
 
-      return items;
+      return batch;
     }
 
-    std::vector<Model> load_all() const { return select<"ORDER BY ROWID">(); }
-
     template<jmixin::StringLiteral... Fields>
     int64_t count_by(auto... values) const {
       std::ostringstream o;
@@ -76,8 +116,8 @@ namespace jdb {
 
       for_each_where<0, Fields...>(o, values...);
 
-      mDb->query_string(o.str(), [&](std::vector<std::string> const &columns,
-                                     std::vector<Data> const &values) {
+      query(o.str(), [&](std::vector<std::string> const &columns,
+                         std::vector<Data> const &values) {
         result = values[0].get_int().value();
 
         return false;
@@ -97,13 +137,17 @@ namespace jdb {
 
       o << " ORDER BY ROWID";
 
-      mDb->query_string(o.str(), callback);
+      query(o.str(), callback);
 
       return items;
     }
 
     template<jmixin::StringLiteral... Fields>
     std::vector<Model> load_by(auto... values) const {
+      if (auto *store = mDb->get_store<Model>(); store != nullptr) {
+        return store->load_by(get_conditions<Fields...>(values...));
+      }
+
       std::vector<Model> items;
       std::ostringstream o;
 
@@ -113,20 +157,38 @@ namespace jdb {
 
       o << " ORDER BY ROWID";
 
-      mDb->query_string(o.str(), [&](std::vector<std::string> const &columns,
-                                     std::vector<Data> const &values) {
-        Model item;
+      fill(items, o.str());
 
-        for (int i = 0; i < static_cast<int>(columns.size()); i++) {
-          std::string const &column = columns[i];
+      return items;
+    }
 
-          item[column] = values[i];
+    /*
+      Same as load_by(), but the result set lives in the arena.
+    */
+    template<jmixin::StringLiteral... Fields>
+    ResultSet<Model> load_by(ResultArena &arena, auto... values) const {
+      ResultSet<Model> items{arena.get_resource()};
+      std::ostringstream o;
+
+      if (auto *store = mDb->get_store<Model>(); store != nullptr) {
+        auto result = store->load_by(get_conditions<Fields...>(values...));
+
+        items.reserve(result.size());
+
+        for (auto &item: result) {
+          items.emplace_back(std::move(item));
         }
 
-        items.emplace_back(item);
+        return items;
+      }
 
-        return true;
-      });
+      o << "SELECT * from " << Model::get_name() << " WHERE ";
+
+      for_each_where<0, Fields...>(o, values...);
+
+      o << " ORDER BY ROWID";
+
+      fill(items, o.str());
 
       return items;
     }
@@ -150,8 +212,8 @@ namespace jdb {
 
       o << " ASC LIMIT 1";
 
-      mDb->query_string(o.str(), [&](std::vector<std::string> const &columns,
-                                     std::vector<Data> const &values) {
+      query(o.str(), [&](std::vector<std::string> const &columns,
+                         std::vector<Data> const &values) {
         Model item;
 
         for (int i = 0; i < (int) columns.size(); i++) {
@@ -160,7 +222,9 @@ namespace jdb {
           item[column] = values[i];
         }
 
-        items.emplace_back(item);
+        item.clear_dirty();
+
+        items.emplace_back(std::move(item));
 
         return false;
       });
@@ -191,8 +255,8 @@ namespace jdb {
 
       o << " DESC LIMIT 1";
 
-      mDb->query_string(o.str(), [&](std::vector<std::string> const &columns,
-                                     std::vector<Data> const &values) {
+      query(o.str(), [&](std::vector<std::string> const &columns,
+                         std::vector<Data> const &values) {
         Model item;
 
         for (int i = 0; i < (int) columns.size(); i++) {
@@ -201,7 +265,9 @@ namespace jdb {
           item[column] = values[i];
         }
 
-        items.emplace_back(item);
+        item.clear_dirty();
+
+        items.emplace_back(std::move(item));
 
         return false;
       });
@@ -227,12 +293,22 @@ namespace jdb {
       return {};
     }
 
-    void upsave(Model const &item) {
-      return save(item).or_else([&]() {
-        return update(item).or_else([]() {
-          throw std::runtime_error("upsert error");
-        });
-      });
+    [[nodiscard]] std::expected<Model, std::runtime_error> upsave(Model const &item) const {
+      try {
+        return mDb->upsert(item);
+      } catch (std::runtime_error &e) {
+        return std::unexpected{e};
+      }
+    }
+
+    std::optional<std::string> upsave_all(std::vector<Model> const &items) const {
+      try {
+        mDb->upsert_all(items);
+      } catch (std::runtime_error &e) {
+        return e.what();
+      }
+
+      return {};
     }
 
     [[nodiscard]] std::expected<Model, std::runtime_error> save(Model const &item) const {
@@ -246,9 +322,9 @@ namespace jdb {
     void save_all(std::vector<Model> const &items) const {
       mDb->transaction([&](Database &db) {
         for (auto const &item: items) {
-          save(item).or_else([](auto const &e) {
-            throw std::runtime_error(std::format("unable to save model: {}", e.what()));
-          });
+          if (auto result = save(item); !result.has_value()) {
+            throw std::runtime_error(std::format("unable to save model: {}", result.error().what()));
+          }
         }
       });
     }
@@ -304,6 +380,66 @@ namespace jdb {
       return load_by<Keys...>(values...);
     }
 
+    template<jmixin::StringLiteral... Fields>
+    static Conditions get_conditions(auto... values) {
+      return Conditions{{Fields.to_string(), Data{values}}...};
+    }
+
+    /*
+      Rows are built in place and take the values of the statement row by
+      move, so each text is allocated once, from the resource of the result.
+      Arena results start with room for a first batch of rows and grow from
+      there, the statement is not run twice to size them.
+    */
+    void fill(auto &items, std::string const &sql,
+              std::size_t limit = std::numeric_limits<std::size_t>::max()) const {
+      static constexpr std::size_t FirstBatch = 64;
+
+      std::pmr::memory_resource *resource = std::pmr::get_default_resource();
+
+      if constexpr (std::same_as<std::remove_cvref_t<decltype(items)>, ResultSet<Model> >) {
+        resource = items.get_allocator().resource();
+
+        items.reserve(items.size() + std::min(limit, FirstBatch));
+      }
+
+      read([&](Database &db) {
+        db.query_rows(sql, resource, [&](std::vector<std::string> const &columns, std::vector<Data> &values) {
+          if (items.size() >= limit) {
+            return false;
+          }
+
+          Model &item = items.emplace_back();
+
+          for (int i = 0; i < static_cast<int>(columns.size()); i++) {
+            item[columns[i]] = std::move(values[i]);
+          }
+
+          item.clear_dirty();
+
+          return true;
+        });
+      });
+    }
+
+    /*
+      Reads of MemoryPinned models run in read_transaction(), so file
+      databases serve them from the copies kept by the read connections.
+    */
+    void read(std::function<void(Database &)> const &callback) const {
+      if constexpr (MemoryPinned<Model>::value) {
+        mDb->read_transaction(callback);
+      } else {
+        callback(*mDb);
+      }
+    }
+
+    void query(std::string const &sql, QueryCallback const &callback) const {
+      read([&](Database &db) {
+        db.query_string(sql, callback);
+      });
+    }
+
     template<std::size_t Index, jmixin::StringLiteral Field, jmixin::StringLiteral... Fields>
     void for_each_where(std::ostream &out, Data value, auto... values) const {
       if (Index != 0) {
@@ -326,7 +462,7 @@ namespace jdb {
         [&](double arg) {
           out << "(" << Field.to_string() << " = " << arg << ")";
         },
-        [&](std::string arg) {
+        [&](std::pmr::string const &arg) {
           out << "(" << Field.to_string() << " LIKE '%" << arg << "%')";
         }
       });
@@ -392,7 +528,7 @@ namespace jdb {
 
         for_each_fill_model<0, Models...>(item, columns.begin(), values.begin());
 
-        items.emplace_back(item);
+        items.emplace_back(std::move(item));
 
         return true;
       });
@@ -439,6 +575,8 @@ namespace jdb {
         item.template get<TModel>(*itColumn++) = *itValue++;
       }
 
+      item.template get<TModel>().clear_dirty();
+
       if constexpr (sizeof...(TModels) > 0) {
         for_each_fill_model<Index + 1, TModels...>(item, itColumn, itValue);
       }
@@ -497,9 +635,11 @@ namespace jdb {
 
     template<std::size_t Index, typename TModel, typename... TModels>
     void for_each_update(Model const &item) const {
-      std::unique_ptr<Repository<TModel> > repository = jinject::get{};
+      if (item.template get<TModel>().is_dirty()) {
+        std::unique_ptr<Repository<TModel> > repository = jinject::get{};
 
-      repository->update(item.template get<TModel>());
+        repository->update(item.template get<TModel>());
+      }
 
       if constexpr (sizeof...(TModels) > 0) {
         for_each_update<Index + 1, TModels...>(item);
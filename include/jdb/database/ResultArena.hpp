@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <memory_resource>
+#include <vector>
+
+namespace jdb {
+  /*
+    Monotonic arena for query results: the rows of every result set built
+    over it, and the text of their values, are bump allocated and given back
+    at once by release(), or when the arena goes away. Result sets, and rows
+    or values moved out of them, must not outlive their arena; copies are
+    independent of it.
+  */
+  struct ResultArena {
+    explicit ResultArena(std::size_t initialSize = 64 * 1024)
+      : mResource{initialSize} {
+    }
+
+    ResultArena(ResultArena const &) = delete;
+
+    ResultArena &operator=(ResultArena const &) = delete;
+
+    [[nodiscard]] std::pmr::memory_resource *get_resource() {
+      return &mResource;
+    }
+
+    /*
+      Every result set built over the arena must be destroyed before.
+    */
+    void release() {
+      mResource.release();
+    }
+
+  private:
+    std::pmr::monotonic_buffer_resource mResource;
+  };
+
+  template<typename Model>
+  using ResultSet = std::pmr::vector<Model>;
+}
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <SQLiteCpp/SQLiteCpp.h>
+
+#include <fmt/format.h>
+
+namespace jdb {
+  struct ScanViolation {
+    std::string sql;
+    std::string table;
+    int64_t rows{};
+    std::string detail;
+  };
+
+  inline std::string to_string(ScanViolation const &violation) {
+    return fmt::format("'{}' over table '{}' ({} rows): {}",
+                       violation.detail, violation.table, violation.rows, violation.sql);
+  }
+
+  struct FullScanError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+  };
+
+  enum class ScanAction { Throw, Report };
+
+  /*
+    Test time policy: filtering statements that scan, or build an automatic
+    index over, a table holding at least minRows rows are rejected (Throw)
+    before running, or handed to sink (Report).
+  */
+  struct ScanPolicy {
+    int64_t minRows{1000};
+    ScanAction action{ScanAction::Throw};
+    std::function<void(ScanViolation const &)> sink = [](ScanViolation const &violation) {
+      std::clog << "full scan: " << to_string(violation) << std::endl;
+    };
+  };
+
+  /*
+    Only statements with a WHERE clause are checked, since reading a whole
+    table (load_all, unfiltered selects) is a scan on purpose. For the same
+    reason the outermost scan of a join is accepted when the other tables
+    are searched through an index.
+  */
+  struct ScanDetector {
+    explicit ScanDetector(ScanPolicy policy) : mPolicy{std::move(policy)} {
+    }
+
+    void check(SQLite::Database &connection, std::string const &sql) const {
+      if (!is_filtering(sql)) {
+        return;
+      }
+
+      struct Step {
+        int64_t id;
+        int64_t parent;
+        std::string detail;
+      };
+
+      std::vector<Step> plan;
+
+      try {
+        SQLite::Statement query(connection, "EXPLAIN QUERY PLAN " + sql);
+
+        while (query.executeStep()) {
+          plan.push_back({query.getColumn(0).getInt64(), query.getColumn(1).getInt64(),
+                          query.getColumn(3).getString()});
+        }
+      } catch (std::exception &) {
+        return;
+      }
+
+      bool searches = std::ranges::any_of(plan, [](auto const &step) {
+        return step.detail.starts_with("SEARCH ");
+      });
+      bool driver = true;
+      std::map<std::string, int64_t> sizes;
+
+      for (auto const &step: plan) {
+        bool automatic = step.detail.find("AUTOMATIC") != std::string::npos;
+        bool scan = step.detail.starts_with("SCAN ") and step.detail.find(" USING ") == std::string::npos;
+
+        if (!automatic and !scan) {
+          if (step.detail.starts_with("SEARCH ")) {
+            driver = false;
+          }
+
+          continue;
+        }
+
+        std::string table = get_table(step.detail);
+
+        if (table.empty()) {
+          continue;
+        }
+
+        if (scan and driver and searches) {
+          driver = false;
+
+          continue;
+        }
+
+        driver = false;
+
+        if (!sizes.contains(table)) {
+          sizes[table] = count_rows(connection, table);
+        }
+
+        if (sizes[table] < mPolicy.minRows) {
+          continue;
+        }
+
+        ScanViolation violation{sql, table, sizes[table], step.detail};
+
+        if (mPolicy.action == ScanAction::Throw) {
+          throw FullScanError(fmt::format("full scan: {}", to_string(violation)));
+        }
+
+        if (mPolicy.sink) {
+          mPolicy.sink(violation);
+        }
+      }
+    }
+
+  private:
+    ScanPolicy mPolicy;
+
+    static std::string upper(std::string_view value) {
+      std::string out{value};
+
+      std::ranges::transform(out, out.begin(), [](unsigned char c) { return std::toupper(c); });
+
+      return out;
+    }
+
+    static bool is_filtering(std::string const &sql) {
+      std::string statement = upper(sql.substr(0, std::min<std::size_t>(sql.size(), 16)));
+      auto start = statement.find_first_not_of(" \t\r\n");
+
+      if (start == std::string::npos) {
+        return false;
+      }
+
+      statement = statement.substr(start);
+
+      if (!statement.starts_with("SELECT") and !statement.starts_with("UPDATE") and
+          !statement.starts_with("DELETE") and !statement.starts_with("INSERT") and
+          !statement.starts_with("WITH")) {
+        return false;
+      }
+
+      return upper(sql).find(" WHERE ") != std::string::npos;
+    }
+
+    /*
+      "SCAN counter", "SCAN TABLE counter AS c", "SEARCH counter USING
+      AUTOMATIC COVERING INDEX (hits=?)", "BLOOM FILTER ON counter (hits=?)"
+    */
+    static std::string get_table(std::string const &detail) {
+      std::istringstream words(detail);
+      std::string word;
+
+      while (words >> word) {
+        if (word == "SCAN" or word == "SEARCH" or word == "ON") {
+          break;
+        }
+      }
+
+      if (!(words >> word)) {
+        return {};
+      }
+
+      if (word == "TABLE" and !(words >> word)) {
+        return {};
+      }
+
+      if (word == "CONSTANT" or word.starts_with("(")) {
+        return {};
+      }
+
+      return word;
+    }
+
+    static int64_t count_rows(SQLite::Database &connection, std::string const &table) {
+      try {
+        SQLite::Statement query(connection, fmt::format("SELECT COUNT(*) FROM \"{}\";", table));
+
+        if (query.executeStep()) {
+          return query.getColumn(0).getInt64();
+        }
+      } catch (std::exception &) {
+        // not a table (view, cte)
+      }
+
+      return 0;
+    }
+  };
+}
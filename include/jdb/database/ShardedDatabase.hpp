@@ -0,0 +1,1281 @@
+#pragma once
+
+#include "jdb/database/Database.hpp"
+#include "jdb/database/MemoryDatabase.hpp"
+#include "jdb/database/SqliteDatabase.hpp"
+#include "jdb/utils/Scope.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace jdb {
+  /*
+    Spreads the rows of every table over N SqliteDatabase shards, so N
+    writers run at once. Each model goes to the shard picked by a hash of
+    its primary keys; models without keys are dealt round robin. Serial keys
+    are handed out here, from one sequence per table, so they stay unique
+    over the shards and still route the row.
+
+    Typed operations (insert, upsert, update, remove, find_by_rowid,
+    Repository::load_by and the bulk insert_all/upsert_all) go to the owning
+    shard when the keys tell it, and to every shard otherwise. Raw SELECTs
+    given to query_string() run on every shard and are merged: rows are
+    interleaved by ORDER BY and cut by LIMIT/OFFSET, and select lists made
+    only of COUNT, SUM, TOTAL, MIN and MAX are combined into one row (what
+    Repository::count_by uses). The merge compares values by their bytes, so
+    ORDER BY terms with COLLATE throw and columns declared with a collation
+    interleave in binary order. GROUP BY, DISTINCT, compound selects and
+    AVG can not be merged and throw. Other statements run on every shard,
+    except raw INSERTs, which can not be routed.
+
+    Outside of a transaction the shards are worked in parallel (one thread
+    each), bulk writes included. transaction() holds a transaction open on
+    every shard and runs the callback on the calling thread: each shard
+    rolls back on failure, but shards commit one after the other, so a
+    failing commit may leave the ones before it committed. Reads see each
+    shard's own snapshot, not a single one.
+  */
+  template<typename... Tables>
+  struct ShardedDatabase : public Database {
+    using Shard = SqliteDatabase<Tables...>;
+
+    /*
+      pattern names the file of each shard, formatted with its index
+      ("orders-{}.db"); ":memory:" gives in memory shards.
+    */
+    ShardedDatabase(std::string const &pattern, std::size_t shards, BusyPolicy busyPolicy = {})
+      : mTables{Table<Tables>{this}...} {
+      if (shards == 0) {
+        throw std::invalid_argument("ShardedDatabase needs at least one shard");
+      }
+
+      for (std::size_t i = 0; i < shards; i++) {
+        mShards.push_back(std::make_shared<Shard>(fmt::format(fmt::runtime(pattern), i), busyPolicy));
+      }
+
+      mScope = std::make_unique<Scope>(shards);
+    }
+
+    ShardedDatabase(ShardedDatabase const &) = delete;
+
+    ShardedDatabase &operator=(ShardedDatabase const &) = delete;
+
+    ~ShardedDatabase() override {
+      mScope.reset();
+    }
+
+    [[nodiscard]] std::size_t get_shard_count() const {
+      return mShards.size();
+    }
+
+    Shard &get_shard(std::size_t index) {
+      return *mShards.at(index);
+    }
+
+    /*
+      Shard that owns the row with the keys of model.
+    */
+    template<typename Model>
+    std::size_t get_shard_index(Model const &model) {
+      return std::get<Table<Model> >(mTables).route(model);
+    }
+
+    int64_t query_string(std::string const &sql, QueryCallback const &callback) override {
+      auto words = get_words(sql, false);
+      std::string kind = words.empty() ? std::string{} : words[0].text;
+
+      if (kind == "SELECT") {
+        return select(sql, words, callback);
+      }
+
+      if (kind == "INSERT" or kind == "REPLACE") {
+        throw std::runtime_error(
+          fmt::format("raw inserts can not be routed to a shard, use the typed operations: {}", sql));
+      }
+
+      std::vector<Result> results(mShards.size());
+      std::vector<int64_t> changes(mShards.size());
+
+      for_each_shard([&](std::size_t i) {
+        mShards[i]->write_transaction([&](Database &db) {
+          changes[i] = db.query_string(sql, collect(results[i]));
+        });
+      });
+
+      deliver_in_order(results, 0, callback);
+
+      int64_t result = -1;
+
+      for (int64_t value: changes) {
+        if (value >= 0) {
+          result = std::max<int64_t>(result, 0) + value;
+        }
+      }
+
+      return result;
+    }
+
+    void transaction(std::function<void(Database &)> callback) override {
+      std::lock_guard<std::recursive_mutex> lk(mTransactionMutex);
+
+      mOwner.store(std::this_thread::get_id());
+      mDepth++;
+
+      try {
+        open(0, callback);
+      } catch (...) {
+        if (--mDepth == 0) {
+          mOwner.store({});
+        }
+
+        throw;
+      }
+
+      if (--mDepth == 0) {
+        mOwner.store({});
+      }
+    }
+
+    /*
+      Reads go to the shards as they come, each one over its own snapshot.
+    */
+    void read_transaction(std::function<void(Database &)> callback) override {
+      callback(*this);
+    }
+
+    int64_t get_last_rowid() override {
+      return mLastRowId.load();
+    }
+
+    ShardedDatabase &add_migration(Migration migration) override {
+      for (auto &shard: mShards) {
+        shard->add_migration(migration);
+      }
+
+      return *this;
+    }
+
+    void build() {
+      for (auto &shard: mShards) {
+        shard->build();
+      }
+    }
+
+  protected:
+    void *get_model_store(std::type_info const &type) override {
+      void *store = nullptr;
+
+      std::apply([&](auto &... table) { (find_store(table, type, store), ...); }, mTables);
+
+      return store;
+    }
+
+  private:
+    struct Result {
+      std::vector<std::string> columns;
+      std::vector<std::vector<Data> > rows;
+    };
+
+    struct SortKey {
+      std::size_t column;
+      bool hidden;
+      bool descending;
+    };
+
+    struct Column {
+      std::string_view expression;
+      std::string_view alias;
+      // position in the result unknown, a star expands before it
+      bool afterStar;
+    };
+
+    struct Word {
+      std::size_t begin;
+      std::size_t end;
+      // upper case
+      std::string text;
+    };
+
+    template<typename T>
+    struct Table : public ModelStore<T> {
+      using Model = T;
+
+      explicit Table(ShardedDatabase *owner) : mOwner{owner} {
+      }
+
+      // only moved into mTables, before any use
+      Table(Table &&other) noexcept : mOwner{other.mOwner} {
+      }
+
+      Model insert(Model const &model) override {
+        Model row = model;
+        std::size_t shard = assign(row);
+        Model result = mOwner->mShards[shard]->insert(row);
+
+        mOwner->mLastRowId.store(mOwner->mShards[shard]->get_last_rowid());
+
+        return result;
+      }
+
+      Model upsert(Model const &model) override {
+        if (Model::Keys::get_size() == 0 or !has_keys(model)) {
+          return insert(model);
+        }
+
+        Model row = model;
+        std::size_t shard = assign(row);
+
+        return mOwner->mShards[shard]->upsert(row);
+      }
+
+      void update(Model const &model) override {
+        if constexpr (Model::Keys::get_size() == 0) {
+          mOwner->for_each_shard([&](std::size_t i) { mOwner->mShards[i]->update(model); });
+        } else {
+          mOwner->mShards[route(model)]->update(model);
+        }
+      }
+
+      bool remove(Model const &model) override {
+        if constexpr (Model::Keys::get_size() == 0) {
+          mOwner->for_each_shard([&](std::size_t i) { mOwner->mShards[i]->remove(model); });
+        } else {
+          mOwner->mShards[route(model)]->remove(model);
+        }
+
+        return true;
+      }
+
+      /*
+        The rowid of a Serial key is the key itself, so it is routed; other
+        tables have a rowid sequence per shard and the first match wins.
+      */
+      std::optional<Model> find_by_rowid(int64_t rowId) override {
+        if (auto serial = get_serial(); serial.has_value()) {
+          return mOwner->mShards[route_keys({Data{rowId}})]->template find_by_rowid<Model>(rowId);
+        }
+
+        std::vector<std::optional<Model> > items(mOwner->mShards.size());
+
+        mOwner->for_each_shard([&](std::size_t i) {
+          items[i] = mOwner->mShards[i]->template find_by_rowid<Model>(rowId);
+        });
+
+        for (auto &item: items) {
+          if (item.has_value()) {
+            return item;
+          }
+        }
+
+        return {};
+      }
+
+      /*
+        Goes to a single shard when every primary key is compared to a number;
+        the rows of all shards are otherwise merged in rowid order.
+      */
+      std::vector<Model> load_by(Conditions const &conditions) override {
+        auto target = route_conditions(conditions);
+        std::string sql = fmt::format("SELECT ROWID AS jdb_rowid, * FROM {}{} ORDER BY ROWID;",
+                                      Model::get_name(), get_where(conditions));
+        std::vector<std::vector<std::pair<int64_t, Model> > > parts(mOwner->mShards.size());
+
+        mOwner->for_each_shard([&](std::size_t i) {
+          if (target.has_value() and *target != i) {
+            return;
+          }
+
+          mOwner->mShards[i]->read_transaction([&](Database &db) {
+            db.query_string(sql, [&](std::vector<std::string> const &columns, std::vector<Data> const &values) {
+              Model row;
+
+              for (std::size_t j = 1; j < columns.size(); j++) {
+                row[columns[j]] = values[j];
+              }
+
+              row.clear_dirty();
+
+              parts[i].emplace_back(values[0].get_int().value_or(0), std::move(row));
+
+              return true;
+            });
+          });
+        });
+
+        std::vector<std::pair<int64_t, Model> > merged;
+
+        for (auto &part: parts) {
+          std::move(part.begin(), part.end(), std::back_inserter(merged));
+        }
+
+        std::stable_sort(merged.begin(), merged.end(), [](auto const &a, auto const &b) {
+          return a.first < b.first;
+        });
+
+        std::vector<Model> items;
+
+        items.reserve(merged.size());
+
+        for (auto &[rowId, row]: merged) {
+          items.push_back(std::move(row));
+        }
+
+        return items;
+      }
+
+      void insert_all(std::vector<Model> const &models) override {
+        write_all(models, false);
+      }
+
+      void upsert_all(std::vector<Model> const &models) override {
+        write_all(models, true);
+      }
+
+      std::size_t route(Model const &model) {
+        if constexpr (Model::Keys::get_size() == 0) {
+          throw std::runtime_error(fmt::format("'{}' has no primary key to route by", Model::get_name()));
+        } else {
+          std::vector<Data> keys;
+
+          Model::get_keys([&]<typename Field>() {
+            auto const &value = model[Field::get_name()];
+
+            if (value.is_invalid() or value.is_null()) {
+              throw std::runtime_error(fmt::format("unable to route '{}' to a shard, primary key '{}' is not set",
+                                                   Model::get_name(), Field::get_name()));
+            }
+
+            keys.push_back(normalize(Field::get_type(), value));
+          });
+
+          return route_keys(keys);
+        }
+      }
+
+    private:
+      ShardedDatabase *mOwner;
+      std::atomic<int64_t> mSequence{0};
+      std::atomic<std::size_t> mNext{0};
+      std::once_flag mSequenceFlag;
+
+      // FNV-1a over the key values, the same on every run; keys come normalized
+      // to their field type, so 5 and 5.0 land on the same shard
+      std::size_t route_keys(std::vector<Data> const &keys) const {
+        uint64_t hash = 14695981039346656037ULL;
+
+        auto feed = [&](std::string_view bytes) {
+          for (unsigned char c: bytes) {
+            hash = (hash ^ c) * 1099511628211ULL;
+          }
+        };
+
+        for (auto const &key: keys) {
+          key.get_value(overloaded{
+            [&](bool arg) { feed(fmt::format("i{}", arg ? 1 : 0)); },
+            [&](int64_t arg) { feed(fmt::format("i{}", arg)); },
+            [&](double arg) { feed(fmt::format("d{}", arg)); },
+            [&](std::pmr::string const &arg) {
+              feed("s");
+              feed(arg);
+            },
+            [&]([[maybe_unused]] auto const &arg) { }
+          });
+
+          feed(std::string_view{"\0", 1});
+        }
+
+        return static_cast<std::size_t>(hash % mOwner->mShards.size());
+      }
+
+      std::optional<std::size_t> route_conditions(Conditions const &conditions) const {
+        if constexpr (Model::Keys::get_size() == 0) {
+          return {};
+        } else {
+          std::vector<Data> keys;
+
+          Model::get_keys([&]<typename Field>() {
+            for (auto const &[name, value]: conditions) {
+              // text is matched with LIKE, so it does not name a single row
+              if (name == Field::get_name() and (value.get_int().has_value() or value.get_decimal().has_value())) {
+                keys.push_back(normalize(Field::get_type(), value));
+
+                return;
+              }
+            }
+          });
+
+          if (keys.size() != Model::Keys::get_size()) {
+            return {};
+          }
+
+          return route_keys(keys);
+        }
+      }
+
+      static std::optional<std::string> get_serial() {
+        std::optional<std::string> serial;
+
+        Model::get_fields([&]<typename Field>() {
+          if constexpr (Field::get_type() == FieldType::Serial) {
+            serial = Field::get_name();
+          }
+        });
+
+        return serial;
+      }
+
+      static bool has_keys(Model const &model) {
+        auto serial = get_serial();
+
+        return !serial.has_value() or model[*serial].get_int().has_value();
+      }
+
+      /*
+        Gives the row its Serial key, if unset, and returns its shard.
+      */
+      std::size_t assign(Model &row) {
+        if constexpr (Model::Keys::get_size() == 0) {
+          return mNext.fetch_add(1) % mOwner->mShards.size();
+        } else {
+          if (auto serial = get_serial(); serial.has_value()) {
+            std::call_once(mSequenceFlag, [&] {
+              std::vector<int64_t> maximum(mOwner->mShards.size());
+
+              mOwner->for_each_shard([&](std::size_t i) {
+                mOwner->mShards[i]->read_transaction([&](Database &db) {
+                  db.query_string(fmt::format("SELECT MAX({}) FROM {};", *serial, Model::get_name()),
+                                  [&](auto const &, std::vector<Data> const &values) {
+                                    maximum[i] = values[0].get_int().value_or(0);
+
+                                    return false;
+                                  });
+                });
+              });
+
+              mSequence.store(*std::max_element(maximum.begin(), maximum.end()));
+            });
+
+            if (auto id = std::as_const(row)[*serial].get_int(); id.has_value()) {
+              int64_t current = mSequence.load();
+
+              while (current < *id and !mSequence.compare_exchange_weak(current, *id)) {
+              }
+            } else {
+              row[*serial] = mSequence.fetch_add(1) + 1;
+            }
+          }
+
+          return route(row);
+        }
+      }
+
+      void write_all(std::vector<Model> const &models, bool upsert) {
+        if (mOwner->in_transaction()) {
+          upsert ? ModelStore<Model>::upsert_all(models) : ModelStore<Model>::insert_all(models);
+
+          return;
+        }
+
+        std::vector<std::vector<Model> > parts(mOwner->mShards.size());
+
+        for (auto const &model: models) {
+          if (!model.is_valid()) {
+            throw std::invalid_argument("invalid or restricted model");
+          }
+
+          Model row = model;
+
+          parts[assign(row)].push_back(std::move(row));
+        }
+
+        mOwner->for_each_shard([&](std::size_t i) {
+          if (parts[i].empty()) {
+            return;
+          }
+
+          if (upsert) {
+            mOwner->mShards[i]->upsert_all(parts[i]);
+          } else {
+            mOwner->mShards[i]->insert_all(parts[i]);
+          }
+        });
+      }
+
+      // same predicates as Repository::load_by
+      static std::string get_where(Conditions const &conditions) {
+        std::string where;
+
+        for (auto const &[name, value]: conditions) {
+          if (value.is_invalid()) {
+            continue;
+          }
+
+          where += where.empty() ? " WHERE " : " AND ";
+
+          value.get_value(overloaded{
+            [&]([[maybe_unused]] InvalidData arg) {
+            },
+            [&]([[maybe_unused]] std::nullptr_t arg) {
+              where += fmt::format("({} IS NULL)", name);
+            },
+            [&](bool arg) {
+              where += fmt::format("({} = {})", name, arg ? "true" : "false");
+            },
+            [&](int64_t arg) {
+              where += fmt::format("({} = {})", name, arg);
+            },
+            [&](double arg) {
+              where += fmt::format("({} = {})", name, arg);
+            },
+            [&](std::pmr::string const &arg) {
+              std::string text;
+
+              for (char c: arg) {
+                text += c == '\'' ? "''" : std::string(1, c);
+              }
+
+              where += fmt::format("({} LIKE '%{}%')", name, text);
+            }
+          });
+        }
+
+        return where;
+      }
+    };
+
+    std::vector<std::shared_ptr<Shard> > mShards;
+    std::tuple<Table<Tables>...> mTables;
+    std::unique_ptr<Scope> mScope;
+    std::recursive_mutex mTransactionMutex;
+    std::atomic<std::thread::id> mOwner{};
+    int mDepth{0};
+    std::atomic<int64_t> mLastRowId{0};
+
+    template<typename Model>
+    static void find_store(Table<Model> &table, std::type_info const &type, void *&store) {
+      if (typeid(Model) == type) {
+        store = static_cast<ModelStore<Model> *>(&table);
+      }
+    }
+
+    [[nodiscard]] bool in_transaction() const {
+      return mOwner.load() == std::this_thread::get_id();
+    }
+
+    void open(std::size_t index, std::function<void(Database &)> const &callback) {
+      if (index == mShards.size()) {
+        callback(*this);
+
+        return;
+      }
+
+      mShards[index]->write_transaction([&](Database &) {
+        open(index + 1, callback);
+      });
+    }
+
+    /*
+      Runs task(index) for every shard, each on a thread of its own unless
+      the calling thread holds the shards in a transaction. The first failure
+      is rethrown once every shard is done.
+    */
+    template<typename F>
+    void for_each_shard(F &&task) {
+      if (mShards.size() == 1 or in_transaction()) {
+        for (std::size_t i = 0; i < mShards.size(); i++) {
+          task(i);
+        }
+
+        return;
+      }
+
+      std::vector<std::future<void> > futures;
+      std::exception_ptr error;
+
+      for (std::size_t i = 0; i < mShards.size(); i++) {
+        futures.push_back(mScope->post([&task, i] { task(i); }));
+      }
+
+      for (auto &future: futures) {
+        try {
+          future.get();
+        } catch (...) {
+          if (!error) {
+            error = std::current_exception();
+          }
+        }
+      }
+
+      if (error) {
+        std::rethrow_exception(error);
+      }
+    }
+
+    static QueryCallback collect(Result &result) {
+      return [&result](std::vector<std::string> const &columns, std::vector<Data> const &values) {
+        if (result.columns.empty()) {
+          result.columns = columns;
+        }
+
+        result.rows.push_back(values);
+
+        return true;
+      };
+    }
+
+    /*
+      Rows of every shard, in shard order, without the last hidden columns.
+    */
+    static int64_t deliver_in_order(std::vector<Result> &results, std::size_t hidden, QueryCallback const &callback,
+                                    int64_t offset = 0, std::optional<int64_t> limit = {}) {
+      int64_t delivered = 0;
+
+      for (auto &result: results) {
+        std::vector<std::string> columns(result.columns.begin(), result.columns.end() - hidden);
+
+        for (auto &row: result.rows) {
+          if (offset > 0) {
+            offset--;
+
+            continue;
+          }
+
+          if (limit.has_value() and delivered >= *limit) {
+            return delivered;
+          }
+
+          row.resize(row.size() - hidden);
+          delivered++;
+
+          if (!callback(columns, row)) {
+            return delivered;
+          }
+        }
+      }
+
+      return delivered;
+    }
+
+    int64_t select(std::string const &sql, std::vector<Word> const &words, QueryCallback const &callback) {
+      std::string_view text = sql;
+
+      while (!text.empty() and (std::isspace(static_cast<unsigned char>(text.back())) or text.back() == ';')) {
+        text.remove_suffix(1);
+      }
+
+      auto unsupported = [&](std::string_view what) {
+        return std::runtime_error(fmt::format("{} can not be merged across shards: {}", what, sql));
+      };
+
+      // order is the BY of ORDER BY
+      Word const *from = nullptr, *order = nullptr, *limit = nullptr;
+      std::size_t tail = text.size();
+
+      for (std::size_t i = 0; i < words.size(); i++) {
+        auto const &word = words[i];
+
+        if (word.text == "UNION" or word.text == "INTERSECT" or word.text == "EXCEPT" or word.text == "WINDOW" or
+            word.text == "GROUP" or word.text == "HAVING" or (i == 1 and word.text == "DISTINCT")) {
+          throw unsupported(word.text);
+        }
+
+        if (word.text == "FROM" and from == nullptr) {
+          from = &word;
+        } else if (word.text == "ORDER" and i + 1 < words.size() and words[i + 1].text == "BY") {
+          order = &words[i + 1];
+          tail = std::min(tail, word.begin);
+        } else if (word.text == "LIMIT") {
+          limit = &word;
+          tail = std::min(tail, word.begin);
+        }
+      }
+
+      std::string_view list = text.substr(words[0].end, (from != nullptr ? from->begin : tail) - words[0].end);
+      std::string_view body = from != nullptr ? text.substr(from->begin, tail - from->begin) : std::string_view{};
+      std::string_view terms = order != nullptr
+                                 ? text.substr(order->end, (limit != nullptr ? limit->begin : text.size()) - order->end)
+                                 : std::string_view{};
+      int64_t offset = 0;
+      std::optional<int64_t> count;
+
+      if (limit != nullptr) {
+        std::tie(count, offset) = parse_limit(text.substr(limit->end), sql);
+      }
+
+      auto items = split(list);
+      std::vector<std::string> aggregates;
+
+      for (auto item: items) {
+        if (auto function = get_aggregate(item); function.has_value()) {
+          if (*function == "AVG" or *function == "GROUP_CONCAT" or *function == "DISTINCT") {
+            throw unsupported(*function);
+          }
+
+          aggregates.push_back(*function);
+        } else if (has_aggregate(item)) {
+          throw unsupported(fmt::format("'{}'", trim(item)));
+        }
+      }
+
+      // a select without tables reads nothing from the shards
+      std::size_t shards = from == nullptr ? 1 : mShards.size();
+
+      if (!aggregates.empty()) {
+        if (aggregates.size() != items.size()) {
+          throw unsupported("a select list mixing aggregates and columns");
+        }
+
+        std::vector<Result> results(shards);
+
+        run_read(shards, sql, results);
+
+        std::optional<Result> total;
+
+        for (auto &result: results) {
+          if (result.rows.empty()) {
+            continue;
+          }
+
+          if (!total.has_value()) {
+            total = std::move(result);
+
+            continue;
+          }
+
+          for (std::size_t i = 0; i < aggregates.size(); i++) {
+            total->rows[0][i] = combine(aggregates[i], total->rows[0][i], result.rows[0][i]);
+          }
+        }
+
+        if (!total.has_value()) {
+          return -1;
+        }
+
+        callback(total->columns, total->rows[0]);
+
+        return 0;
+      }
+
+      std::vector<Column> columns;
+      bool star = false;
+
+      for (auto item: items) {
+        columns.push_back(get_column(item, star));
+        star = star or columns.back().expression == "*" or columns.back().expression.ends_with(".*");
+      }
+
+      // a result column for positional terms, a hidden column appended to the select list otherwise
+      std::vector<SortKey> keys;
+      std::string hidden;
+      std::size_t hiddenCount = 0;
+
+      for (auto term: split(terms)) {
+        term = trim(term);
+
+        bool descending = false;
+        auto termWords = get_words(term, false);
+
+        if (!termWords.empty() and termWords.back().end == term.size() and
+            (termWords.back().text == "ASC" or termWords.back().text == "DESC")) {
+          descending = termWords.back().text == "DESC";
+          term = trim(term.substr(0, termWords.back().begin));
+        }
+
+        std::size_t position{};
+
+        if (auto [end, error] = std::from_chars(term.data(), term.data() + term.size(), position);
+          error == std::errc{} and end == term.data() + term.size() and position > 0) {
+          keys.push_back({position - 1, false, descending});
+
+          continue;
+        }
+
+        // an alias or a repeated expression sorts by that item of the select list
+        auto item = std::ranges::find_if(columns, [&](auto const &column) {
+          return column.expression == term or (!column.alias.empty() and same_name(column.alias, term));
+        });
+
+        if (item != columns.end()) {
+          term = item->expression;
+        }
+
+        if (std::ranges::any_of(get_words(term, false), [](auto const &word) { return word.text == "COLLATE"; })) {
+          throw unsupported("COLLATE in ORDER BY");
+        }
+
+        if (item != columns.end() and !item->afterStar) {
+          keys.push_back({static_cast<std::size_t>(item - columns.begin()), false, descending});
+        } else {
+          keys.push_back({hiddenCount, true, descending});
+          hidden += fmt::format(", {} AS jdb_order_{}", term, hiddenCount++);
+        }
+      }
+
+      std::string shardSql = fmt::format("SELECT{}{} {}", list, hidden, body);
+
+      if (!terms.empty()) {
+        shardSql += fmt::format(" ORDER BY {}", terms);
+      }
+
+      if (count.has_value()) {
+        shardSql += fmt::format(" LIMIT {}", *count + offset);
+      }
+
+      std::vector<Result> results(shards);
+
+      run_read(shards, shardSql + ";", results);
+
+      bool empty = std::ranges::all_of(results, [](auto const &result) { return result.rows.empty(); });
+
+      if (empty) {
+        return -1;
+      }
+
+      if (keys.empty()) {
+        deliver_in_order(results, hiddenCount, callback, offset, count);
+
+        return 0;
+      }
+
+      std::size_t width = 0;
+
+      for (auto const &result: results) {
+        width = std::max(width, result.columns.size());
+      }
+
+      for (auto &key: keys) {
+        if (key.hidden) {
+          key.column += width - hiddenCount;
+        }
+      }
+
+      merge(results, keys, hiddenCount, callback, offset, count);
+
+      return 0;
+    }
+
+    void run_read(std::size_t shards, std::string const &sql, std::vector<Result> &results) {
+      auto task = [&](std::size_t i) {
+        if (i >= shards) {
+          return;
+        }
+
+        mShards[i]->read_transaction([&](Database &db) {
+          db.query_string(sql, collect(results[i]));
+        });
+      };
+
+      if (shards == 1) {
+        task(0);
+      } else {
+        for_each_shard(task);
+      }
+    }
+
+    /*
+      k-way merge of the shard results, each already sorted by keys. Ties
+      keep the shard order.
+    */
+    static void merge(std::vector<Result> &results, std::vector<SortKey> const &keys,
+                      std::size_t hidden, QueryCallback const &callback, int64_t offset,
+                      std::optional<int64_t> limit) {
+      using Cursor = std::pair<std::size_t, std::size_t>;
+
+      auto after = [&](Cursor const &a, Cursor const &b) {
+        auto const &rowA = results[a.first].rows[a.second];
+        auto const &rowB = results[b.first].rows[b.second];
+
+        for (auto const &key: keys) {
+          if (DataLess{}(rowA[key.column], rowB[key.column])) {
+            return key.descending;
+          }
+
+          if (DataLess{}(rowB[key.column], rowA[key.column])) {
+            return !key.descending;
+          }
+        }
+
+        return a.first > b.first;
+      };
+
+      std::priority_queue<Cursor, std::vector<Cursor>, decltype(after)> heap{after};
+      std::vector<std::string> columns;
+
+      for (std::size_t i = 0; i < results.size(); i++) {
+        if (!results[i].rows.empty()) {
+          heap.emplace(i, 0);
+
+          if (columns.empty()) {
+            columns.assign(results[i].columns.begin(), results[i].columns.end() - hidden);
+          }
+        }
+      }
+
+      int64_t delivered = 0;
+
+      while (!heap.empty() and (!limit.has_value() or delivered < *limit)) {
+        auto [shard, index] = heap.top();
+
+        heap.pop();
+
+        if (index + 1 < results[shard].rows.size()) {
+          heap.emplace(shard, index + 1);
+        }
+
+        if (offset > 0) {
+          offset--;
+
+          continue;
+        }
+
+        auto &row = results[shard].rows[index];
+
+        row.resize(row.size() - hidden);
+        delivered++;
+
+        if (!callback(columns, row)) {
+          return;
+        }
+      }
+    }
+
+    static Data combine(std::string const &function, Data const &a, Data const &b) {
+      if (a.is_null() or a.is_invalid()) {
+        return b;
+      }
+
+      if (b.is_null() or b.is_invalid()) {
+        return a;
+      }
+
+      if (function == "MIN") {
+        return DataLess{}(b, a) ? b : a;
+      }
+
+      if (function == "MAX") {
+        return DataLess{}(a, b) ? b : a;
+      }
+
+      if (auto x = a.get_int(), y = b.get_int(); x.has_value() and y.has_value()) {
+        return *x + *y;
+      }
+
+      auto number = [](Data const &value) {
+        return value.get_decimal().value_or(static_cast<double>(value.get_int().value_or(0)));
+      };
+
+      return number(a) + number(b);
+    }
+
+    static std::pair<std::optional<int64_t>, int64_t> parse_limit(std::string_view text, std::string const &sql) {
+      auto number = [&](std::string_view value) {
+        int64_t result{};
+
+        value = trim(value);
+
+        if (auto [end, error] = std::from_chars(value.data(), value.data() + value.size(), result);
+          error != std::errc{} or end != value.data() + value.size() or result < 0) {
+          throw std::runtime_error(fmt::format("LIMIT must be a number to be merged across shards: {}", sql));
+        }
+
+        return result;
+      };
+
+      for (auto const &word: get_words(text, false)) {
+        if (word.text == "OFFSET") {
+          return {number(text.substr(0, word.begin)), number(text.substr(word.end))};
+        }
+      }
+
+      if (auto parts = split(text); parts.size() == 2) {
+        return {number(parts[1]), number(parts[0])};
+      }
+
+      return {number(text), 0};
+    }
+
+    /*
+      Name of the aggregate when the whole item is one call (with an optional
+      alias): "COUNT (*)", "max(hits) AS top". min() and max() with more than
+      one argument are scalar functions.
+    */
+    static std::optional<std::string> get_aggregate(std::string_view item) {
+      static constexpr std::string_view Names[] = {"COUNT", "SUM", "TOTAL", "MIN", "MAX", "AVG", "GROUP_CONCAT"};
+
+      item = trim(item);
+
+      auto words = get_words(item, true);
+
+      if (words.empty() or words[0].begin != 0 or std::ranges::find(Names, words[0].text) == std::end(Names)) {
+        return {};
+      }
+
+      std::size_t open = item.find_first_not_of(" \t\r\n", words[0].end);
+
+      if (open == std::string_view::npos or item[open] != '(') {
+        return {};
+      }
+
+      std::size_t close = find_close(item, open);
+
+      if (close == std::string_view::npos or
+          item.substr(close + 1).find_first_of("+-*/|<>=%&!(~") != std::string_view::npos) {
+        return {};
+      }
+
+      std::string_view arguments = item.substr(open + 1, close - open - 1);
+
+      if (split(arguments).size() > 1) {
+        return {};
+      }
+
+      if (auto inner = get_words(arguments, false); !inner.empty() and inner[0].text == "DISTINCT") {
+        return "DISTINCT";
+      }
+
+      return words[0].text;
+    }
+
+    /*
+      Expression and AS alias of a select list item.
+    */
+    static Column get_column(std::string_view item, bool afterStar) {
+      item = trim(item);
+
+      auto words = get_words(item, false);
+
+      for (std::size_t i = words.size(); i-- > 0;) {
+        if (words[i].text != "AS") {
+          continue;
+        }
+
+        std::string_view alias = trim(item.substr(words[i].end));
+
+        if (words.size() - i <= 2 and !alias.empty() and alias.find_first_of(" \t\r\n") == std::string_view::npos) {
+          return {trim(item.substr(0, words[i].begin)), alias, afterStar};
+        }
+
+        break;
+      }
+
+      return {item, {}, afterStar};
+    }
+
+    /*
+      Identifiers compared as SQLite does, without quotes and case.
+    */
+    static bool same_name(std::string_view a, std::string_view b) {
+      auto unquote = [](std::string_view name) {
+        if (name.size() >= 2 and ((name.front() == '"' and name.back() == '"') or
+                                  (name.front() == '`' and name.back() == '`') or
+                                  (name.front() == '[' and name.back() == ']'))) {
+          name = name.substr(1, name.size() - 2);
+        }
+
+        return name;
+      };
+
+      a = unquote(a);
+      b = unquote(b);
+
+      return std::ranges::equal(a, b, [](unsigned char x, unsigned char y) {
+        return std::toupper(x) == std::toupper(y);
+      });
+    }
+
+    static bool has_aggregate(std::string_view item) {
+      for (auto const &word: get_words(item, true)) {
+        std::size_t next = item.find_first_not_of(" \t\r\n", word.end);
+
+        if (next != std::string_view::npos and item[next] == '(' and
+            (word.text == "COUNT" or word.text == "SUM" or word.text == "TOTAL" or word.text == "AVG" or
+             word.text == "GROUP_CONCAT" or word.text == "MIN" or word.text == "MAX")) {
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    static std::string_view trim(std::string_view text) {
+      while (!text.empty() and std::isspace(static_cast<unsigned char>(text.front()))) {
+        text.remove_prefix(1);
+      }
+
+      while (!text.empty() and std::isspace(static_cast<unsigned char>(text.back()))) {
+        text.remove_suffix(1);
+      }
+
+      return text;
+    }
+
+    /*
+      End of the literal, quoted identifier or comment starting at i, or i
+      when there is none.
+    */
+    static std::size_t skip(std::string_view sql, std::size_t i) {
+      char c = sql[i];
+
+      if (c == '\'' or c == '"' or c == '`') {
+        for (std::size_t j = i + 1; j < sql.size(); j++) {
+          if (sql[j] == c) {
+            if (j + 1 < sql.size() and sql[j + 1] == c) {
+              j++;
+
+              continue;
+            }
+
+            return j + 1;
+          }
+        }
+
+        return sql.size();
+      }
+
+      if (c == '[') {
+        auto end = sql.find(']', i);
+
+        return end == std::string_view::npos ? sql.size() : end + 1;
+      }
+
+      if (sql.substr(i, 2) == "--") {
+        auto end = sql.find('\n', i);
+
+        return end == std::string_view::npos ? sql.size() : end + 1;
+      }
+
+      if (sql.substr(i, 2) == "/*") {
+        auto end = sql.find("*/", i + 2);
+
+        return end == std::string_view::npos ? sql.size() : end + 2;
+      }
+
+      return i;
+    }
+
+    /*
+      Keywords and identifiers outside of literals, at the top level or at
+      any depth of parentheses.
+    */
+    static std::vector<Word> get_words(std::string_view sql, bool nested) {
+      std::vector<Word> words;
+      int depth = 0;
+
+      for (std::size_t i = 0; i < sql.size();) {
+        if (std::size_t next = skip(sql, i); next != i) {
+          i = next;
+
+          continue;
+        }
+
+        char c = sql[i];
+
+        if (c == '(') {
+          depth++;
+        } else if (c == ')') {
+          depth--;
+        } else if (std::isalpha(static_cast<unsigned char>(c)) or c == '_') {
+          std::size_t begin = i;
+
+          while (i < sql.size() and (std::isalnum(static_cast<unsigned char>(sql[i])) or sql[i] == '_' or
+                                     sql[i] == '$')) {
+            i++;
+          }
+
+          if (depth == 0 or nested) {
+            std::string text{sql.substr(begin, i - begin)};
+
+            std::ranges::transform(text, text.begin(), [](unsigned char c) { return std::toupper(c); });
+
+            words.push_back({begin, i, std::move(text)});
+          }
+
+          continue;
+        } else if (std::isdigit(static_cast<unsigned char>(c))) {
+          while (i < sql.size() and (std::isalnum(static_cast<unsigned char>(sql[i])) or sql[i] == '.')) {
+            i++;
+          }
+
+          continue;
+        }
+
+        i++;
+      }
+
+      return words;
+    }
+
+    static std::vector<std::string_view> split(std::string_view text) {
+      std::vector<std::string_view> parts;
+      std::size_t start = 0;
+      int depth = 0;
+
+      if (trim(text).empty()) {
+        return parts;
+      }
+
+      for (std::size_t i = 0; i < text.size();) {
+        if (std::size_t next = skip(text, i); next != i) {
+          i = next;
+
+          continue;
+        }
+
+        if (text[i] == '(') {
+          depth++;
+        } else if (text[i] == ')') {
+          depth--;
+        } else if (text[i] == ',' and depth == 0) {
+          parts.push_back(text.substr(start, i - start));
+          start = i + 1;
+        }
+
+        i++;
+      }
+
+      parts.push_back(text.substr(start));
+
+      return parts;
+    }
+
+    static std::size_t find_close(std::string_view text, std::size_t open) {
+      int depth = 0;
+
+      for (std::size_t i = open; i < text.size();) {
+        if (std::size_t next = skip(text, i); next != i) {
+          i = next;
+
+          continue;
+        }
+
+        if (text[i] == '(') {
+          depth++;
+        } else if (text[i] == ')' and --depth == 0) {
+          return i;
+        }
+
+        i++;
+      }
+
+      return std::string_view::npos;
+    }
+  };
+}
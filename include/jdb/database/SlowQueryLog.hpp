@@ -0,0 +1,135 @@
+#pragma once
+
+#include "jdb/database/StatementMetrics.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace jdb {
+  struct SlowQuery {
+    std::string sql;
+    std::string shape;
+    std::chrono::nanoseconds duration{};
+    int64_t fullScanSteps{};
+    int64_t sorts{};
+    int64_t autoIndexes{};
+    std::vector<std::string> plan;
+    // occurrences of the same shape dropped since its previous report
+    uint64_t suppressed{};
+  };
+
+  inline std::string to_string(SlowQuery const &query) {
+    std::string out = fmt::format(
+      "slow query ({:.3f} ms, fullscan steps: {}, sorts: {}, auto indexes: {}, suppressed: {}): {}",
+      static_cast<double>(query.duration.count()) / 1e6, query.fullScanSteps, query.sorts,
+      query.autoIndexes, query.suppressed, query.sql);
+
+    for (auto const &line: query.plan) {
+      out += "\n  " + line;
+    }
+
+    return out;
+  }
+
+  /*
+    Statements slower than threshold are reported to sink, at most once per
+    interval for each statement shape and no more than maxReports per interval
+    overall. At most maxShapes shapes are tracked; past it, shapes not reported
+    within the last interval are forgotten along with their suppressed counts.
+  */
+  struct SlowQueryPolicy {
+    std::chrono::nanoseconds threshold{std::chrono::milliseconds{100}};
+    std::chrono::nanoseconds interval{std::chrono::seconds{60}};
+    std::size_t maxReports{20};
+    std::size_t maxShapes{1024};
+    std::function<void(SlowQuery const &)> sink = [](SlowQuery const &query) {
+      std::clog << to_string(query) << std::endl;
+    };
+  };
+
+  struct SlowQueryLog {
+    explicit SlowQueryLog(SlowQueryPolicy policy) : mPolicy{std::move(policy)} {
+    }
+
+    [[nodiscard]] SlowQueryPolicy const &get_policy() const {
+      return mPolicy;
+    }
+
+    /*
+      Decides whether a slow occurrence of shape is reported, filling the count
+      of occurrences suppressed before it.
+    */
+    bool admit(std::string const &shape, uint64_t &suppressed) {
+      std::lock_guard<std::mutex> lk(mMutex);
+
+      auto now = std::chrono::steady_clock::now();
+
+      if (now - mWindowStart >= mPolicy.interval) {
+        mWindowStart = now;
+        mReports = 0;
+
+        // nothing left to say about them
+        std::erase_if(mShapes, [&](auto const &item) {
+          return item.second.suppressed == 0 and now - item.second.lastReport >= mPolicy.interval;
+        });
+      }
+
+      if (mShapes.size() >= mPolicy.maxShapes and !mShapes.contains(shape)) {
+        // only shapes reported in this interval stay, so no more than maxReports
+        std::erase_if(mShapes, [&](auto const &item) {
+          return now - item.second.lastReport >= mPolicy.interval;
+        });
+      }
+
+      auto [it, inserted] = mShapes.try_emplace(shape);
+      auto &state = it->second;
+
+      if ((!inserted and now - state.lastReport < mPolicy.interval) or mReports >= mPolicy.maxReports) {
+        state.suppressed++;
+
+        return false;
+      }
+
+      suppressed = std::exchange(state.suppressed, 0);
+      state.lastReport = now;
+      mReports++;
+
+      return true;
+    }
+
+    /*
+      Shapes currently tracked.
+    */
+    [[nodiscard]] std::size_t size() const {
+      std::lock_guard<std::mutex> lk(mMutex);
+
+      return mShapes.size();
+    }
+
+    void report(SlowQuery const &query) const {
+      if (mPolicy.sink) {
+        mPolicy.sink(query);
+      }
+    }
+
+  private:
+    struct ShapeState {
+      std::chrono::steady_clock::time_point lastReport;
+      uint64_t suppressed{};
+    };
+
+    SlowQueryPolicy mPolicy;
+    std::unordered_map<std::string, ShapeState> mShapes;
+    std::chrono::steady_clock::time_point mWindowStart;
+    std::size_t mReports{};
+    mutable std::mutex mMutex;
+  };
+}
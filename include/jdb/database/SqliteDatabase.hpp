@@ -1,16 +1,31 @@
 #pragma once
 
+#include "jdb/database/Backup.hpp"
+#include "jdb/database/ChangeFeed.hpp"
 #include "jdb/database/Database.hpp"
 #include "jdb/database/Migration.hpp"
+#include "jdb/database/ScanDetector.hpp"
+#include "jdb/database/SlowQueryLog.hpp"
+#include "jdb/database/StatementMetrics.hpp"
+#include "jdb/utils/Scope.hpp"
 
 #include <algorithm>
+#include <chrono>
+#include <filesystem>
 #include <functional>
+#include <random>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <atomic>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
 
 #include <SQLiteCpp/SQLiteCpp.h>
+#include <sqlite3.h>
 
 #include <fmt/format.h>
 
@@ -19,108 +34,337 @@ namespace jdb {
     Field<"id", FieldType::Int, false>,
     Field<"version", FieldType::Int> >;
 
+  /*
+    SQLITE_BUSY or SQLITE_LOCKED raised by a statement.
+  */
+  struct BusyError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+  };
+
+  /*
+    busyTimeout is how long sqlite itself waits on a lock before giving up;
+    after that a top level write transaction is rolled back and restarted up to
+    maxRetries times, sleeping a jittered, exponentially growing backoff.
+  */
+  struct BusyPolicy {
+    std::chrono::milliseconds busyTimeout{1000};
+    std::size_t maxRetries{5};
+    std::chrono::milliseconds initialBackoff{10};
+    std::chrono::milliseconds maxBackoff{500};
+  };
+
+  struct BusyStats {
+    uint64_t retries{};
+    uint64_t timeouts{};
+  };
+
   template<typename... Tables>
   struct SqliteDatabase : public Database {
     inline static std::string const Tag = "SqliteDatabase";
 
-    explicit SqliteDatabase(std::string const &dbName)
-      : mDb(dbName, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE) {
-      // Initialize MigracaoModel locally
-      query_string(this->create_ddl(MigracaoModel{}),
-                   [](auto...) { return false; });
+    /*
+      The schema fingerprint is kept in the database header (user_version), so
+      opening an up to date database costs a single read and no DDL.
+    */
+    explicit SqliteDatabase(std::string const &dbName, BusyPolicy busyPolicy = {})
+      : mBusyPolicy{busyPolicy}, mDb(dbName, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE) {
+      mDb.setBusyTimeout(static_cast<int>(mBusyPolicy.busyTimeout.count()));
+      mChangeFeed.attach(mDb.getHandle());
 
-      for_each<Tables...>([&]<typename Table>() {
-        try {
-          typename Table::Keys{};
-          typename Table::Refers{};
+      int64_t fingerprint = get_schema_fingerprint();
+      int64_t version = 0;
 
-          query_string(this->create_ddl(Table{}),
-                       [](auto...) { return false; });
-        } catch (std::runtime_error &e) {
-          throw std::runtime_error(
-            fmt::format("On '{}' -> {}", Table::get_name(), e.what()));
-        }
+      query_string("PRAGMA user_version;", [&](auto const &columns, auto const &values) {
+        version = values[0].get_int().value_or(0);
+
+        return false;
       });
+
+      if (!is_memory()) {
+        // readers keep their snapshot without blocking the writer
+        query_string("PRAGMA journal_mode = WAL;", [](auto...) { return false; });
+      }
+
+      if (version != fingerprint) {
+        SQLite::Transaction transaction(mDb, SQLite::TransactionBehavior::IMMEDIATE);
+
+        for (auto const &ddl: get_schema_ddl()) {
+          query_string(ddl, [](auto...) { return false; });
+        }
+
+        query_string(fmt::format("PRAGMA user_version = {};", fingerprint), [](auto...) { return false; });
+
+        transaction.commit();
+      }
+
+      pin_tables();
     }
 
-    virtual ~SqliteDatabase() = default;
+    virtual ~SqliteDatabase() {
+      std::vector<std::shared_ptr<BackupJob>> jobs;
+
+      {
+        std::lock_guard<std::mutex> lk(mBackupMutex);
 
+        jobs = std::move(mBackups);
+      }
+
+      for (auto &job: jobs) {
+        job->cancel();
+      }
+
+      mBackupScope.reset();
+
+      // jobs still queued when the scope stopped never ran
+      for (auto &job: jobs) {
+        if (!job->is_finished()) {
+          job->finish(std::make_exception_ptr(std::runtime_error("backup cancelled")));
+        }
+      }
+    }
+
+    /*
+      Plain transactions are write transactions.
+    */
     void transaction(std::function<void(Database &)> callback) override {
-      std::lock_guard<std::recursive_mutex> lk(mTransactionMutex);
+      write_transaction(std::move(callback));
+    }
 
-      if (mTransactionLock.exchange(true, std::memory_order_acquire)) {
-        mTransactionCallbacks.push_back(std::move(callback));
+    /*
+      Starts with BEGIN IMMEDIATE, so the write lock is taken upfront instead of
+      being upgraded (and possibly failing with SQLITE_BUSY) in the middle of the
+      unit of work. Nested calls run in place inside a SAVEPOINT: if the inner
+      callback throws, only its own work is rolled back and the exception is
+      propagated, so the outer unit may catch it and go on (or retry).
+    */
+    void write_transaction(std::function<void(Database &)> callback) override {
+      {
+        std::lock_guard<std::recursive_mutex> lk(mTransactionMutex);
+
+        if (mTransactionDepth > 0) {
+          savepoint(callback);
+
+          return;
+        }
+
+        run_write_transaction(callback);
+      }
+
+      // observers run once the writer is released, so they may use the database
+      mChangeFeed.publish();
+    }
+
+    /*
+      Runs the callback in a deferred transaction over a pooled read-only
+      connection: it sees a consistent snapshot and runs concurrently with the
+      writer and other readers. In memory databases have no separate readers,
+      and reads issued by the writer thread must see its own uncommitted work,
+      so both run on the writer connection.
+
+      Tables marked MemoryPinned are served, on those read-only connections,
+      from a TEMP copy kept in memory (temp_store = MEMORY): sqlite resolves
+      unqualified names in temp before main, so the callback's SQL is the same
+      and its reads of those tables neither hit the file nor take part in the
+      WAL locking. Writes keep going to the file, in their own transaction,
+      where triggers bump the table's row in jdb_pinned_version. Once the
+      snapshot starts, a connection reloads, from that same snapshot, the
+      copies whose version moved since they were loaded: pinned and file
+      tables are always read as of the same commit.
+    */
+    void read_transaction(std::function<void(Database &)> callback) override {
+      if (mWriterThread.load(std::memory_order_acquire) == std::this_thread::get_id()) {
+        callback(*this);
 
         return;
       }
 
-      SQLite::Transaction transaction(mDb);
+      if (is_memory()) {
+        std::lock_guard<std::recursive_mutex> lk(mTransactionMutex);
+        Reader reader{*this, mDb};
+        SQLite::Transaction transaction(mDb, SQLite::TransactionBehavior::DEFERRED);
 
-      callback(*this);
+        callback(reader);
 
-      std::ranges::for_each(
-        mTransactionCallbacks,
-        [this](auto const &item) {
-          item(*this);
-        });
+        transaction.commit();
 
-      transaction.commit();
+        return;
+      }
+
+      std::unique_ptr<ReaderConnection> connection = acquire_reader();
+
+      try {
+        Reader reader{*this, *connection};
+        SQLite::Transaction transaction(*connection, SQLite::TransactionBehavior::DEFERRED);
+
+        // the snapshot starts with the first read
+        reader.query_string("SELECT 1 FROM sqlite_master LIMIT 1;", [](auto...) { return false; });
 
-      mTransactionCallbacks.clear();
+        if (!get_pinned_tables().empty()) {
+          refresh_pinned(*connection);
+        }
+
+        callback(reader);
+
+        transaction.commit();
+      } catch (...) {
+        release_reader(std::move(connection));
 
-      mTransactionLock.store(false, std::memory_order_release);
+        throw;
+      }
+
+      release_reader(std::move(connection));
     }
 
     int64_t query_string(std::string const &sql, QueryCallback const &callback) override {
-      try {
-        SQLite::Statement query(mDb, sql);
+      return run_query(sql, callback, std::pmr::get_default_resource());
+    }
+
+    /*
+      Text columns are read straight into resource, with no intermediate copy.
+    */
+    int64_t query_rows(std::string const &sql, std::pmr::memory_resource *resource,
+                       RowCallback const &callback) override {
+      return run_query(sql, callback, resource);
+    }
 
-        std::vector<std::string> columns;
-        std::vector<Data> values;
+    /*
+      Rows committed through this connection, see ChangeFeed. Each write
+      transaction is delivered as one ChangeSet once it commits; other
+      statements are delivered as they complete.
+    */
+    ChangeFeed &get_change_feed() {
+      return mChangeFeed;
+    }
 
-        if (!query.executeStep()) {
-          return -1L;
+    int64_t get_last_rowid() override { return mDb.getLastInsertRowid(); }
+
+    /*
+      Rows changed by every statement since the database was opened.
+    */
+    int64_t get_total_changes() { return mDb.getTotalChanges(); }
+
+    /*
+      Online copy of the database into path, made by sqlite3_backup on a
+      background thread pagesPerStep pages at a time. Each step runs between
+      write transactions and holds the writer only for its own pages; the
+      thread sleeps between steps so foreground work keeps its latency. Writes
+      made through this database are mirrored into the copy as it goes, while
+      writes from other connections make sqlite restart the copy from the first
+      page (counted in BackupProgress::restarts). The copy is written next to
+      path and renamed over it only once complete, so a failed or cancelled
+      backup never leaves a partial file behind. Backups run one at a time, in
+      the order they were requested.
+    */
+    std::shared_ptr<BackupJob> backup_to(std::string const &path, int pagesPerStep = 64,
+                                         std::chrono::milliseconds sleep = std::chrono::milliseconds{10},
+                                         BackupCallback callback = {}) {
+      if (pagesPerStep <= 0) {
+        throw std::runtime_error(fmt::format("Invalid backup step of {} pages", pagesPerStep));
+      }
+
+      auto job = std::make_shared<BackupJob>();
+
+      {
+        std::lock_guard<std::mutex> lk(mBackupMutex);
+
+        if (!mBackupScope) {
+          mBackupScope = std::make_unique<Scope>(1);
         }
 
-        columns.clear();
+        std::erase_if(mBackups, [](auto const &item) { return item->is_finished(); });
 
-        for (int i = 0; i < query.getColumnCount(); i++) {
-          columns.emplace_back(query.getColumn(i).getName());
-        }
-
-        do {
-          for (int i = 0; i < query.getColumnCount(); i++) {
-            SQLite::Column col = query.getColumn(i);
-
-            if (col.isInteger()) {
-              values.emplace_back(col.getInt64());
-            } else if (col.isFloat()) {
-              values.emplace_back(col.getDouble());
-            } else if (col.isText()) {
-              values.emplace_back(col.getString());
-            } else if (col.isBlob()) {
-              throw std::runtime_error("Type not implemented");
-            } else {
-              values.emplace_back(nullptr);
-            }
-          }
+        mBackups.push_back(job);
 
-          if (!callback(columns, values)) {
-            break;
+        mBackupScope->post_ordered([this, job, path, pagesPerStep, sleep, callback]() {
+          try {
+            run_backup(*job, path, pagesPerStep, sleep, callback);
+
+            job->finish();
+          } catch (...) {
+            job->finish(std::current_exception());
           }
+        });
+      }
 
-          values.clear();
-        } while (query.executeStep());
+      return job;
+    }
 
-        query.reset();
+    SqliteDatabase &set_busy_policy(BusyPolicy busyPolicy) {
+      std::lock_guard<std::recursive_mutex> lk(mTransactionMutex);
 
-        return query.getChanges();
-      } catch (std::exception &e) {
-        throw std::runtime_error(fmt::format("{}: {}", e.what(), sql));
-      }
+      mBusyPolicy = busyPolicy;
+
+      mDb.setBusyTimeout(static_cast<int>(mBusyPolicy.busyTimeout.count()));
+
+      return *this;
     }
 
-    int64_t get_last_rowid() override { return mDb.getLastInsertRowid(); }
+    /*
+      Statement metrics are recorded by default; they cost a clock read and a
+      thread local lookup per statement.
+    */
+    SqliteDatabase &set_metrics_enabled(bool enabled) {
+      mMetricsEnabled.store(enabled, std::memory_order_relaxed);
+
+      return *this;
+    }
+
+    [[nodiscard]] StatementMetrics const &get_metrics() const {
+      return mMetrics;
+    }
+
+    /*
+      Statements slower than the policy threshold are reported with their
+      sqlite scan/sort counters and EXPLAIN QUERY PLAN output.
+    */
+    SqliteDatabase &set_slow_query_log(SlowQueryPolicy policy) {
+      auto threshold = policy.threshold.count();
+
+      mSlowQueryLog.store(std::make_shared<SlowQueryLog>(std::move(policy)));
+      mSlowQueryThreshold.store(std::max<int64_t>(threshold, 1), std::memory_order_relaxed);
+
+      return *this;
+    }
+
+    SqliteDatabase &disable_slow_query_log() {
+      mSlowQueryThreshold.store(0, std::memory_order_relaxed);
+      mSlowQueryLog.store(nullptr);
+
+      return *this;
+    }
+
+    /*
+      Test helper: checks the plan of every filtering statement before running
+      it and rejects (or reports) full scans and automatic indexes over large
+      tables, see ScanDetector.
+    */
+    SqliteDatabase &set_scan_detector(ScanPolicy policy) {
+      mScanDetector.store(std::make_shared<ScanDetector>(std::move(policy)));
+      mScanDetectorEnabled.store(true, std::memory_order_relaxed);
+
+      return *this;
+    }
+
+    SqliteDatabase &disable_scan_detector() {
+      mScanDetectorEnabled.store(false, std::memory_order_relaxed);
+      mScanDetector.store(nullptr);
+
+      return *this;
+    }
+
+    /*
+      Copies of pinned tables loaded by read connections so far.
+    */
+    [[nodiscard]] uint64_t get_pinned_loads() const {
+      return mPinnedLoads.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] BusyStats get_busy_stats() const {
+      return {
+        mBusyRetries.load(std::memory_order_relaxed),
+        mBusyTimeouts.load(std::memory_order_relaxed)
+      };
+    }
 
     SqliteDatabase &add_migration(Migration migration) override {
       if (std::find_if(mMigrations.begin(), mMigrations.end(),
@@ -137,59 +381,724 @@ namespace jdb {
 
     void build() {
       MigracaoModel migracaoModel;
+      bool hasVersion = false;
 
       migracaoModel["id"] = 1;
       migracaoModel["version"] = 0;
 
-      query_string(
-        std::format("CREATE TABLE IF NOT EXISTS {} (version INTEGER NOT NULL);", migracaoModel.get_name()),
-        [&](auto...) { return false; });
-
-      query_string(fmt::format("SELECT * FROM {};", MigracaoModel::get_name()),
+      query_string(fmt::format("SELECT version FROM {} WHERE id = 1;", MigracaoModel::get_name()),
                    [&](std::vector<std::string> const &columns,
                        std::vector<Data> const &values) {
-                     for (int i = 0; i < static_cast<int>(columns.size()); i++) {
-                       if (columns[i] == "version") {
-                         migracaoModel["version"] = values[0].get_int().value();
-                       }
-                     }
+                     migracaoModel["version"] = values[0].get_int().value_or(0);
+
+                     hasVersion = true;
 
                      return false;
                    });
 
-      if (migracaoModel["version"].get_int().value() == 0) {
-        insert(migracaoModel);
-      }
-
       std::sort(
         mMigrations.begin(), mMigrations.end(),
         [](auto const &a, auto const &b) { return a.get_id() < b.get_id(); });
 
-      for (auto const &migration: mMigrations) {
-        if (migration.get_id() <= migracaoModel["version"].get_int().value()) {
-          continue;
+      int64_t version = migracaoModel["version"].get_int().value();
+
+      if (hasVersion and std::ranges::none_of(mMigrations, [&](auto const &item) {
+        return item.get_id() > version;
+      })) {
+        return;
+      }
+
+      transaction([&](Database &db) {
+        if (!hasVersion) {
+          insert(migracaoModel);
         }
 
-        try {
-          migracaoModel["version"] = migration.get_id();
+        for (auto const &migration: mMigrations) {
+          if (migration.get_id() <= version) {
+            continue;
+          }
 
-          migration.execute(*this);
+          try {
+            migracaoModel["version"] = migration.get_id();
 
-          update(migracaoModel);
-        } catch (std::exception &e) {
-          throw std::runtime_error(fmt::format(
-            "Unable to proceed with migration [{} v{}]: {}",
-            MigracaoModel::get_name(), migration.get_id(), e.what()));
+            migration.execute(*this);
+
+            update(migracaoModel);
+          } catch (std::exception &e) {
+            throw std::runtime_error(fmt::format(
+              "Unable to proceed with migration [{} v{}]: {}",
+              MigracaoModel::get_name(), migration.get_id(), e.what()));
+          }
         }
-      }
+      });
+
+      // migrations may have dropped and recreated pinned tables, with their triggers
+      pin_tables();
     }
 
   private:
+    struct Reader : public Database {
+      Reader(SqliteDatabase &owner, SQLite::Database &connection)
+        : mOwner{owner}, mConnection{connection} {
+      }
+
+      int64_t query_string(std::string const &sql, QueryCallback const &callback) override {
+        return mOwner.execute(mConnection, sql, callback);
+      }
+
+      int64_t query_rows(std::string const &sql, std::pmr::memory_resource *resource,
+                         RowCallback const &callback) override {
+        return mOwner.execute(mConnection, sql, callback, resource);
+      }
+
+      void transaction(std::function<void(Database &)> callback) override {
+        callback(*this);
+      }
+
+      void read_transaction(std::function<void(Database &)> callback) override {
+        callback(*this);
+      }
+
+      void write_transaction(std::function<void(Database &)> callback) override {
+        throw std::runtime_error("write transaction requested inside a read transaction");
+      }
+
+      int64_t get_last_rowid() override { return mConnection.getLastInsertRowid(); }
+
+      Database &add_migration(Migration migration) override {
+        throw std::runtime_error("migrations are not available inside a read transaction");
+      }
+
+    private:
+      SqliteDatabase &mOwner;
+      SQLite::Database &mConnection;
+    };
+
     std::vector<Migration> mMigrations;
-    std::vector<std::function<void(Database &)>> mTransactionCallbacks;
+    BusyPolicy mBusyPolicy;
+    std::atomic<uint64_t> mBusyRetries{0};
+    std::atomic<uint64_t> mBusyTimeouts{0};
+    StatementMetrics mMetrics;
+    std::atomic<bool> mMetricsEnabled{true};
+    std::atomic<std::shared_ptr<SlowQueryLog>> mSlowQueryLog;
+    std::atomic<int64_t> mSlowQueryThreshold{0};
+    std::atomic<std::shared_ptr<ScanDetector>> mScanDetector;
+    std::atomic<bool> mScanDetectorEnabled{false};
     std::recursive_mutex mTransactionMutex;
-    std::atomic<bool> mTransactionLock{false};
+    int mTransactionDepth{0};
+    std::atomic<std::thread::id> mWriterThread;
+    struct ReaderConnection : public SQLite::Database {
+      using SQLite::Database::Database;
+
+      // data_version and schema_version of the snapshot last refreshed from
+      std::optional<int64_t> dataVersion;
+      std::optional<int64_t> schemaVersion;
+      bool hasVersions{false};
+      // jdb_pinned_version of each copy held in its temp schema
+      std::unordered_map<std::string, int64_t> versions;
+    };
+
+    std::vector<std::unique_ptr<ReaderConnection>> mReaders;
+    std::mutex mReadersMutex;
+    std::atomic<uint64_t> mPinnedLoads{0};
+    // declared before mDb: its hooks stay registered until the connection closes
+    ChangeFeed mChangeFeed;
     SQLite::Database mDb;
+    // declared after mDb: running backups step over it until the scope stops
+    std::unique_ptr<Scope> mBackupScope;
+    std::vector<std::shared_ptr<BackupJob>> mBackups;
+    std::mutex mBackupMutex;
+
+    void run_write_transaction(std::function<void(Database &)> const &callback) {
+      for (std::size_t attempt = 0;; attempt++) {
+        mWriterThread.store(std::this_thread::get_id(), std::memory_order_release);
+        mTransactionDepth = 1;
+
+        try {
+          SQLite::Transaction transaction(mDb, SQLite::TransactionBehavior::IMMEDIATE);
+
+          callback(*this);
+
+          transaction.commit();
+
+          mChangeFeed.settle();
+        } catch (std::exception &e) {
+          mTransactionDepth = 0;
+          mWriterThread.store({}, std::memory_order_release);
+
+          if (!is_busy(e)) {
+            throw;
+          }
+
+          if (attempt >= mBusyPolicy.maxRetries) {
+            mBusyTimeouts.fetch_add(1, std::memory_order_relaxed);
+
+            throw;
+          }
+
+          mBusyRetries.fetch_add(1, std::memory_order_relaxed);
+
+          std::this_thread::sleep_for(get_backoff(attempt));
+
+          continue;
+        } catch (...) {
+          mTransactionDepth = 0;
+          mWriterThread.store({}, std::memory_order_release);
+
+          throw;
+        }
+
+        mTransactionDepth = 0;
+        mWriterThread.store({}, std::memory_order_release);
+
+        return;
+      }
+    }
+
+    void savepoint(std::function<void(Database &)> const &callback) {
+      std::string name = fmt::format("jdb_savepoint_{}", mTransactionDepth++);
+      std::size_t mark = mChangeFeed.mark();
+
+      mDb.exec(fmt::format("SAVEPOINT {};", name));
+
+      try {
+        callback(*this);
+      } catch (...) {
+        mTransactionDepth--;
+
+        mDb.exec(fmt::format("ROLLBACK TO {};", name));
+        mDb.exec(fmt::format("RELEASE {};", name));
+
+        // no rollback hook fires for a savepoint
+        mChangeFeed.rollback_to(mark);
+
+        throw;
+      }
+
+      mTransactionDepth--;
+
+      mDb.exec(fmt::format("RELEASE {};", name));
+    }
+
+    void run_backup(BackupJob &job, std::string const &path, int pagesPerStep,
+                    std::chrono::milliseconds sleep, BackupCallback const &callback) {
+      std::string partial = path + ".partial";
+
+      std::filesystem::remove(partial);
+
+      auto destination = std::make_unique<SQLite::Database>(partial, SQLite::OPEN_READWRITE | SQLite::OPEN_CREATE);
+      sqlite3_backup *backup = sqlite3_backup_init(destination->getHandle(), "main", mDb.getHandle(), "main");
+
+      if (backup == nullptr) {
+        throw std::runtime_error(fmt::format(
+          "Unable to start backup to '{}': {}", path, sqlite3_errmsg(destination->getHandle())));
+      }
+
+      BackupProgress progress;
+      int rc = SQLITE_OK;
+
+      progress.remaining = -1;
+
+      while (!job.is_cancelled()) {
+        {
+          // never steps inside a write transaction, nor makes one wait for a step
+          std::unique_lock<std::recursive_mutex> lk(mTransactionMutex, std::try_to_lock);
+
+          if (!lk.owns_lock() or mTransactionDepth > 0) {
+            lk = {};
+
+            std::this_thread::sleep_for(sleep);
+
+            continue;
+          }
+
+          rc = sqlite3_backup_step(backup, pagesPerStep);
+        }
+
+        if (rc != SQLITE_OK and rc != SQLITE_DONE and rc != SQLITE_BUSY and rc != SQLITE_LOCKED) {
+          break;
+        }
+
+        int64_t remaining = sqlite3_backup_remaining(backup);
+
+        if (progress.remaining >= 0 and remaining > progress.remaining) {
+          progress.restarts++;
+        }
+
+        progress.remaining = remaining;
+        progress.pageCount = sqlite3_backup_pagecount(backup);
+        progress.steps++;
+        progress.done = rc == SQLITE_DONE;
+
+        job.set_progress(progress);
+
+        if (callback) {
+          callback(progress);
+        }
+
+        if (rc == SQLITE_DONE) {
+          break;
+        }
+
+        std::this_thread::sleep_for(sleep);
+      }
+
+      int finish = sqlite3_backup_finish(backup);
+      std::string error = rc == SQLITE_DONE ? sqlite3_errmsg(destination->getHandle()) : sqlite3_errstr(rc);
+
+      destination.reset();
+
+      if (rc != SQLITE_DONE or finish != SQLITE_OK) {
+        std::filesystem::remove(partial);
+
+        if (job.is_cancelled()) {
+          throw std::runtime_error("backup cancelled");
+        }
+
+        throw std::runtime_error(fmt::format("Unable to backup to '{}': {}", path, error));
+      }
+
+      std::filesystem::rename(partial, path);
+    }
+
+    static bool is_busy(std::exception const &e) {
+      if (dynamic_cast<BusyError const *>(&e) != nullptr) {
+        return true;
+      }
+
+      if (auto const *error = dynamic_cast<SQLite::Exception const *>(&e); error != nullptr) {
+        int code = error->getErrorCode() & 0xff;
+
+        return code == SQLITE_BUSY or code == SQLITE_LOCKED;
+      }
+
+      return false;
+    }
+
+    std::chrono::milliseconds get_backoff(std::size_t attempt) const {
+      thread_local std::mt19937 generator{std::random_device{}()};
+
+      auto backoff = std::min(
+        mBusyPolicy.initialBackoff * (int64_t{1} << std::min<std::size_t>(attempt, 20)),
+        mBusyPolicy.maxBackoff);
+      std::uniform_int_distribution<int64_t> jitter(backoff.count() / 2, backoff.count());
+
+      return std::chrono::milliseconds{jitter(generator)};
+    }
+
+    bool is_memory() const {
+      char const *filename = sqlite3_db_filename(mDb.getHandle(), "main");
+
+      return filename == nullptr or *filename == '\0';
+    }
+
+    static std::vector<std::string> const &get_pinned_tables() {
+      static std::vector<std::string> const tables = [] {
+        std::vector<std::string> items;
+
+        for_each<Tables...>([&]<typename Table>() {
+          if constexpr (MemoryPinned<Table>::value) {
+            items.push_back(Table::get_name());
+          }
+        });
+
+        return items;
+      }();
+
+      return tables;
+    }
+
+    /*
+      Creates jdb_pinned_version, with a row for each pinned table, and the
+      triggers that bump it on every write to the table. They live in the
+      file, so writes from any connection or process keep it up. In memory
+      databases are already served from memory.
+    */
+    void pin_tables() {
+      if (get_pinned_tables().empty() or is_memory()) {
+        return;
+      }
+
+      std::string names;
+
+      for (auto const &table: get_pinned_tables()) {
+        for (std::string operation: {"INSERT", "UPDATE", "DELETE"}) {
+          names += fmt::format("{}'jdb_pinned_{}_{}'", names.empty() ? "" : ", ", table, operation);
+        }
+      }
+
+      int64_t triggers = 0;
+
+      query_string(fmt::format("SELECT COUNT(*) FROM sqlite_master WHERE type = 'trigger' AND name IN ({});", names),
+                   [&](auto const &, std::vector<Data> const &values) {
+                     triggers = values[0].get_int().value_or(0);
+
+                     return false;
+                   });
+
+      // already pinned, no need for the write lock
+      if (triggers == static_cast<int64_t>(get_pinned_tables().size() * 3)) {
+        return;
+      }
+
+      SQLite::Transaction transaction(mDb, SQLite::TransactionBehavior::IMMEDIATE);
+
+      // without rowid, so the update hook (and the change feed) never see it
+      mDb.exec("CREATE TABLE IF NOT EXISTS jdb_pinned_version "
+               "(name TEXT PRIMARY KEY, version INTEGER NOT NULL) WITHOUT ROWID;");
+
+      for (auto const &table: get_pinned_tables()) {
+        mDb.exec(fmt::format("INSERT OR IGNORE INTO jdb_pinned_version (name, version) VALUES ('{}', 0);", table));
+
+        for (std::string operation: {"INSERT", "UPDATE", "DELETE"}) {
+          mDb.exec(fmt::format(
+            "CREATE TRIGGER IF NOT EXISTS jdb_pinned_{0}_{1} AFTER {1} ON {0} "
+            "BEGIN UPDATE jdb_pinned_version SET version = version + 1 WHERE name = '{0}'; END;", table, operation));
+        }
+      }
+
+      transaction.commit();
+    }
+
+    static int64_t get_pragma(ReaderConnection &connection, std::string const &name) {
+      SQLite::Statement query(connection, fmt::format("PRAGMA {};", name));
+
+      query.executeStep();
+
+      return query.getColumn(0).getInt64();
+    }
+
+    /*
+      Reloads, from the connection's snapshot, the copies whose row in
+      jdb_pinned_version moved. That row is only read when data_version says
+      something was committed; a new schema_version (a migration, a file
+      restored in place) reloads them all, as does a table without a row.
+    */
+    void refresh_pinned(ReaderConnection &connection) {
+      int64_t dataVersion = get_pragma(connection, "data_version");
+
+      if (connection.dataVersion == dataVersion) {
+        return;
+      }
+
+      if (int64_t schemaVersion = get_pragma(connection, "schema_version"); connection.schemaVersion != schemaVersion) {
+        SQLite::Statement query(connection, "SELECT 1 FROM main.sqlite_master WHERE name = 'jdb_pinned_version';");
+
+        connection.hasVersions = query.executeStep();
+        connection.schemaVersion = schemaVersion;
+        connection.versions.clear();
+      }
+
+      std::unordered_map<std::string, int64_t> versions;
+
+      if (connection.hasVersions) {
+        SQLite::Statement query(connection, "SELECT name, version FROM main.jdb_pinned_version;");
+
+        while (query.executeStep()) {
+          versions[query.getColumn(0).getString()] = query.getColumn(1).getInt64();
+        }
+      }
+
+      for (auto const &table: get_pinned_tables()) {
+        auto version = versions.find(table);
+        auto loaded = connection.versions.find(table);
+
+        if (version != versions.end() and loaded != connection.versions.end() and loaded->second == version->second) {
+          continue;
+        }
+
+        connection.versions.erase(table);
+
+        load_pinned(connection, table);
+
+        if (version != versions.end()) {
+          connection.versions[table] = version->second;
+        }
+      }
+
+      connection.dataVersion = dataVersion;
+    }
+
+    /*
+      Rebuilds the temp copy of a pinned table from the connection's
+      snapshot: columns, primary key and (non partial, non expression)
+      indexes are taken from the file schema, and rows keep their rowid.
+    */
+    void load_pinned(ReaderConnection &connection, std::string const &table) {
+      std::vector<std::string> keys;
+      std::string columns;
+      std::string definitions;
+
+      {
+        SQLite::Statement query(connection, fmt::format("PRAGMA main.table_info({});", table));
+
+        while (query.executeStep()) {
+          std::string name = query.getColumn(1).getString();
+
+          definitions += fmt::format("{}{} {}", columns.empty() ? "" : ", ", name, query.getColumn(2).getString());
+          columns += (columns.empty() ? "" : ", ") + name;
+
+          // position in the primary key, 0 for other columns
+          if (auto key = static_cast<std::size_t>(query.getColumn(5).getInt64()); key > 0) {
+            keys.resize(std::max(keys.size(), key));
+            keys[key - 1] = name;
+          }
+        }
+      }
+
+      if (columns.empty()) {
+        throw std::runtime_error(fmt::format("Unable to pin missing table '{}'", table));
+      }
+
+      if (!keys.empty()) {
+        definitions += ", PRIMARY KEY (";
+
+        for (std::size_t i = 0; i < keys.size(); i++) {
+          definitions += (i == 0 ? "" : ", ") + keys[i];
+        }
+
+        definitions += ")";
+      }
+
+      std::vector<std::string> indexes;
+
+      {
+        SQLite::Statement query(connection, fmt::format("PRAGMA main.index_list({});", table));
+
+        while (query.executeStep()) {
+          std::string name = query.getColumn(1).getString();
+          bool unique = query.getColumn(2).getInt64() != 0;
+          std::string items;
+          bool expression = false;
+
+          if (query.getColumn(3).getString() == "pk" or query.getColumn(4).getInt64() != 0) {
+            continue;
+          }
+
+          SQLite::Statement info(connection, fmt::format("PRAGMA main.index_info({});", name));
+
+          while (info.executeStep()) {
+            expression = expression or info.getColumn(1).getInt64() < 0;
+            items += (items.empty() ? "" : ", ") + info.getColumn(2).getString();
+          }
+
+          if (!expression and !items.empty()) {
+            indexes.push_back(fmt::format("CREATE {}INDEX temp.jdb_pinned_{} ON {} ({});",
+                                          unique ? "UNIQUE " : "", name, table, items));
+          }
+        }
+      }
+
+      connection.exec(fmt::format("DROP TABLE IF EXISTS temp.{};", table));
+      connection.exec(fmt::format("CREATE TEMP TABLE {} ({});", table, definitions));
+
+      for (auto const &index: indexes) {
+        connection.exec(index);
+      }
+
+      connection.exec(fmt::format("INSERT INTO temp.{0} (ROWID, {1}) SELECT ROWID, {1} FROM main.{0};",
+                                  table, columns));
+
+      mPinnedLoads.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::unique_ptr<ReaderConnection> acquire_reader() {
+      {
+        std::lock_guard<std::mutex> lk(mReadersMutex);
+
+        if (!mReaders.empty()) {
+          auto connection = std::move(mReaders.back());
+
+          mReaders.pop_back();
+
+          return connection;
+        }
+      }
+
+      auto connection = std::make_unique<ReaderConnection>(
+        sqlite3_db_filename(mDb.getHandle(), "main"), SQLite::OPEN_READONLY,
+        static_cast<int>(mBusyPolicy.busyTimeout.count()));
+
+      if (!get_pinned_tables().empty()) {
+        // the temp schema holds the pinned copies, it must not spill to a file
+        connection->exec("PRAGMA temp_store = MEMORY;");
+      }
+
+      return connection;
+    }
+
+    void release_reader(std::unique_ptr<ReaderConnection> connection) {
+      std::lock_guard<std::mutex> lk(mReadersMutex);
+
+      mReaders.push_back(std::move(connection));
+    }
+
+    template<typename Callback>
+    int64_t run_query(std::string const &sql, Callback const &callback, std::pmr::memory_resource *resource) {
+      int64_t result = execute(mDb, sql, callback, resource);
+
+      // statements outside of write_transaction() commit on their own
+      if (mWriterThread.load(std::memory_order_acquire) != std::this_thread::get_id() and
+          sqlite3_get_autocommit(mDb.getHandle()) != 0) {
+        mChangeFeed.settle();
+        mChangeFeed.publish();
+      }
+
+      return result;
+    }
+
+    template<typename Callback>
+    int64_t execute(SQLite::Database &connection, std::string const &sql, Callback const &callback,
+                    std::pmr::memory_resource *resource = std::pmr::get_default_resource()) {
+      if (mScanDetectorEnabled.load(std::memory_order_relaxed)) {
+        if (std::shared_ptr<ScanDetector> detector = mScanDetector.load(); detector) {
+          detector->check(connection, sql);
+        }
+      }
+
+      auto start = std::chrono::steady_clock::now();
+      uint64_t rows = 0;
+
+      try {
+        SQLite::Statement query(connection, sql);
+
+        int64_t result = step(query, callback, rows, resource);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        std::string const *shape = nullptr;
+
+        if (mMetricsEnabled.load(std::memory_order_relaxed)) {
+          bool readonly = sqlite3_stmt_readonly(query.getPreparedStatement()) != 0;
+
+          shape = &mMetrics.record(sql, elapsed, rows, readonly ? 0 : sqlite3_changes(connection.getHandle()));
+        }
+
+        if (auto threshold = mSlowQueryThreshold.load(std::memory_order_relaxed);
+          threshold > 0 and elapsed.count() >= threshold) {
+          report_slow_query(connection, query, sql, shape, elapsed);
+        }
+
+        return result;
+      } catch (std::exception &e) {
+        if (mMetricsEnabled.load(std::memory_order_relaxed)) {
+          mMetrics.record(sql, std::chrono::steady_clock::now() - start, rows, 0, true);
+        }
+
+        if (is_busy(e)) {
+          throw BusyError(fmt::format("{}: {}", e.what(), sql));
+        }
+
+        throw std::runtime_error(fmt::format("{}: {}", e.what(), sql));
+      }
+    }
+
+    /*
+      shape is the one recorded by the metrics, normalized here when they are
+      disabled.
+    */
+    void report_slow_query(SQLite::Database &connection, SQLite::Statement &query, std::string const &sql,
+                           std::string const *shape, std::chrono::nanoseconds elapsed) {
+      std::shared_ptr<SlowQueryLog> log = mSlowQueryLog.load();
+
+      if (!log) {
+        return;
+      }
+
+      try {
+        SlowQuery item;
+
+        item.sql = sql;
+        item.shape = shape != nullptr ? *shape : normalize_statement(sql);
+        item.duration = elapsed;
+
+        if (!log->admit(item.shape, item.suppressed)) {
+          return;
+        }
+
+        sqlite3_stmt *statement = query.getPreparedStatement();
+
+        item.fullScanSteps = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0);
+        item.sorts = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_SORT, 0);
+        item.autoIndexes = sqlite3_stmt_status(statement, SQLITE_STMTSTATUS_AUTOINDEX, 0);
+        item.plan = explain(connection, sql);
+
+        log->report(item);
+      } catch (...) {
+        // reporting must never fail the statement itself
+      }
+    }
+
+    /*
+      EXPLAIN QUERY PLAN details, indented by their depth in the plan tree.
+    */
+    static std::vector<std::string> explain(SQLite::Database &connection, std::string const &sql) {
+      std::vector<std::string> plan;
+      std::unordered_map<int64_t, std::size_t> depths;
+
+      try {
+        SQLite::Statement query(connection, "EXPLAIN QUERY PLAN " + sql);
+
+        while (query.executeStep()) {
+          int64_t id = query.getColumn(0).getInt64();
+          int64_t parent = query.getColumn(1).getInt64();
+          std::size_t depth = depths.contains(parent) ? depths[parent] + 1 : 0;
+
+          depths[id] = depth;
+
+          plan.emplace_back(std::string(depth * 2, ' ') + query.getColumn(3).getString());
+        }
+      } catch (std::exception &) {
+        // statements like pragmas have no plan
+      }
+
+      return plan;
+    }
+
+    template<typename Callback>
+    static int64_t step(SQLite::Statement &query, Callback const &callback, uint64_t &rows,
+                        std::pmr::memory_resource *resource) {
+      std::vector<std::string> columns;
+      std::vector<Data> values;
+
+      if (!query.executeStep()) {
+        return -1L;
+      }
+
+      columns.clear();
+
+      for (int i = 0; i < query.getColumnCount(); i++) {
+        columns.emplace_back(query.getColumn(i).getName());
+      }
+
+      do {
+        rows++;
+
+        for (int i = 0; i < query.getColumnCount(); i++) {
+          SQLite::Column col = query.getColumn(i);
+
+          if (col.isInteger()) {
+            values.emplace_back(col.getInt64());
+          } else if (col.isFloat()) {
+            values.emplace_back(col.getDouble());
+          } else if (col.isText()) {
+            values.emplace_back(std::string_view{col.getText(), static_cast<std::size_t>(col.getBytes())}, resource);
+          } else if (col.isBlob()) {
+            throw std::runtime_error("Type not implemented");
+          } else {
+            values.emplace_back(nullptr);
+          }
+        }
+
+        if (!callback(columns, values)) {
+          break;
+        }
+
+        values.clear();
+      } while (query.executeStep());
+
+      query.reset();
+
+      return query.getChanges();
+    }
 
     void fillValues(SQLite::Statement &query, std::vector<Data> const &values) {
       for (int i = 0; i < values.size(); i++) {
@@ -202,11 +1111,58 @@ namespace jdb {
             [&](bool arg) { query.bind(i + 1, arg); },
             [&](int64_t arg) { query.bind(i + 1, arg); },
             [&](double arg) { query.bind(i + 1, arg); },
-            [&](std::string const &arg) { query.bind(i + 1, arg); }
+            [&](std::pmr::string const &arg) {
+              sqlite3_bind_text(query.getPreparedStatement(), i + 1, arg.data(), static_cast<int>(arg.size()),
+                                SQLITE_TRANSIENT);
+            }
           });
       }
     }
 
+    static std::vector<std::string> const &get_schema_ddl() {
+      static std::vector<std::string> const ddls = [] {
+        std::vector<std::string> items;
+
+        items.emplace_back(create_ddl(MigracaoModel{}));
+
+        for_each<Tables...>([&]<typename Table>() {
+          try {
+            typename Table::Keys{};
+            typename Table::Refers{};
+
+            items.emplace_back(create_ddl(Table{}));
+          } catch (std::runtime_error &e) {
+            throw std::runtime_error(
+              fmt::format("On '{}' -> {}", Table::get_name(), e.what()));
+          }
+        });
+
+        return items;
+      }();
+
+      return ddls;
+    }
+
+    /*
+      FNV-1a over the generated DDL, which covers table names, fields, types,
+      defaults and keys, folded to a positive non zero 32 bits user_version.
+    */
+    static int64_t get_schema_fingerprint() {
+      static int64_t const fingerprint = [] {
+        uint64_t hash = 14695981039346656037ULL;
+
+        for (auto const &ddl: get_schema_ddl()) {
+          for (unsigned char c: ddl) {
+            hash = (hash ^ c) * 1099511628211ULL;
+          }
+        }
+
+        return static_cast<int64_t>(((hash ^ (hash >> 32)) & 0x7fffffff) | 1);
+      }();
+
+      return fingerprint;
+    }
+
     template<typename Arg, typename... Args, typename F>
     static constexpr void for_each(F callback) {
       callback.template operator()<Arg>();
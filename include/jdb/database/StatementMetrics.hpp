@@ -0,0 +1,438 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <fmt/format.h>
+
+namespace jdb {
+  /*
+    Log-linear (HDR style) latency buckets: values below SubBuckets are exact,
+    every power of two above is split in SubBuckets linear buckets, so each
+    bucket spans at most 1/SubBuckets of its value. Latencies are clamped at
+    2^MaxBits nanoseconds (about 18 minutes).
+  */
+  struct LatencyBuckets {
+    static constexpr std::size_t SubBits = 4;
+    static constexpr std::size_t SubBuckets = std::size_t{1} << SubBits;
+    static constexpr std::size_t MaxBits = 40;
+    static constexpr std::size_t Size = (MaxBits - SubBits + 1) * SubBuckets;
+
+    static constexpr std::size_t index_of(uint64_t nanos) {
+      nanos = std::min<uint64_t>(nanos, (uint64_t{1} << MaxBits) - 1);
+
+      if (nanos < SubBuckets) {
+        return nanos;
+      }
+
+      std::size_t shift = std::bit_width(nanos) - 1 - SubBits;
+
+      return (shift + 1) * SubBuckets + ((nanos >> shift) & (SubBuckets - 1));
+    }
+
+    static constexpr uint64_t lower_bound(std::size_t index) {
+      if (index < SubBuckets) {
+        return index;
+      }
+
+      std::size_t shift = index / SubBuckets - 1;
+
+      return (SubBuckets + index % SubBuckets) << shift;
+    }
+
+    static constexpr uint64_t upper_bound(std::size_t index) {
+      return lower_bound(index + 1) - 1;
+    }
+  };
+
+  struct StatementStats {
+    std::string shape;
+    uint64_t calls{};
+    uint64_t errors{};
+    uint64_t rows{};
+    uint64_t changes{};
+    uint64_t totalNanos{};
+    uint64_t maxNanos{};
+    std::vector<uint64_t> histogram = std::vector<uint64_t>(LatencyBuckets::Size);
+
+    /*
+      Upper bound of the bucket holding the given percentile (0..100).
+    */
+    [[nodiscard]] uint64_t percentile(double value) const {
+      uint64_t total = 0;
+
+      for (auto count: histogram) {
+        total += count;
+      }
+
+      if (total == 0) {
+        return 0;
+      }
+
+      uint64_t rank = static_cast<uint64_t>(value / 100.0 * static_cast<double>(total) + 0.5);
+      uint64_t seen = 0;
+
+      rank = std::max<uint64_t>(rank, 1);
+
+      for (std::size_t i = 0; i < histogram.size(); i++) {
+        seen += histogram[i];
+
+        if (seen >= rank) {
+          return std::min(LatencyBuckets::upper_bound(i), maxNanos);
+        }
+      }
+
+      return maxNanos;
+    }
+
+    [[nodiscard]] uint64_t mean() const {
+      return calls == 0 ? 0 : totalNanos / calls;
+    }
+  };
+
+  /*
+    Replaces literals by '?' and collapses repeated VALUES groups and IN lists
+    of literals, so statements that only differ by their values share the same
+    shape. Quotes inside literals are doubled (SQL style), never escaped.
+  */
+  inline std::string normalize_statement(std::string_view sql) {
+    std::string shape;
+    bool space = false;
+
+    shape.reserve(sql.size());
+
+    auto is_word = [](char c) {
+      return std::isalnum(static_cast<unsigned char>(c)) or c == '_';
+    };
+
+    for (std::size_t i = 0; i < sql.size(); i++) {
+      char c = sql[i];
+
+      if (std::isspace(static_cast<unsigned char>(c))) {
+        space = !shape.empty();
+
+        continue;
+      }
+
+      if (space) {
+        shape.push_back(' ');
+
+        space = false;
+      }
+
+      if (c == '\'' or c == '"') {
+        for (i++; i < sql.size(); i++) {
+          if (sql[i] == c) {
+            if (i + 1 < sql.size() and sql[i + 1] == c) {
+              i++;
+            } else {
+              break;
+            }
+          }
+        }
+
+        shape.push_back('?');
+      } else if ((std::isdigit(static_cast<unsigned char>(c)) or
+                  (c == '-' and i + 1 < sql.size() and std::isdigit(static_cast<unsigned char>(sql[i + 1])))) and
+                 (shape.empty() or !is_word(shape.back()))) {
+        for (i++; i < sql.size() and (is_word(sql[i]) or sql[i] == '.'); i++) {
+        }
+
+        i--;
+
+        shape.push_back('?');
+      } else {
+        shape.push_back(c);
+      }
+    }
+
+    if (auto values = shape.find(" VALUES ("); values != std::string::npos) {
+      auto start = values + 8;
+      auto end = shape.find(')', start);
+
+      if (end != std::string::npos) {
+        std::string group = ", " + shape.substr(start, end - start + 1);
+
+        for (auto next = end + 1; shape.compare(next, group.size(), group) == 0;) {
+          shape.erase(next, group.size());
+        }
+      }
+    }
+
+    // "IN (?, ?, ?)" -> "IN (?)"
+    for (auto in = shape.find("IN (?"); in != std::string::npos; in = shape.find("IN (?", in + 4)) {
+      if (in > 0 and is_word(shape[in - 1])) {
+        continue;
+      }
+
+      for (auto next = in + 5; shape.compare(next, 3, ", ?") == 0;) {
+        shape.erase(next, 3);
+      }
+    }
+
+    return shape;
+  }
+
+  /*
+    Per statement shape counters and latency histograms. Each thread records
+    into its own shard, touching only relaxed atomics it alone writes, and
+    publishes new shapes through lock-free lists; snapshot() merges the shards
+    without stopping the writers.
+  */
+  struct StatementMetrics {
+    StatementMetrics() = default;
+
+    StatementMetrics(StatementMetrics const &) = delete;
+
+    StatementMetrics &operator=(StatementMetrics const &) = delete;
+
+    ~StatementMetrics() {
+      for (Shard *shard = mShards.load(std::memory_order_acquire); shard != nullptr;) {
+        for (Entry *entry = shard->head.load(std::memory_order_acquire); entry != nullptr;) {
+          delete std::exchange(entry, entry->next);
+        }
+
+        delete std::exchange(shard, shard->next);
+      }
+    }
+
+    /*
+      Returns the shape of sql, which stays valid as long as the metrics.
+    */
+    std::string const &record(std::string_view sql, std::chrono::nanoseconds elapsed, uint64_t rows,
+                              uint64_t changes, bool failed = false) {
+      Entry &entry = get_entry(sql);
+      uint64_t nanos = static_cast<uint64_t>(std::max<int64_t>(elapsed.count(), 0));
+
+      increment(entry.calls, 1);
+      increment(entry.errors, failed ? 1 : 0);
+      increment(entry.rows, rows);
+      increment(entry.changes, changes);
+      increment(entry.totalNanos, nanos);
+      increment(entry.histogram[LatencyBuckets::index_of(nanos)], 1);
+
+      if (nanos > entry.maxNanos.load(std::memory_order_relaxed)) {
+        entry.maxNanos.store(nanos, std::memory_order_relaxed);
+      }
+
+      return entry.shape;
+    }
+
+    [[nodiscard]] std::vector<StatementStats> snapshot() const {
+      std::map<std::string, StatementStats> merged;
+
+      for (Shard *shard = mShards.load(std::memory_order_acquire); shard != nullptr; shard = shard->next) {
+        for (Entry *entry = shard->head.load(std::memory_order_acquire); entry != nullptr; entry = entry->next) {
+          auto &stats = merged[entry->shape];
+
+          stats.shape = entry->shape;
+          stats.calls += entry->calls.load(std::memory_order_relaxed);
+          stats.errors += entry->errors.load(std::memory_order_relaxed);
+          stats.rows += entry->rows.load(std::memory_order_relaxed);
+          stats.changes += entry->changes.load(std::memory_order_relaxed);
+          stats.totalNanos += entry->totalNanos.load(std::memory_order_relaxed);
+          stats.maxNanos = std::max(stats.maxNanos, entry->maxNanos.load(std::memory_order_relaxed));
+
+          for (std::size_t i = 0; i < LatencyBuckets::Size; i++) {
+            stats.histogram[i] += entry->histogram[i].load(std::memory_order_relaxed);
+          }
+        }
+      }
+
+      std::vector<StatementStats> items;
+
+      for (auto &[shape, stats]: merged) {
+        items.emplace_back(std::move(stats));
+      }
+
+      std::ranges::sort(items, [](auto const &a, auto const &b) { return a.totalNanos > b.totalNanos; });
+
+      return items;
+    }
+
+    [[nodiscard]] std::string to_text() const {
+      std::string out = fmt::format("{:>10} {:>8} {:>10} {:>10} {:>12} {:>12} {:>12} {:>12}  {}\n",
+                                    "calls", "errors", "rows", "changes", "mean(us)", "p50(us)", "p99(us)",
+                                    "max(us)", "statement");
+
+      for (auto const &stats: snapshot()) {
+        out += fmt::format("{:>10} {:>8} {:>10} {:>10} {:>12.1f} {:>12.1f} {:>12.1f} {:>12.1f}  {}\n",
+                           stats.calls, stats.errors, stats.rows, stats.changes, stats.mean() / 1000.0,
+                           stats.percentile(50) / 1000.0, stats.percentile(99) / 1000.0,
+                           stats.maxNanos / 1000.0, stats.shape);
+      }
+
+      return out;
+    }
+
+    [[nodiscard]] std::string to_json() const {
+      std::string out = "[";
+      bool first = true;
+
+      for (auto const &stats: snapshot()) {
+        if (!first) {
+          out += ",";
+        }
+
+        first = false;
+
+        out += fmt::format(
+          R"({{"statement":"{}","calls":{},"errors":{},"rows":{},"changes":{},"total_ns":{},"mean_ns":{},)"
+          R"("p50_ns":{},"p90_ns":{},"p99_ns":{},"p999_ns":{},"max_ns":{}}})",
+          escape_json(stats.shape), stats.calls, stats.errors, stats.rows, stats.changes, stats.totalNanos,
+          stats.mean(), stats.percentile(50), stats.percentile(90), stats.percentile(99),
+          stats.percentile(99.9), stats.maxNanos);
+      }
+
+      out += "]";
+
+      return out;
+    }
+
+  private:
+    struct Entry {
+      std::string shape;
+      std::atomic<uint64_t> calls{0};
+      std::atomic<uint64_t> errors{0};
+      std::atomic<uint64_t> rows{0};
+      std::atomic<uint64_t> changes{0};
+      std::atomic<uint64_t> totalNanos{0};
+      std::atomic<uint64_t> maxNanos{0};
+      std::array<std::atomic<uint64_t>, LatencyBuckets::Size> histogram{};
+      Entry *next{nullptr};
+    };
+
+    struct StringHash {
+      using is_transparent = void;
+
+      std::size_t operator()(std::string_view value) const {
+        return std::hash<std::string_view>{}(value);
+      }
+    };
+
+    using EntryIndex = std::unordered_map<std::string, Entry *, StringHash, std::equal_to<> >;
+
+    // statements embedding their literals are all distinct, the cache is reset past this size
+    static constexpr std::size_t MaxStatements = 1024;
+
+    struct Shard {
+      std::thread::id owner;
+      // shape -> entry
+      EntryIndex index;
+      // exact sql -> entry, spares normalize_statement() on repeated statements
+      EntryIndex statements;
+      std::atomic<Entry *> head{nullptr};
+      Shard *next{nullptr};
+    };
+
+    inline static std::atomic<uint64_t> sInstances{0};
+
+    uint64_t const mId = sInstances.fetch_add(1, std::memory_order_relaxed);
+    std::atomic<Shard *> mShards{nullptr};
+
+    // single writer per shard, so a plain load and store is enough
+    static void increment(std::atomic<uint64_t> &counter, uint64_t value) {
+      counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    /*
+      Shards belong to a thread (id) and are found by walking the list; a small
+      thread local cache, keyed by instance id and not address since a later
+      instance may reuse the memory, skips the walk without growing with every
+      instance the thread ever touched. A thread id reused by the system takes
+      over the shard of its finished predecessor, still a single writer.
+    */
+    Shard &get_shard() {
+      thread_local std::array<std::pair<uint64_t, Shard *>, 8> cache{};
+
+      auto &slot = cache[mId % cache.size()];
+
+      if (slot.second != nullptr and slot.first == mId) {
+        return *slot.second;
+      }
+
+      std::thread::id owner = std::this_thread::get_id();
+
+      for (Shard *shard = mShards.load(std::memory_order_acquire); shard != nullptr; shard = shard->next) {
+        if (shard->owner == owner) {
+          slot = {mId, shard};
+
+          return *shard;
+        }
+      }
+
+      auto *shard = new Shard{};
+
+      shard->owner = owner;
+      shard->next = mShards.load(std::memory_order_relaxed);
+
+      while (!mShards.compare_exchange_weak(shard->next, shard, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+      }
+
+      slot = {mId, shard};
+
+      return *shard;
+    }
+
+    Entry &get_entry(std::string_view sql) {
+      Shard &shard = get_shard();
+
+      if (auto it = shard.statements.find(sql); it != shard.statements.end()) {
+        return *it->second;
+      }
+
+      std::string shape = normalize_statement(sql);
+      Entry *entry;
+
+      if (auto it = shard.index.find(shape); it != shard.index.end()) {
+        entry = it->second;
+      } else {
+        entry = new Entry{};
+
+        entry->shape = shape;
+        entry->next = shard.head.load(std::memory_order_relaxed);
+
+        shard.head.store(entry, std::memory_order_release);
+        shard.index[std::move(shape)] = entry;
+      }
+
+      if (shard.statements.size() >= MaxStatements) {
+        shard.statements.clear();
+      }
+
+      shard.statements.emplace(sql, entry);
+
+      return *entry;
+    }
+
+    static std::string escape_json(std::string_view value) {
+      std::string out;
+
+      for (char c: value) {
+        if (c == '"' or c == '\\') {
+          out.push_back('\\');
+          out.push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+          out += fmt::format("\\u{:04x}", static_cast<int>(c));
+        } else {
+          out.push_back(c);
+        }
+      }
+
+      return out;
+    }
+  };
+}
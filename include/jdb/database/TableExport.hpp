@@ -0,0 +1,381 @@
+#pragma once
+
+#include "jdb/database/DataClass.hpp"
+#include "jdb/database/Database.hpp"
+#include "jdb/utils/Scope.hpp"
+
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/format.h>
+
+#include <zlib.h>
+
+namespace jdb {
+  enum class ExportFormat { Csv, Ndjson };
+
+  enum class ExportCompression { None, Gzip };
+
+  using ExportSink = std::function<void(std::string_view)>;
+
+  struct ExportOptions {
+    ExportCompression compression{ExportCompression::None};
+    // zlib level, 1 (fast) to 9 (small)
+    int level{Z_DEFAULT_COMPRESSION};
+    // compression threads, more than one compresses blocks in parallel
+    std::size_t threads{1};
+    // text is handed to the sink (or compressed) in blocks of this size
+    std::size_t blockSize{1024 * 1024};
+    char delimiter{','};
+    bool header{true};
+    // SQL predicate over the table, empty exports every row
+    std::string where;
+  };
+
+  struct ExportStats {
+    std::size_t rows{};
+    // text produced, before compression
+    uint64_t bytes{};
+    // bytes handed to the sink
+    uint64_t written{};
+  };
+
+  /*
+    Buffered, optionally gzip compressed, output of an export. Text is
+    formatted into get_buffer() and goes out each time the buffer passes
+    blockSize, so memory does not grow with the output. A single thread
+    writes one deflate stream; with more threads each block becomes a gzip
+    member of its own, compressed on a Scope and written in order (gzip
+    readers take concatenated members as one file). close() writes what is
+    left; a writer destroyed without closing drops it.
+  */
+  struct ExportWriter {
+    ExportWriter(ExportSink sink, ExportOptions const &options)
+      : mSink{std::move(sink)}, mCompression{options.compression}, mLevel{options.level},
+        mBlockSize{std::max<std::size_t>(options.blockSize, 1)}, mThreads{std::max<std::size_t>(options.threads, 1)} {
+      if (mCompression == ExportCompression::Gzip) {
+        if (mThreads > 1) {
+          mScope = std::make_unique<Scope>(mThreads);
+        } else {
+          mStream = std::make_unique<z_stream>();
+
+          if (deflateInit2(mStream.get(), mLevel, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+            mStream.reset();
+
+            throw std::runtime_error("Unable to start export compression");
+          }
+        }
+      }
+    }
+
+    ExportWriter(ExportWriter const &) = delete;
+
+    ExportWriter &operator=(ExportWriter const &) = delete;
+
+    ~ExportWriter() {
+      mPending.clear();
+      mScope.reset();
+
+      if (mStream) {
+        deflateEnd(mStream.get());
+      }
+    }
+
+    fmt::memory_buffer &get_buffer() {
+      return mBuffer;
+    }
+
+    /*
+      Called after formatting into the buffer, flushes a full block.
+    */
+    void commit() {
+      if (mBuffer.size() >= mBlockSize) {
+        flush(false);
+      }
+    }
+
+    void close() {
+      if (mClosed) {
+        return;
+      }
+
+      mClosed = true;
+
+      flush(true);
+
+      while (!mPending.empty()) {
+        drain();
+      }
+    }
+
+    [[nodiscard]] uint64_t get_bytes() const {
+      return mBytes;
+    }
+
+    [[nodiscard]] uint64_t get_written() const {
+      return mWritten;
+    }
+
+  private:
+    ExportSink mSink;
+    ExportCompression mCompression;
+    int mLevel;
+    std::size_t mBlockSize;
+    std::size_t mThreads;
+    fmt::memory_buffer mBuffer;
+    std::unique_ptr<z_stream> mStream;
+    std::unique_ptr<Scope> mScope;
+    std::deque<std::future<std::string> > mPending;
+    uint64_t mBytes{};
+    uint64_t mWritten{};
+    bool mClosed{false};
+
+    void emit(std::string_view data) {
+      if (!data.empty()) {
+        mSink(data);
+
+        mWritten += data.size();
+      }
+    }
+
+    void flush(bool last) {
+      std::string_view block{mBuffer.data(), mBuffer.size()};
+
+      mBytes += block.size();
+
+      if (mCompression == ExportCompression::None) {
+        emit(block);
+      } else if (mScope) {
+        if (!block.empty()) {
+          mPending.push_back(mScope->post([data = std::string{block}, level = mLevel] {
+            return compress_member(data, level);
+          }));
+        }
+
+        // bounds the blocks held in memory
+        while (mPending.size() > mThreads * 2) {
+          drain();
+        }
+      } else {
+        deflate_block(block, last ? Z_FINISH : Z_NO_FLUSH);
+      }
+
+      mBuffer.clear();
+    }
+
+    void drain() {
+      std::string member = mPending.front().get();
+
+      mPending.pop_front();
+
+      emit(member);
+    }
+
+    void deflate_block(std::string_view block, int mode) {
+      char out[64 * 1024];
+
+      mStream->next_in = reinterpret_cast<Bytef *>(const_cast<char *>(block.data()));
+      mStream->avail_in = static_cast<uInt>(block.size());
+
+      int result;
+
+      do {
+        mStream->next_out = reinterpret_cast<Bytef *>(out);
+        mStream->avail_out = sizeof(out);
+
+        result = deflate(mStream.get(), mode);
+
+        if (result == Z_STREAM_ERROR) {
+          throw std::runtime_error("Unable to compress export");
+        }
+
+        emit({out, sizeof(out) - mStream->avail_out});
+      } while (mStream->avail_out == 0 or (mode == Z_FINISH and result != Z_STREAM_END));
+    }
+
+    static std::string compress_member(std::string_view data, int level) {
+      z_stream stream{};
+
+      if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Unable to start export compression");
+      }
+
+      std::string out(deflateBound(&stream, static_cast<uLong>(data.size())), '\0');
+
+      stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+      stream.avail_in = static_cast<uInt>(data.size());
+      stream.next_out = reinterpret_cast<Bytef *>(out.data());
+      stream.avail_out = static_cast<uInt>(out.size());
+
+      int result = deflate(&stream, Z_FINISH);
+
+      out.resize(stream.total_out);
+
+      deflateEnd(&stream);
+
+      if (result != Z_STREAM_END) {
+        throw std::runtime_error("Unable to compress export");
+      }
+
+      return out;
+    }
+  };
+
+  /*
+    Streams the rows of a table (in rowid order) as CSV or NDJSON. Rows are
+    read one at a time from the statement inside a read transaction, so the
+    export sees a single snapshot and, on file databases, does not hold the
+    writer. Ignored fields are left out.
+
+    CSV quotes only the values that need it (delimiter, quote or line
+    break), null is an empty field and the empty string "". NDJSON writes
+    one object per row, Bool fields as true/false. Both read back with
+    BulkLoader.
+  */
+  template<typename Model>
+  ExportStats export_table(Database &db, ExportSink sink, ExportFormat format, ExportOptions const &options = {}) {
+    std::vector<std::string> keys;
+    std::vector<FieldType> types;
+    std::string columns;
+
+    Model::get_fields([&]<typename Field>() {
+      std::string key;
+
+      if (format == ExportFormat::Csv) {
+        key = Field::get_name();
+      } else {
+        write_json_string(std::back_inserter(key), Field::get_name());
+
+        key = (keys.empty() ? "{" : ",") + key + ":";
+      }
+
+      columns += (keys.empty() ? "" : ", ") + Field::get_name();
+      keys.push_back(std::move(key));
+      types.push_back(Field::get_type());
+    });
+
+    ExportWriter writer{std::move(sink), options};
+    ExportStats stats;
+    auto &buffer = writer.get_buffer();
+    auto out = fmt::appender(buffer);
+
+    auto write_csv = [&](std::string_view value) {
+      if (value.empty() or value.find_first_of(std::string{options.delimiter} + "\"\r\n") != std::string_view::npos) {
+        buffer.push_back('"');
+
+        for (char c: value) {
+          if (c == '"') {
+            buffer.push_back('"');
+          }
+
+          buffer.push_back(c);
+        }
+
+        buffer.push_back('"');
+      } else {
+        buffer.append(value);
+      }
+    };
+
+    if (format == ExportFormat::Csv and options.header) {
+      for (std::size_t i = 0; i < keys.size(); i++) {
+        if (i > 0) {
+          buffer.push_back(options.delimiter);
+        }
+
+        write_csv(keys[i]);
+      }
+
+      buffer.push_back('\n');
+    }
+
+    db.read_transaction([&](Database &reader) {
+      reader.query_string(
+        fmt::format("SELECT {} FROM {}{} ORDER BY ROWID;", columns, Model::get_name(),
+                    options.where.empty() ? "" : fmt::format(" WHERE ({})", options.where)),
+        [&](std::vector<std::string> const &, std::vector<Data> const &values) {
+          for (std::size_t i = 0; i < values.size(); i++) {
+            bool csv = format == ExportFormat::Csv;
+
+            if (csv and i > 0) {
+              buffer.push_back(options.delimiter);
+            } else if (!csv) {
+              buffer.append(std::string_view{keys[i]});
+            }
+
+            values[i].get_value(overloaded{
+              [&](InvalidData) {
+                if (!csv) {
+                  buffer.append(std::string_view{"null"});
+                }
+              },
+              [&](std::nullptr_t) {
+                if (!csv) {
+                  buffer.append(std::string_view{"null"});
+                }
+              },
+              [&](bool arg) {
+                buffer.append(std::string_view{csv ? (arg ? "1" : "0") : (arg ? "true" : "false")});
+              },
+              [&](int64_t arg) {
+                if (!csv and types[i] == FieldType::Bool) {
+                  buffer.append(std::string_view{arg != 0 ? "true" : "false"});
+                } else {
+                  fmt::format_to(out, "{}", arg);
+                }
+              },
+              [&](double arg) {
+                if (!csv and !std::isfinite(arg)) {
+                  buffer.append(std::string_view{"null"});
+                } else {
+                  fmt::format_to(out, "{}", arg);
+                }
+              },
+              [&](std::pmr::string const &arg) {
+                if (csv) {
+                  write_csv(arg);
+                } else {
+                  write_json_string(out, arg);
+                }
+              }
+            });
+          }
+
+          if (format == ExportFormat::Ndjson) {
+            buffer.push_back('}');
+          }
+
+          buffer.push_back('\n');
+
+          stats.rows++;
+
+          writer.commit();
+
+          return true;
+        });
+    });
+
+    writer.close();
+
+    stats.bytes = writer.get_bytes();
+    stats.written = writer.get_written();
+
+    return stats;
+  }
+
+  template<typename Model>
+  ExportStats export_table(Database &db, std::ostream &out, ExportFormat format, ExportOptions const &options = {}) {
+    return export_table<Model>(db, [&out](std::string_view chunk) {
+      out.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+    }, format, options);
+  }
+}
@@ -1,56 +1,481 @@
 #pragma once
 
+#include "jdb/utils/Task.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <functional>
-#include <iostream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
 
-#include <boost/asio/io_context.hpp>
-#include <boost/asio/strand.hpp>
-#include <boost/thread/thread.hpp>
+namespace jdb {
+  enum class QueueOverflow { Block, Reject, RunInline };
 
-#include <crypt.h>
+  /*
+    capacity bounds the tasks accepted and not started yet, 0 leaves the queue
+    unbounded. Once it is full, Block makes the caller wait for room, Reject
+    throws QueueFullError and RunInline runs the task in the calling thread.
+    A worker never waits for room in its own pool (every worker could end up
+    waiting): it runs the task inline instead. Ordered tasks never run inline,
+    as that would break their order; they wait for room, and go over capacity
+    when posted from a worker.
+  */
+  struct QueuePolicy {
+    std::size_t capacity{0};
+    QueueOverflow overflow{QueueOverflow::Block};
+  };
 
-namespace jdb {
+  struct QueueFullError : public std::runtime_error {
+    using std::runtime_error::runtime_error;
+  };
+
+  /*
+    waits are measured from the moment a task is accepted until it starts.
+  */
+  struct ScopeStats {
+    std::size_t queued{};
+    std::size_t maxQueued{};
+    uint64_t submitted{};
+    uint64_t completed{};
+    uint64_t rejected{};
+    uint64_t inlined{};
+    uint64_t blocked{};
+    // detached tasks that threw
+    uint64_t failed{};
+    std::chrono::nanoseconds totalWait{};
+    std::chrono::nanoseconds maxWait{};
+  };
+
+  /*
+    Work stealing pool. Every worker owns a deque: tasks posted from a worker
+    go to its own deque and are taken back newest first, tasks posted from
+    other threads go to a shared queue, and an idle worker steals the oldest
+    task of another deque. post() runs tasks in parallel; post_ordered() runs
+    the tasks sharing a key one at a time and in the order they were posted,
+    like a strand, while different keys still run in parallel. Both return a
+    future of the task result, which also carries its exception. stop() lets
+    the running tasks finish and drops the queued ones, whose futures then
+    report a broken promise.
+  */
   struct Scope {
-    Scope(std::size_t threads = 1)
-      : mStrand{mIoContext.get_executor()}, 
-      mWorkGuard{boost::asio::make_work_guard(mIoContext)} {
+    Scope(std::size_t threads = 1, QueuePolicy policy = {}) : mPolicy{policy} {
+      threads = std::max<std::size_t>(threads, 1);
+
       for (std::size_t i = 0; i < threads; ++i) {
-        mThreads.create_thread([&]() {
-          mIoContext.run();
+        mWorkers.push_back(std::make_unique<Worker>());
+      }
+
+      for (std::size_t i = 0; i < threads; ++i) {
+        mThreads.emplace_back([this, i]() {
+          run(i);
         });
       }
     }
 
+    Scope(Scope const &) = delete;
+
+    Scope &operator=(Scope const &) = delete;
+
     ~Scope() {
       stop();
     }
 
-    void post(std::function<void()> task) {
-      std::allocator<void> allocator;
+    template<typename F>
+    auto post(F &&task) -> std::future<std::invoke_result_t<std::decay_t<F> > > {
+      auto [job, future] = make_job(std::forward<F>(task));
 
-      mStrand.post(task, allocator);
+      if (admit(false)) {
+        submit({std::move(job), Clock::now(), true});
+      } else {
+        job();
+      }
+
+      return std::move(future);
     }
 
-    void post_ordered(std::function<void()> task) {
-      std::allocator<void> allocator;
+    /*
+      Fire and forget: no future, so a small task is posted without any
+      allocation. Exceptions are counted in ScopeStats::failed and dropped.
+    */
+    template<typename F>
+    void post_detached(F &&task) {
+      Task job{[this, task = std::forward<F>(task)]() mutable {
+        try {
+          std::invoke(task);
+        } catch (...) {
+          mFailed.fetch_add(1, std::memory_order_relaxed);
+        }
+      }};
 
-      mStrand.post(task, allocator);
+      if (admit(false)) {
+        submit({std::move(job), Clock::now(), true});
+      } else {
+        job();
+      }
+    }
+
+    /*
+      Tasks posted without a key share the same one.
+    */
+    template<typename F>
+    auto post_ordered(F &&task) -> std::future<std::invoke_result_t<std::decay_t<F> > > {
+      return post_ordered(0, std::forward<F>(task));
+    }
+
+    template<typename F>
+    auto post_ordered(std::size_t key, F &&task) -> std::future<std::invoke_result_t<std::decay_t<F> > > {
+      auto [job, future] = make_job(std::forward<F>(task));
+      bool idle = false;
+
+      admit(true);
+
+      {
+        std::lock_guard<std::mutex> lk(mStrandsMutex);
+
+        auto &strand = mStrands[key];
+
+        strand.tasks.push_back({std::move(job), Clock::now(), true});
+
+        idle = !std::exchange(strand.running, true);
+      }
+
+      if (idle) {
+        submit({Task{[this, key]() { drain(key); }}, {}, false});
+      }
+
+      return std::move(future);
     }
 
     void stop() {
-      if (mWorkGuard.owns_work()) {
-        mWorkGuard.reset();
-        mIoContext.stop();
-        mThreads.interrupt_all();
-        mThreads.join_all();
+      if (mStopped.exchange(true)) {
+        return;
+      }
+
+      {
+        std::lock_guard<std::mutex> lk(mMutex);
+      }
+
+      mCondition.notify_all();
+
+      {
+        std::lock_guard<std::mutex> lk(mSpaceMutex);
       }
+
+      mSpace.notify_all();
+
+      for (auto &thread: mThreads) {
+        if (thread.joinable()) {
+          thread.join();
+        }
+      }
+
+      std::lock_guard<std::mutex> lk(mStrandsMutex);
+
+      mStrands.clear();
+    }
+
+    [[nodiscard]] std::size_t get_threads() const {
+      return mWorkers.size();
+    }
+
+    [[nodiscard]] QueuePolicy const &get_policy() const {
+      return mPolicy;
+    }
+
+    [[nodiscard]] ScopeStats get_stats() const {
+      return {
+        mPending.load(std::memory_order_relaxed),
+        mMaxPending.load(std::memory_order_relaxed),
+        mSubmitted.load(std::memory_order_relaxed),
+        mCompleted.load(std::memory_order_relaxed),
+        mRejected.load(std::memory_order_relaxed),
+        mInlined.load(std::memory_order_relaxed),
+        mBlocked.load(std::memory_order_relaxed),
+        mFailed.load(std::memory_order_relaxed),
+        std::chrono::nanoseconds{mTotalWait.load(std::memory_order_relaxed)},
+        std::chrono::nanoseconds{mMaxWait.load(std::memory_order_relaxed)}
+      };
     }
 
   private:
-    boost::asio::io_context mIoContext;
-    boost::asio::strand<boost::asio::io_context::executor_type> mStrand;
-    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> mWorkGuard;
-    boost::thread_group mThreads;
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+      Task task;
+      Clock::time_point accepted;
+      // internal strand drains are not user tasks
+      bool counted{true};
+    };
+
+    struct Worker {
+      std::deque<Entry> tasks;
+      std::mutex mutex;
+    };
+
+    struct Strand {
+      std::deque<Entry> tasks;
+      bool running{false};
+    };
+
+    inline static thread_local Scope *tScope{nullptr};
+    inline static thread_local std::size_t tWorker{0};
+
+    QueuePolicy mPolicy;
+    std::vector<std::unique_ptr<Worker> > mWorkers;
+    std::vector<std::thread> mThreads;
+    std::deque<Entry> mInjected;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::atomic<std::size_t> mQueued{0};
+    std::atomic<bool> mStopped{false};
+    std::unordered_map<std::size_t, Strand> mStrands;
+    std::mutex mStrandsMutex;
+    std::mutex mSpaceMutex;
+    std::condition_variable mSpace;
+    std::atomic<std::size_t> mPending{0};
+    std::atomic<std::size_t> mMaxPending{0};
+    std::atomic<uint64_t> mSubmitted{0};
+    std::atomic<uint64_t> mCompleted{0};
+    std::atomic<uint64_t> mRejected{0};
+    std::atomic<uint64_t> mInlined{0};
+    std::atomic<uint64_t> mBlocked{0};
+    std::atomic<uint64_t> mFailed{0};
+    std::atomic<int64_t> mTotalWait{0};
+    std::atomic<int64_t> mMaxWait{0};
+
+    template<typename F>
+    static auto make_job(F &&task) {
+      using Result = std::invoke_result_t<std::decay_t<F> >;
+
+      std::packaged_task<Result()> packaged{std::forward<F>(task)};
+      auto future = packaged.get_future();
+
+      return std::pair{Task{std::move(packaged)}, std::move(future)};
+    }
+
+    template<typename T>
+    static void store_max(std::atomic<T> &target, T value) {
+      T current = target.load(std::memory_order_relaxed);
+
+      while (current < value and !target.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+      }
+    }
+
+    /*
+      Takes a slot of the queue for a new task; false when the task has to run
+      inline in the caller instead.
+    */
+    bool admit(bool ordered) {
+      mSubmitted.fetch_add(1, std::memory_order_relaxed);
+
+      if (mPolicy.capacity == 0) {
+        store_max(mMaxPending, mPending.fetch_add(1, std::memory_order_relaxed) + 1);
+
+        return true;
+      }
+
+      std::unique_lock<std::mutex> lk(mSpaceMutex);
+      bool blocked = false;
+
+      while (mPending.load(std::memory_order_relaxed) >= mPolicy.capacity and
+             !mStopped.load(std::memory_order_acquire)) {
+        bool worker = tScope == this;
+
+        if (mPolicy.overflow == QueueOverflow::Reject) {
+          mRejected.fetch_add(1, std::memory_order_relaxed);
+
+          throw QueueFullError("Scope queue is full");
+        }
+
+        if (!ordered and (worker or mPolicy.overflow == QueueOverflow::RunInline)) {
+          mInlined.fetch_add(1, std::memory_order_relaxed);
+
+          return false;
+        }
+
+        if (worker) {
+          break;
+        }
+
+        if (!std::exchange(blocked, true)) {
+          mBlocked.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        mSpace.wait(lk);
+      }
+
+      store_max(mMaxPending, mPending.fetch_add(1, std::memory_order_relaxed) + 1);
+
+      return true;
+    }
+
+    /*
+      Runs a user task, keeping the queue metrics.
+    */
+    void execute(Entry &entry) {
+      if (entry.counted) {
+        int64_t wait = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - entry.accepted).count();
+
+        mTotalWait.fetch_add(wait, std::memory_order_relaxed);
+        store_max(mMaxWait, wait);
+
+        mPending.fetch_sub(1, std::memory_order_relaxed);
+
+        if (mPolicy.capacity > 0) {
+          {
+            std::lock_guard<std::mutex> lk(mSpaceMutex);
+          }
+
+          mSpace.notify_one();
+        }
+      }
+
+      entry.task();
+
+      if (entry.counted) {
+        mCompleted.fetch_add(1, std::memory_order_relaxed);
+      }
+    }
+
+    void submit(Entry entry) {
+      // counted first, so a worker never sees it taken before it was queued
+      mQueued.fetch_add(1, std::memory_order_release);
+
+      if (tScope == this) {
+        auto &worker = *mWorkers[tWorker];
+        std::lock_guard<std::mutex> lk(worker.mutex);
+
+        worker.tasks.push_back(std::move(entry));
+      } else {
+        std::lock_guard<std::mutex> lk(mMutex);
+
+        mInjected.push_back(std::move(entry));
+      }
+
+      {
+        // pairs with the predicate check of a worker about to sleep
+        std::lock_guard<std::mutex> lk(mMutex);
+      }
+
+      mCondition.notify_one();
+    }
+
+    bool take(std::size_t index, Entry &entry) {
+      {
+        auto &worker = *mWorkers[index];
+        std::lock_guard<std::mutex> lk(worker.mutex);
+
+        if (!worker.tasks.empty()) {
+          entry = std::move(worker.tasks.back());
+
+          worker.tasks.pop_back();
+
+          return true;
+        }
+      }
+
+      {
+        std::lock_guard<std::mutex> lk(mMutex);
+
+        if (!mInjected.empty()) {
+          entry = std::move(mInjected.front());
+
+          mInjected.pop_front();
+
+          return true;
+        }
+      }
+
+      for (std::size_t i = 1; i < mWorkers.size(); i++) {
+        auto &victim = *mWorkers[(index + i) % mWorkers.size()];
+        std::lock_guard<std::mutex> lk(victim.mutex);
+
+        if (!victim.tasks.empty()) {
+          entry = std::move(victim.tasks.front());
+
+          victim.tasks.pop_front();
+
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    void run(std::size_t index) {
+      tScope = this;
+      tWorker = index;
+
+      while (!mStopped.load(std::memory_order_acquire)) {
+        Entry entry;
+
+        if (take(index, entry)) {
+          mQueued.fetch_sub(1, std::memory_order_relaxed);
+
+          execute(entry);
+
+          continue;
+        }
+
+        std::unique_lock<std::mutex> lk(mMutex);
+
+        mCondition.wait(lk, [&]() {
+          return mStopped.load(std::memory_order_acquire) or mQueued.load(std::memory_order_acquire) > 0;
+        });
+      }
+
+      tScope = nullptr;
+    }
+
+    /*
+      Runs the oldest task of a strand and hands the rest back to the pool, so
+      a busy key does not hold a worker.
+    */
+    void drain(std::size_t key) {
+      Entry entry;
+
+      {
+        std::lock_guard<std::mutex> lk(mStrandsMutex);
+
+        auto &strand = mStrands[key];
+
+        entry = std::move(strand.tasks.front());
+
+        strand.tasks.pop_front();
+      }
+
+      execute(entry);
+
+      bool more = false;
+
+      {
+        std::lock_guard<std::mutex> lk(mStrandsMutex);
+
+        if (auto it = mStrands.find(key); it != mStrands.end()) {
+          if (it->second.tasks.empty()) {
+            mStrands.erase(it);
+          } else {
+            more = true;
+          }
+        }
+      }
+
+      if (more) {
+        submit({Task{[this, key]() { drain(key); }}, {}, false});
+      }
+    }
   };
 }
 
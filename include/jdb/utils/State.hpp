@@ -34,7 +34,11 @@ namespace jdb {
       mCallback = callback;
     }
 
-    void notify(T const &data) { mCallback(data); }
+    void notify(T const &data) {
+      if (mCallback) {
+        mCallback(data);
+      }
+    }
 
   private:
     std::function<void(T const &)> mCallback;
@@ -56,7 +60,9 @@ namespace jdb {
 
       mData = data;
 
-      mCallback(data);
+      if (mCallback) {
+        mCallback(data);
+      }
     }
 
     std::optional<T> get() {
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace jdb {
+  /*
+    Move-only void() callable. Callables of up to InlineSize bytes that move
+    without throwing are kept in place, so posting them costs no allocation;
+    larger ones go to the heap. Unlike std::function it takes move-only
+    captures (unique_ptr, packaged_task, prepared statements).
+  */
+  struct Task {
+    static constexpr std::size_t InlineSize = 48;
+
+    Task() = default;
+
+    template<typename F> requires (!std::same_as<std::decay_t<F>, Task> and std::invocable<std::decay_t<F> &>)
+    Task(F &&callable) {
+      using T = std::decay_t<F>;
+
+      if constexpr (fits<T>()) {
+        ::new(static_cast<void *>(mStorage)) T(std::forward<F>(callable));
+
+        mOps = &InlineOps<T>;
+      } else {
+        ::new(static_cast<void *>(mStorage)) T *(new T(std::forward<F>(callable)));
+
+        mOps = &HeapOps<T>;
+      }
+    }
+
+    Task(Task &&other) noexcept {
+      if (other.mOps != nullptr) {
+        other.mOps->move(other.mStorage, mStorage);
+
+        mOps = std::exchange(other.mOps, nullptr);
+      }
+    }
+
+    Task &operator=(Task &&other) noexcept {
+      if (this != &other) {
+        reset();
+
+        if (other.mOps != nullptr) {
+          other.mOps->move(other.mStorage, mStorage);
+
+          mOps = std::exchange(other.mOps, nullptr);
+        }
+      }
+
+      return *this;
+    }
+
+    Task(Task const &) = delete;
+
+    Task &operator=(Task const &) = delete;
+
+    ~Task() {
+      reset();
+    }
+
+    void operator()() {
+      mOps->invoke(mStorage);
+    }
+
+    explicit operator bool() const {
+      return mOps != nullptr;
+    }
+
+    [[nodiscard]] bool is_inline() const {
+      return mOps != nullptr and mOps->local;
+    }
+
+  private:
+    struct Ops {
+      void (*invoke)(void *);
+      void (*move)(void *from, void *to) noexcept;
+      void (*destroy)(void *) noexcept;
+      bool local;
+    };
+
+    template<typename T>
+    static constexpr bool fits() {
+      return sizeof(T) <= InlineSize and alignof(T) <= alignof(std::max_align_t) and
+             std::is_nothrow_move_constructible_v<T>;
+    }
+
+    template<typename T>
+    static T *get(void *storage) {
+      return std::launder(static_cast<T *>(storage));
+    }
+
+    template<typename T>
+    static constexpr Ops InlineOps{
+      [](void *storage) { std::invoke(*get<T>(storage)); },
+      [](void *from, void *to) noexcept {
+        ::new(to) T(std::move(*get<T>(from)));
+
+        get<T>(from)->~T();
+      },
+      [](void *storage) noexcept { get<T>(storage)->~T(); },
+      true
+    };
+
+    template<typename T>
+    static constexpr Ops HeapOps{
+      [](void *storage) { std::invoke(**get<T *>(storage)); },
+      [](void *from, void *to) noexcept { ::new(to) T *(std::exchange(*get<T *>(from), nullptr)); },
+      [](void *storage) noexcept { delete *get<T *>(storage); },
+      false
+    };
+
+    alignas(std::max_align_t) std::byte mStorage[InlineSize];
+    Ops const *mOps{nullptr};
+
+    void reset() {
+      if (mOps != nullptr) {
+        mOps->destroy(mStorage);
+
+        mOps = nullptr;
+      }
+    }
+  };
+}
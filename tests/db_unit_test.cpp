@@ -2,11 +2,22 @@
 #include "jdb/database/DataClass.hpp"
 #include "jdb/database/Repository.hpp"
 #include "jdb/database/ExtendedModel.hpp"
+#include "jdb/database/ColumnKernels.hpp"
+#include "jdb/database/MemoryDatabase.hpp"
+#include "jdb/database/BinaryCodec.hpp"
+#include "jdb/database/JsonWriter.hpp"
+#include "jdb/database/LiveQuery.hpp"
+#include "jdb/database/BulkLoader.hpp"
+#include "jdb/database/TableExport.hpp"
+#include "jdb/database/ShardedDatabase.hpp"
 
 #include <fmt/format.h>
 #include <gtest/gtest.h>
 
 #include <iostream>
+#include <sstream>
+
+#include <zlib.h>
 
 using namespace jinject;
 using namespace jdb;
@@ -30,6 +41,19 @@ using SimpleModel = DataClass<"simple", NoPrimary, NoForeign,
   Field<"simple_id", FieldType::Serial, false>,
   Field<"simple_data", FieldType::Text, false>>;
 
+using CounterModel = DataClass<"counter", Primary<"id">, NoForeign,
+  Field<"id", FieldType::Serial, false>,
+  Field<"label", FieldType::Text, false>,
+  Field<"hits", FieldType::Int, false> >;
+
+using SettingModel = DataClass<"setting", Primary<"name">, NoForeign,
+  Field<"name", FieldType::Text, false>,
+  Field<"value", FieldType::Text, false> >;
+
+template<>
+struct jdb::MemoryPinned<SettingModel> : std::true_type {
+};
+
 using CompoundUser = CompoundModel<UserModel, LoginModel>;
 
 using UserModelRepository = Repository<UserModel>;
@@ -87,6 +111,30 @@ TEST_F(jDbSuite, SimpleMigration) {
       .build();
 }
 
+TEST_F(jDbSuite, SchemaFingerprint) {
+  using MyDatabase = SqliteDatabase<CounterModel>;
+
+  std::remove("fingerprint.db");
+
+  std::vector<int64_t> versions;
+
+  for (int i = 0; i < 2; i++) {
+    auto db = std::make_shared<MyDatabase>("fingerprint.db");
+
+    db->build();
+    db->query_string("PRAGMA user_version;", [&](auto const &columns, auto const &values) {
+      versions.push_back(values[0].get_int().value());
+
+      return false;
+    });
+  }
+
+  ASSERT_NE(versions[0], 0);
+  ASSERT_EQ(versions[0], versions[1]);
+
+  std::remove("fingerprint.db");
+}
+
 TEST_F(jDbSuite, SimpleConvertion) {
   UserModel model;
   std::string data;
@@ -156,6 +204,1128 @@ TEST_F(jDbSuite, DumpModel) {
             "{'user': {'id':1, 'name':'Jeff Ferr', 'address':'First District', 'description':'Some description'}, 'login': {'user_id':1, 'pass':'12345678'}}");
 }
 
+TEST_F(jDbSuite, DirtyFields) {
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+  Repository<CounterModel> repository{db};
+  CounterModel counter;
+
+  counter["label"] = "visits";
+  counter["hits"] = 0;
+
+  auto saved = repository.save(counter).value();
+
+  ASSERT_FALSE(saved.is_dirty());
+
+  // changed behind the model's back, must survive the update below
+  db->query_string("UPDATE counter SET label = 'renamed';", [](auto...) { return false; });
+
+  saved["hits"] = 1;
+
+  ASSERT_TRUE(saved.is_dirty("hits"));
+  ASSERT_FALSE(saved.is_dirty("label"));
+  ASSERT_FALSE(repository.update(saved).has_value());
+
+  auto loaded = repository.find(saved["id"].get_int().value()).value();
+
+  ASSERT_EQ(loaded["hits"], 1);
+  ASSERT_EQ(loaded["label"], "renamed");
+}
+
+TEST_F(jDbSuite, Upsert) {
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+  Repository<CounterModel> repository{db};
+  CounterModel counter;
+
+  counter["id"] = 1;
+  counter["label"] = "visits";
+  counter["hits"] = 1;
+
+  ASSERT_EQ(repository.upsave(counter).value()["hits"], 1);
+
+  counter["hits"] = 2;
+
+  ASSERT_EQ(repository.upsave(counter).value()["hits"], 2);
+
+  std::vector<CounterModel> counters;
+
+  for (int i = 1; i <= 4; i++) {
+    CounterModel item;
+
+    item["id"] = i;
+    item["label"] = fmt::format("counter {}", i);
+    item["hits"] = i * 10;
+
+    counters.push_back(item);
+  }
+
+  ASSERT_FALSE(repository.upsave_all(counters).has_value());
+  ASSERT_EQ(repository.load_all().size(), 4);
+  ASSERT_EQ(repository.find(1).value()["hits"], 10);
+}
+
+TEST_F(jDbSuite, ReadTransaction) {
+  std::remove("snapshot.db");
+
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >("snapshot.db");
+  Repository<CounterModel> repository{db};
+
+  db->write_transaction([&](Database &db) {
+    for (int i = 0; i < 10; i++) {
+      CounterModel counter;
+
+      counter["label"] = "snapshot";
+      counter["hits"] = i;
+
+      db.insert(counter);
+    }
+  });
+
+  db->read_transaction([&](Database &reader) {
+    Repository<CounterModel> snapshot{std::shared_ptr<Database>(&reader, [](auto *) {})};
+
+    ASSERT_EQ(snapshot.count_by<"label">("snapshot"), 10);
+
+    // committed after the snapshot started, so invisible to it
+    std::thread([&]() {
+      CounterModel counter;
+
+      counter["label"] = "snapshot";
+      counter["hits"] = 10;
+
+      ASSERT_TRUE(repository.save(counter).has_value());
+    }).join();
+
+    ASSERT_EQ(snapshot.load_all().size(), 10);
+    ASSERT_THROW(reader.write_transaction([](Database &) {}), std::runtime_error);
+  });
+
+  ASSERT_EQ(repository.load_all().size(), 11);
+
+  std::remove("snapshot.db");
+}
+
+TEST_F(jDbSuite, NestedTransaction) {
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+  Repository<CounterModel> repository{db};
+
+  auto make_counter = [](std::string const &label) {
+    CounterModel counter;
+
+    counter["label"] = label;
+    counter["hits"] = 0;
+
+    return counter;
+  };
+
+  db->transaction([&](Database &db) {
+    db.insert(make_counter("outer"));
+
+    try {
+      db.transaction([&](Database &db) {
+        db.insert(make_counter("failed"));
+
+        throw std::runtime_error("bad row");
+      });
+    } catch (std::runtime_error &) {
+    }
+
+    db.transaction([&](Database &db) {
+      db.insert(make_counter("retried"));
+    });
+  });
+
+  auto items = repository.load_all();
+
+  ASSERT_EQ(items.size(), 2);
+  ASSERT_EQ(items[0]["label"], "outer");
+  ASSERT_EQ(items[1]["label"], "retried");
+}
+
+TEST_F(jDbSuite, BusyRetry) {
+  using namespace std::chrono_literals;
+
+  std::remove("busy.db");
+
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >("busy.db", BusyPolicy{0ms, 50, 5ms, 20ms});
+  auto other = std::make_shared<SqliteDatabase<CounterModel> >("busy.db");
+  std::atomic<bool> locked{false};
+
+  std::thread holder([&]() {
+    other->write_transaction([&](Database &) {
+      locked = true;
+
+      std::this_thread::sleep_for(100ms);
+    });
+  });
+
+  while (!locked) {
+    std::this_thread::yield();
+  }
+
+  db->write_transaction([](Database &db) {
+    CounterModel counter;
+
+    counter["label"] = "busy";
+    counter["hits"] = 0;
+
+    db.insert(counter);
+  });
+
+  holder.join();
+
+  ASSERT_GT(db->get_busy_stats().retries, 0);
+  ASSERT_EQ(db->get_busy_stats().timeouts, 0);
+  ASSERT_EQ(Repository<CounterModel>{db}.load_all().size(), 1);
+
+  std::remove("busy.db");
+}
+
+TEST_F(jDbSuite, StatementMetrics) {
+  ASSERT_EQ(normalize_statement("INSERT INTO t (a, b) VALUES (1, \"x\"), (2, \"y\");"),
+            "INSERT INTO t (a, b) VALUES (?, ?);");
+  ASSERT_EQ(normalize_statement("SELECT * from t WHERE (text_1 = -1.5) AND (b LIKE '%it''s%')"),
+            "SELECT * from t WHERE (text_1 = ?) AND (b LIKE ?)");
+  ASSERT_EQ(normalize_statement("SELECT * FROM t WHERE ROWID IN (1, 2, 3) AND a = 'c:\\' AND b IN (4)"),
+            "SELECT * FROM t WHERE ROWID IN (?) AND a = ? AND b IN (?)");
+
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+  Repository<CounterModel> repository{db};
+
+  for (int i = 1; i <= 3; i++) {
+    CounterModel counter;
+
+    counter["label"] = "metrics";
+    counter["hits"] = i;
+
+    ASSERT_TRUE(repository.save(counter).has_value());
+    ASSERT_TRUE(repository.find(i).has_value());
+  }
+
+  auto stats = db->get_metrics().snapshot();
+  auto find = std::ranges::find_if(stats, [](auto const &item) {
+    return item.shape == "SELECT * from counter WHERE (id = ?) ORDER BY ROWID";
+  });
+
+  ASSERT_TRUE(find != stats.end());
+  ASSERT_EQ(find->calls, 3);
+  ASSERT_EQ(find->rows, 3);
+  ASSERT_GE(find->percentile(99), find->percentile(50));
+  ASSERT_NE(db->get_metrics().to_json().find("\"calls\":3"), std::string::npos);
+}
+
+TEST_F(jDbSuite, SlowQueryLog) {
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+  Repository<CounterModel> repository{db};
+  std::vector<SlowQuery> reports;
+
+  db->set_slow_query_log(SlowQueryPolicy{
+    .threshold = std::chrono::nanoseconds{1},
+    .sink = [&](SlowQuery const &query) { reports.push_back(query); }
+  });
+
+  for (int i = 0; i < 3; i++) {
+    repository.load_by<"hits">(i);
+  }
+
+  auto scan = std::ranges::find_if(reports, [](auto const &item) {
+    return item.shape == "SELECT * from counter WHERE (hits = ?) ORDER BY ROWID";
+  });
+
+  ASSERT_TRUE(scan != reports.end());
+  ASSERT_EQ(std::ranges::count(reports, scan->shape, &SlowQuery::shape), 1);
+  ASSERT_FALSE(scan->plan.empty());
+  ASSERT_NE(scan->plan[0].find("SCAN"), std::string::npos);
+
+  SlowQueryLog log{SlowQueryPolicy{.maxReports = 2, .maxShapes = 4}};
+  uint64_t suppressed = 0;
+
+  for (int i = 0; i < 100; i++) {
+    log.admit(fmt::format("shape {}", i), suppressed);
+  }
+
+  ASSERT_LE(log.size(), 4);
+}
+
+TEST_F(jDbSuite, ScanDetector) {
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+  Repository<CounterModel> repository{db};
+  std::vector<CounterModel> counters;
+
+  for (int i = 0; i < 20; i++) {
+    CounterModel counter;
+
+    counter["label"] = "scan";
+    counter["hits"] = i;
+
+    counters.push_back(counter);
+  }
+
+  repository.save_all(counters);
+
+  db->set_scan_detector(ScanPolicy{.minRows = 10});
+
+  ASSERT_TRUE(repository.find(1).has_value());
+  ASSERT_EQ(repository.load_all().size(), 20);
+  ASSERT_THROW(repository.load_by<"hits">(1), FullScanError);
+
+  db->query_string("CREATE INDEX counter_hits ON counter (hits);", [](auto...) { return false; });
+
+  ASSERT_EQ(repository.load_by<"hits">(1).size(), 1);
+}
+
+TEST_F(jDbSuite, ResultArena) {
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+  Repository<CounterModel> repository{db};
+  std::vector<CounterModel> counters;
+
+  for (int i = 0; i < 300; i++) {
+    CounterModel counter;
+
+    counter["label"] = fmt::format("arena {}", i);
+    counter["hits"] = i % 3;
+
+    counters.push_back(counter);
+  }
+
+  repository.save_all(counters);
+
+  ResultArena arena;
+
+  {
+    auto all = repository.load_all(arena);
+    auto some = repository.load_by<"hits">(arena, 1);
+    auto first = repository.select<"ORDER BY id", 10>(arena);
+
+    auto get_resource = [](Data const &value) {
+      std::pmr::memory_resource *resource = nullptr;
+
+      value.get_value(overloaded{
+        [&](std::pmr::string const &arg) { resource = arg.get_allocator().resource(); },
+        [](auto const &) {}
+      });
+
+      return resource;
+    };
+
+    // same cap of load_all()
+    ASSERT_EQ(all.size(), 100);
+    ASSERT_EQ(some.size(), 100);
+    ASSERT_EQ(first.size(), 10);
+    ASSERT_TRUE(all.get_allocator().resource() == arena.get_resource());
+    ASSERT_TRUE(get_resource(some[99]["label"]) == arena.get_resource());
+    ASSERT_EQ(all[99]["label"].get_text().value(), "arena 99");
+    ASSERT_FALSE(all[0].is_dirty());
+
+    CounterModel copy = some[0];
+
+    ASSERT_TRUE(get_resource(copy["label"]) == std::pmr::get_default_resource());
+  }
+
+  arena.release();
+
+  ASSERT_EQ(repository.load_by<"hits">(arena, 2).size(), 100);
+}
+
+TEST_F(jDbSuite, SelectColumns) {
+  using ReadingModel = DataClass<"reading", Primary<"id">, NoForeign,
+    Field<"id", FieldType::Serial, false>,
+    Field<"sensor", FieldType::Text, false>,
+    Field<"value", FieldType::Decimal, true>,
+    Field<"count", FieldType::Int, true> >;
+
+  auto db = std::make_shared<SqliteDatabase<ReadingModel> >(":memory:");
+  Repository<ReadingModel> repository{db};
+  std::vector<ReadingModel> readings;
+
+  for (int i = 0; i < 100; i++) {
+    ReadingModel reading;
+
+    reading["sensor"] = fmt::format("s{}", i);
+    reading["value"] = i % 10 == 0 ? Data{nullptr} : Data{i * 0.5};
+    reading["count"] = static_cast<int64_t>(i);
+
+    readings.push_back(reading);
+  }
+
+  repository.save_all(readings);
+
+  auto batch = repository.select_columns<"count", "value", "sensor">("WHERE count >= {} ORDER BY id", 50);
+
+  auto const &count = batch.get<"count">();
+  auto const &value = batch.get<"value">();
+  auto const &sensor = batch.get<"sensor">();
+
+  ASSERT_EQ(batch.size(), 50);
+  ASSERT_EQ(count.values.front(), 50);
+  ASSERT_EQ(count.values.back(), 99);
+  ASSERT_EQ(value.validity.null_count(), 5);
+  ASSERT_TRUE(value.validity.is_null(0));
+  ASSERT_DOUBLE_EQ(value[1], 25.5);
+  ASSERT_EQ(sensor[3], "s53");
+  ASSERT_EQ(sensor.bytes.size(), 150);
+}
+
+TEST_F(jDbSuite, ColumnKernels) {
+  IntColumn amount;
+  DecimalColumn price;
+  int64_t sum = 0, low = 0, high = 0;
+  std::size_t less = 0, above = 0;
+  std::vector<uint64_t> buckets(5);
+
+  // 1000 rows: whole blocks with and without nulls, plus a tail
+  for (int64_t i = 0; i < 1000; i++) {
+    if (i % 7 == 0 or (i >= 128 and i < 192)) {
+      amount.push_back(Data{nullptr});
+      price.push_back(Data{nullptr});
+
+      continue;
+    }
+
+    amount.push_back(Data{(i * 37) % 500 - 100});
+    price.push_back(Data{static_cast<double>(i) * 0.5});
+
+    int64_t value = (i * 37) % 500 - 100;
+
+    sum += value;
+    low = std::min(low, value);
+    high = std::max(high, value);
+    less += value < 0;
+    above += i * 0.5 >= 490.0;
+    buckets[i / 200]++;
+  }
+
+  for (auto level: {SimdLevel::Scalar, SimdLevel::Portable, SimdLevel::Avx2, SimdLevel::Avx512}) {
+    ColumnKernels::set_level(level);
+
+    ASSERT_EQ(ColumnKernels::sum(amount), sum);
+    ASSERT_EQ(ColumnKernels::min(amount).value(), low);
+    ASSERT_EQ(ColumnKernels::max(amount).value(), high);
+    ASSERT_DOUBLE_EQ(ColumnKernels::max(price).value(), 499.5);
+    ASSERT_EQ(ColumnKernels::count_if(amount, Compare::Less, int64_t{0}), less);
+
+    auto selection = ColumnKernels::filter(price, Compare::GreaterEqual, 490.0);
+
+    ASSERT_EQ(selection.size(), above);
+    ASSERT_EQ(selection.front(), 981);
+    ASSERT_TRUE(ColumnKernels::histogram(price, 0.0, 500.0, 5) == buckets);
+  }
+
+  ColumnKernels::set_level(ColumnKernels::get_supported_level());
+
+  ASSERT_FALSE(ColumnKernels::min(IntColumn{}).has_value());
+}
+
+TEST_F(jDbSuite, MemoryDatabase) {
+  auto db = std::make_shared<MemoryDatabase<CounterModel> >();
+  Repository<CounterModel> repository{db};
+
+  db->add_index<CounterModel, "hits">(IndexType::Ordered);
+
+  for (int i = 0; i < 10; i++) {
+    CounterModel counter;
+
+    counter["label"] = fmt::format("Memory {}", i);
+    counter["hits"] = i % 3;
+
+    ASSERT_TRUE(repository.save(counter).has_value());
+  }
+
+  ASSERT_EQ(repository.load_by<"hits">(1).size(), 3);
+  ASSERT_EQ(repository.load_by<"label">("memory 7").size(), 1);
+  auto between = db->load_between<CounterModel, "hits">(1, 2);
+
+  ASSERT_EQ(between.size(), 6);
+  ASSERT_EQ(db->find<CounterModel>(4).value()["label"].get_text().value(), "Memory 3");
+
+  auto counter = repository.find(4).value();
+
+  counter["hits"] = 42;
+
+  repository.update(counter);
+
+  // statements see the typed changes and the other way around
+  ASSERT_EQ(repository.count_by<"hits">(42), 1);
+
+  db->query_string("UPDATE counter SET hits = 7 WHERE id = 5;", [](auto...) { return false; });
+
+  ASSERT_EQ(repository.find(5).value()["hits"].get_int().value(), 7);
+  ASSERT_EQ(repository.load_by<"hits">(7).size(), 1);
+
+  ASSERT_THROW(db->transaction([&](Database &db) {
+    db.remove(db.find_by_rowid<CounterModel>(6).value());
+
+    throw std::runtime_error("rollback");
+  }), std::runtime_error);
+
+  ASSERT_TRUE(repository.find(6).has_value());
+  ASSERT_EQ(repository.load_all().size(), 10);
+}
+
+TEST_F(jDbSuite, BackupTo) {
+  std::remove("backup.db");
+
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+  Repository<CounterModel> repository{db};
+
+  db->transaction([&](Database &) {
+    for (int i = 0; i < 2000; i++) {
+      CounterModel counter;
+
+      counter["label"] = fmt::format("Backup {:0>64}", i);
+      counter["hits"] = i;
+
+      ASSERT_TRUE(repository.save(counter).has_value());
+    }
+  });
+
+  std::vector<BackupProgress> reports;
+  auto job = db->backup_to("backup.db", 8, std::chrono::milliseconds{0}, [&](auto const &progress) {
+    reports.push_back(progress);
+  });
+
+  // foreground writes keep going while the copy runs
+  CounterModel late;
+
+  late["label"] = "late";
+  late["hits"] = -1;
+
+  ASSERT_TRUE(repository.save(late).has_value());
+
+  job->wait();
+
+  ASSERT_GT(reports.size(), 1);
+  ASSERT_TRUE(reports.back().done);
+  ASSERT_EQ(reports.back().remaining, 0);
+  ASSERT_EQ(job->get_progress().get_ratio(), 1.0);
+
+  auto copy = std::make_shared<SqliteDatabase<CounterModel> >("backup.db");
+
+  ASSERT_EQ(Repository<CounterModel>{copy}.count_by<"label">("Backup %"), 2000);
+  ASSERT_EQ(Repository<CounterModel>{copy}.load_by<"label">("late").size(), 1);
+
+  auto cancelled = db->backup_to("cancelled.db", 1, std::chrono::milliseconds{5});
+
+  cancelled->cancel();
+
+  ASSERT_THROW(cancelled->wait(), std::runtime_error);
+  ASSERT_FALSE(std::filesystem::exists("cancelled.db"));
+  ASSERT_FALSE(std::filesystem::exists("cancelled.db.partial"));
+
+  copy.reset();
+
+  std::remove("backup.db");
+}
+
+TEST_F(jDbSuite, BinaryCodec) {
+  using NullableModel = DataClass<"nullable", NoPrimary, NoForeign,
+    Field<"amount", FieldType::Decimal>,
+    Field<"note", FieldType::Text> >;
+
+  std::vector<CounterModel> counters;
+
+  for (int i = 0; i < 3; i++) {
+    CounterModel counter;
+
+    counter["id"] = i + 1;
+    counter["label"] = fmt::format("Codec {}", i);
+    counter["hits"] = -1000 * i;
+
+    counters.push_back(counter);
+  }
+
+  std::string buffer = BinaryCodec<CounterModel>::encode(counters);
+  auto decoded = BinaryCodec<CounterModel>::decode_all(buffer);
+
+  ASSERT_EQ(decoded.size(), 3);
+  ASSERT_FALSE(decoded[2].is_dirty());
+  ASSERT_EQ(decoded[2]["hits"], -2000);
+  ASSERT_EQ(decoded[2]["label"], "Codec 2");
+
+  BinaryReader<CounterModel> reader{buffer};
+  std::vector<std::string_view> labels;
+
+  while (reader.next()) {
+    labels.push_back(reader.get_text("label").value());
+  }
+
+  ASSERT_EQ(labels.back(), "Codec 2");
+  ASSERT_TRUE(labels.back().data() >= buffer.data() and labels.back().data() < buffer.data() + buffer.size());
+
+  NullableModel nullable;
+
+  nullable["amount"] = 2;
+  nullable["note"] = nullptr;
+
+  auto copy = BinaryCodec<NullableModel>::decode(BinaryCodec<NullableModel>::encode(nullable));
+
+  ASSERT_EQ(copy["amount"].get_decimal().value(), 2.0);
+  ASSERT_TRUE(copy["note"].is_null());
+
+  ASSERT_THROW(BinaryCodec<NullableModel>::decode(buffer), std::runtime_error);
+  ASSERT_THROW(BinaryCodec<CounterModel>::decode_all(buffer.substr(0, buffer.size() - 1)), std::runtime_error);
+
+  nullable["note"] = 1;
+
+  ASSERT_THROW(BinaryCodec<NullableModel>::encode(nullable), std::runtime_error);
+}
+
+TEST_F(jDbSuite, JsonFormat) {
+  using FlagModel = DataClass<"flag", NoPrimary, NoForeign,
+    Field<"name", FieldType::Text>,
+    Field<"enabled", FieldType::Bool>,
+    Field<"ratio", FieldType::Decimal> >;
+
+  FlagModel flag;
+
+  flag["name"] = "say \"hi\"\n\x01";
+  flag["enabled"] = 1;
+  flag["ratio"] = nullptr;
+
+  ASSERT_EQ(flag.to_json(), R"({"name":"say \"hi\"\n\u0001","enabled":true,"ratio":null})");
+  ASSERT_EQ(fmt::format("{:j}", flag), flag.to_json());
+  ASSERT_EQ(fmt::format("{}", flag), flag.to_string());
+
+  flag["name"] = "it's";
+  flag["ratio"] = 0.5;
+
+  ASSERT_EQ(flag.to_string(), R"({'name':'it\'s', 'enabled':1, 'ratio':0.5})");
+
+  std::string out;
+  JsonWriter writer{[&](std::string_view chunk) { out += chunk; }, 16};
+
+  writer.write_all(std::vector<FlagModel>{flag, FlagModel{}});
+  writer.close();
+
+  ASSERT_EQ(writer.size(), 2);
+  ASSERT_EQ(out, R"([{"name":"it's","enabled":true,"ratio":0.5},{}])");
+}
+
+TEST_F(jDbSuite, ChangeFeed) {
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+  Repository<CounterModel> repository{db};
+  std::vector<ChangeSet> batches;
+  std::vector<ChangeSet> counterBatches;
+
+  uint64_t id = db->get_change_feed().subscribe([&](ChangeSet const &changes) {
+    batches.push_back(changes);
+  });
+
+  db->get_change_feed().get_state<CounterModel>().observe([&](ChangeSet const &changes) {
+    counterBatches.push_back(changes);
+  });
+
+  auto make_counter = [](std::string const &label) {
+    CounterModel counter;
+
+    counter["label"] = label;
+    counter["hits"] = 0;
+
+    return counter;
+  };
+
+  db->transaction([&](Database &) {
+    ASSERT_TRUE(repository.save(make_counter("first")).has_value());
+
+    try {
+      db->transaction([&](Database &) {
+        ASSERT_TRUE(repository.save(make_counter("discarded")).has_value());
+
+        throw std::runtime_error("inner failure");
+      });
+    } catch (std::runtime_error &) {
+    }
+
+    ASSERT_TRUE(repository.save(make_counter("second")).has_value());
+  });
+
+  ASSERT_EQ(batches.size(), 1);
+  ASSERT_TRUE(batches[0] == (ChangeSet{{ChangeOperation::Insert, "counter", 1}, {ChangeOperation::Insert, "counter", 2}}));
+
+  ASSERT_THROW(db->transaction([&](Database &) {
+    ASSERT_TRUE(repository.save(make_counter("rolled back")).has_value());
+
+    throw std::runtime_error("outer failure");
+  }), std::runtime_error);
+
+  ASSERT_EQ(batches.size(), 1);
+
+  db->query_string("UPDATE counter SET hits = 1 WHERE id = 1;", [](auto...) { return false; });
+
+  ASSERT_EQ(batches.size(), 2);
+  ASSERT_TRUE(batches[1] == (ChangeSet{{ChangeOperation::Update, "counter", 1}}));
+  ASSERT_EQ(counterBatches.size(), 2);
+
+  db->get_change_feed().unsubscribe(id);
+  db->query_string("DELETE FROM counter WHERE id = 2;", [](auto...) { return false; });
+
+  ASSERT_EQ(batches.size(), 2);
+  ASSERT_TRUE(counterBatches.back() == (ChangeSet{{ChangeOperation::Delete, "counter", 2}}));
+
+  // the write is committed, a failing observer must not turn it into an error
+  std::vector<std::string> errors;
+  std::size_t delivered = 0;
+
+  db->get_change_feed().set_error_handler([&](std::exception_ptr error) {
+    try {
+      std::rethrow_exception(error);
+    } catch (std::exception const &e) {
+      errors.emplace_back(e.what());
+    }
+  });
+
+  auto failing = db->get_change_feed().subscribe([](ChangeSet const &) {
+    throw std::runtime_error("observer failure");
+  });
+  auto counting = db->get_change_feed().subscribe([&](ChangeSet const &) { delivered++; });
+
+  ASSERT_NO_THROW(db->transaction([&](Database &) {
+    ASSERT_TRUE(repository.save(make_counter("observed")).has_value());
+  }));
+
+  ASSERT_EQ(delivered, 1);
+  ASSERT_EQ(errors, std::vector<std::string>{"observer failure"});
+  ASSERT_EQ(db->get_change_feed().get_failures(), 1);
+  ASSERT_EQ(repository.load_by<"label">("observed").size(), 1);
+
+  db->get_change_feed().unsubscribe(failing);
+  db->get_change_feed().unsubscribe(counting);
+}
+
+TEST_F(jDbSuite, LiveQuery) {
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+  Repository<CounterModel> repository{db};
+
+  for (int i = 0; i < 4; i++) {
+    CounterModel counter;
+
+    counter["label"] = fmt::format("Live {}", i);
+    counter["hits"] = i;
+
+    ASSERT_TRUE(repository.save(counter).has_value());
+  }
+
+  LiveQuery<CounterModel> query{db, "hits >= 2"};
+  std::vector<ResultDiff<CounterModel> > diffs;
+
+  query.observe([&](ResultDiff<CounterModel> const &diff) {
+    diffs.push_back(diff);
+  });
+
+  ASSERT_EQ(query.size(), 2);
+
+  db->transaction([&](Database &) {
+    db->query_string("UPDATE counter SET hits = 5 WHERE id = 1;", [](auto...) { return false; });
+    db->query_string("UPDATE counter SET hits = 0 WHERE id = 3;", [](auto...) { return false; });
+    db->query_string("UPDATE counter SET label = 'Renamed' WHERE id = 4;", [](auto...) { return false; });
+    // still outside of the result
+    db->query_string("UPDATE counter SET hits = 1 WHERE id = 2;", [](auto...) { return false; });
+  });
+
+  ASSERT_EQ(diffs.size(), 1);
+  ASSERT_EQ(diffs[0].size(), 3);
+  ASSERT_TRUE(diffs[0][0].operation == ChangeOperation::Insert);
+  ASSERT_EQ(diffs[0][0].rowId, 1);
+  ASSERT_TRUE(diffs[0][1].operation == ChangeOperation::Delete);
+  ASSERT_EQ(diffs[0][1].row["label"], "Live 2");
+  ASSERT_TRUE(diffs[0][2].operation == ChangeOperation::Update);
+  ASSERT_EQ(diffs[0][2].row["label"], "Renamed");
+
+  ASSERT_FALSE(repository.remove(repository.find(4).value()).has_value());
+
+  ASSERT_EQ(diffs.size(), 2);
+  ASSERT_TRUE(diffs[1][0].operation == ChangeOperation::Delete);
+
+  auto rows = query.get_rows();
+
+  ASSERT_EQ(rows.size(), 1);
+  ASSERT_EQ(rows[0]["hits"], 5);
+}
+
+TEST_F(jDbSuite, BulkLoader) {
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+  Repository<CounterModel> repository{db};
+
+  db->query_string("CREATE INDEX counter_hits ON counter (hits);", [](auto...) { return false; });
+
+  std::string csv = "hits,label\r\n";
+
+  for (int i = 0; i < 100; i++) {
+    csv += fmt::format("{},Row {}\r\n", i, i);
+  }
+
+  csv += "7,\"Quoted, \"\"with\"\"\nbreak\"\n";
+
+  BulkLoader<CounterModel> loader{repository, {.threads = 2, .chunkSize = 64, .rowsPerTransaction = 30, .deferIndexes = true}};
+  auto stats = loader.load(csv);
+
+  ASSERT_EQ(stats.rows, 101);
+  ASSERT_GT(stats.chunks, 1);
+  ASSERT_GE(stats.transactions, 4);
+  ASSERT_EQ(repository.count_by<"hits">(7), 2);
+
+  auto quoted = repository.load_by<"id">(101);
+
+  ASSERT_EQ(quoted.size(), 1);
+  ASSERT_EQ(quoted[0]["label"], "Quoted, \"with\"\nbreak");
+
+  int64_t indexes = 0;
+
+  db->query_string("SELECT COUNT(*) FROM sqlite_master WHERE name = 'counter_hits';",
+                   [&](auto const &, std::vector<Data> const &values) {
+                     indexes = values[0].get_int().value();
+
+                     return false;
+                   });
+
+  ASSERT_EQ(indexes, 1);
+
+  BulkLoader<CounterModel> json{db, {.format = ImportFormat::Ndjson}};
+
+  stats = json.load("{\"label\": \"caf\\u00e9 \\\"bar\\\"\", \"hits\": 500}\n\n{\"hits\":501,\"label\":\"x\"}\n");
+
+  ASSERT_EQ(stats.rows, 2);
+  ASSERT_EQ(repository.load_by<"hits">(500)[0]["label"], "caf\u00e9 \"bar\"");
+
+  try {
+    json.load("{\"label\": \"ok\", \"hits\": 1}\n{\"label\": \"bad\", \"hits\": \"many\"}\n");
+
+    FAIL() << "expected an ImportError";
+  } catch (ImportError const &e) {
+    ASSERT_EQ(e.get_offset(), 27);
+  }
+
+  ASSERT_THROW(loader.load("label\nmissing hits\n"), ImportError);
+}
+
+TEST_F(jDbSuite, TableExport) {
+  auto db = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+  Repository<CounterModel> repository{db};
+  std::vector<CounterModel> counters;
+
+  for (int i = 0; i < 2000; i++) {
+    CounterModel counter;
+
+    counter["label"] = i == 0 ? std::string{"a \"b\", c"} : fmt::format("Export {}", i);
+    counter["hits"] = i;
+
+    counters.push_back(counter);
+  }
+
+  repository.save_all(counters);
+
+  std::ostringstream csv;
+  auto stats = export_table<CounterModel>(*db, csv, ExportFormat::Csv, {.where = "hits < 2"});
+
+  ASSERT_EQ(stats.rows, 2);
+  ASSERT_EQ(csv.str(), "id,label,hits\n1,\"a \"\"b\"\", c\",0\n2,Export 1,1\n");
+
+  std::ostringstream json;
+
+  export_table<CounterModel>(*db, json, ExportFormat::Ndjson, {.where = "hits = 0"});
+
+  ASSERT_EQ(json.str(), "{\"id\":1,\"label\":\"a \\\"b\\\", c\",\"hits\":0}\n");
+
+  auto gunzip = [](std::string const &data) {
+    std::string result;
+    z_stream stream{};
+    char out[4096];
+
+    inflateInit2(&stream, 15 + 32);
+
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+
+    while (stream.avail_in > 0) {
+      stream.next_out = reinterpret_cast<Bytef *>(out);
+      stream.avail_out = sizeof(out);
+
+      int status = inflate(&stream, Z_NO_FLUSH);
+
+      result.append(out, sizeof(out) - stream.avail_out);
+
+      if (status == Z_STREAM_END) {
+        inflateReset(&stream);
+      } else if (status != Z_OK) {
+        break;
+      }
+    }
+
+    inflateEnd(&stream);
+
+    return result;
+  };
+
+  std::ostringstream plain;
+
+  export_table<CounterModel>(*db, plain, ExportFormat::Csv);
+
+  for (std::size_t threads: {1, 4}) {
+    std::ostringstream compressed;
+
+    stats = export_table<CounterModel>(*db, compressed, ExportFormat::Csv, {
+                                         .compression = ExportCompression::Gzip, .threads = threads, .blockSize = 4096
+                                       });
+
+    ASSERT_EQ(stats.rows, 2000);
+    ASSERT_EQ(stats.bytes, plain.str().size());
+    ASSERT_LT(stats.written, stats.bytes);
+    ASSERT_EQ(gunzip(compressed.str()), plain.str());
+  }
+
+  auto copy = std::make_shared<SqliteDatabase<CounterModel> >(":memory:");
+
+  ASSERT_EQ(BulkLoader<CounterModel>{copy}.load(plain.str()).rows, 2000);
+  ASSERT_EQ(Repository<CounterModel>{copy}.find(1).value()["label"], "a \"b\", c");
+}
+
+TEST_F(jDbSuite, ShardedDatabase) {
+  auto db = std::make_shared<ShardedDatabase<CounterModel> >(":memory:", 4);
+  Repository<CounterModel> repository{db};
+
+  for (int i = 0; i < 40; i++) {
+    CounterModel counter;
+
+    counter["label"] = fmt::format("Shard {}", i);
+    counter["hits"] = i % 10;
+
+    auto saved = repository.save(counter);
+
+    ASSERT_TRUE(saved.has_value());
+    ASSERT_EQ(saved.value()["id"], i + 1);
+  }
+
+  int64_t rows = 0;
+
+  for (std::size_t i = 0; i < db->get_shard_count(); i++) {
+    int64_t count = 0;
+
+    db->get_shard(i).query_string("SELECT COUNT(*) FROM counter;", [&](auto const &, std::vector<Data> const &values) {
+      count = values[0].get_int().value();
+
+      return false;
+    });
+
+    ASSERT_GT(count, 0);
+
+    rows += count;
+  }
+
+  ASSERT_EQ(rows, 40);
+
+  ASSERT_EQ(repository.count_by<"hits">(3), 4);
+  ASSERT_EQ(repository.find(7).value()["label"], "Shard 6");
+
+  auto top = repository.select<"ORDER BY hits DESC, id LIMIT 3 OFFSET 1">();
+
+  ASSERT_EQ(top.size(), 3);
+  ASSERT_EQ(top[0]["id"], 20);
+  ASSERT_EQ(top[1]["id"], 30);
+  ASSERT_EQ(top[2]["id"], 40);
+
+  std::vector<int64_t> ids;
+
+  db->query_string("SELECT id, hits AS h FROM counter ORDER BY h DESC, id LIMIT 3 OFFSET 1;",
+                   [&](auto const &, std::vector<Data> const &values) {
+                     ids.push_back(values[0].get_int().value());
+
+                     return true;
+                   });
+
+  ASSERT_EQ(ids, (std::vector<int64_t>{20, 30, 40}));
+
+  ids.clear();
+
+  db->query_string("SELECT *, hits AS \"h\" FROM counter ORDER BY H DESC, id LIMIT 1 OFFSET 1;",
+                   [&](auto const &, std::vector<Data> const &values) {
+                     ids.push_back(values[0].get_int().value());
+
+                     return true;
+                   });
+
+  ASSERT_EQ(ids, (std::vector<int64_t>{20}));
+  ASSERT_THROW(db->query_string("SELECT label FROM counter ORDER BY label COLLATE NOCASE;", [](auto...) { return true; }),
+               std::runtime_error);
+
+  auto all = repository.load_all();
+
+  ASSERT_EQ(all.size(), 40);
+  ASSERT_TRUE(std::ranges::is_sorted(all, [](auto const &a, auto const &b) {
+    return a["id"].get_int().value() < b["id"].get_int().value();
+  }));
+
+  int64_t total = 0;
+
+  db->query_string("SELECT SUM(hits), MAX(label) AS last FROM counter;",
+                   [&](auto const &, std::vector<Data> const &values) {
+                     total = values[0].get_int().value();
+
+                     return false;
+                   });
+
+  ASSERT_EQ(total, 180);
+
+  std::vector<CounterModel> batch;
+
+  for (int i = 0; i < 100; i++) {
+    CounterModel counter;
+
+    counter["label"] = "Batch";
+    counter["hits"] = 100;
+
+    batch.push_back(counter);
+  }
+
+  db->insert_all(batch);
+
+  ASSERT_EQ(repository.count_by<"hits">(100), 100);
+  ASSERT_EQ(repository.find(140).value()["label"], "Batch");
+
+  try {
+    db->transaction([&](Database &) {
+      for (int i = 0; i < 8; i++) {
+        CounterModel counter;
+
+        counter["label"] = "Discarded";
+        counter["hits"] = 200;
+
+        ASSERT_TRUE(repository.save(counter).has_value());
+      }
+
+      throw std::runtime_error("rollback");
+    });
+  } catch (std::runtime_error const &) {
+  }
+
+  ASSERT_EQ(repository.count_by<"hits">(200), 0);
+
+  db->query_string("UPDATE counter SET hits = 0 WHERE hits = 100;", [](auto...) { return false; });
+
+  ASSERT_EQ(repository.count_by<"hits">(0), 104);
+  ASSERT_THROW(db->query_string("SELECT hits, COUNT(*) FROM counter GROUP BY hits;", [](auto...) { return true; }),
+               std::runtime_error);
+
+  using PriceModel = DataClass<"price", Primary<"code">, NoForeign,
+    Field<"code", FieldType::Decimal, false>,
+    Field<"label", FieldType::Text, false> >;
+
+  auto prices = std::make_shared<ShardedDatabase<PriceModel> >(":memory:", 4);
+  Repository<PriceModel> priceRepository{prices};
+
+  for (int i = 1; i <= 8; i++) {
+    PriceModel price;
+
+    price["code"] = static_cast<double>(i);
+    price["label"] = "Initial";
+
+    ASSERT_TRUE(priceRepository.save(price).has_value());
+  }
+
+  // integer keys route to the shard their decimal value went to
+  for (int i = 1; i <= 8; i++) {
+    ASSERT_EQ(priceRepository.find(i).value()["code"], static_cast<double>(i));
+  }
+
+  auto price = priceRepository.find(5).value();
+
+  price["label"] = "Updated";
+
+  ASSERT_FALSE(priceRepository.update(price).has_value());
+  ASSERT_EQ(priceRepository.find(5).value()["label"], "Updated");
+  ASSERT_EQ(priceRepository.load_by<"code">(5).size(), 1);
+  ASSERT_FALSE(priceRepository.remove(price).has_value());
+  ASSERT_FALSE(priceRepository.find(5).has_value());
+  ASSERT_EQ(priceRepository.load_all().size(), 7);
+}
+
+TEST_F(jDbSuite, MemoryPinned) {
+  std::filesystem::remove("pinned.db");
+  std::filesystem::remove("pinned.db-wal");
+  std::filesystem::remove("pinned.db-shm");
+
+  using MyDatabase = SqliteDatabase<SettingModel, CounterModel>;
+
+  auto db = std::make_shared<MyDatabase>("pinned.db");
+  Repository<SettingModel> settings{db};
+
+  auto read_setting = [&](std::string const &table, std::string const &name) {
+    std::string value;
+
+    db->read_transaction([&](Database &reader) {
+      reader.query_string(fmt::format("SELECT value FROM {} WHERE name = '{}';", table, name),
+                          [&](auto const &, std::vector<Data> const &values) {
+                            value = values[0].get_text().value();
+
+                            return false;
+                          });
+    });
+
+    return value;
+  };
+
+  SettingModel setting;
+
+  setting["name"] = "theme";
+  setting["value"] = "dark";
+
+  ASSERT_TRUE(settings.save(setting).has_value());
+
+  // served from the temp copy, the file table is only read to load it
+  ASSERT_EQ(read_setting("temp.setting", "theme"), "dark");
+  ASSERT_EQ(read_setting("setting", "theme"), "dark");
+  ASSERT_EQ(db->get_pinned_loads(), 1);
+
+  CounterModel counter;
+
+  counter["label"] = "Unpinned";
+  counter["hits"] = 1;
+
+  ASSERT_TRUE(Repository<CounterModel>{db}.save(counter).has_value());
+
+  // writes to other tables leave the copies alone
+  ASSERT_EQ(read_setting("setting", "theme"), "dark");
+  ASSERT_EQ(db->get_pinned_loads(), 1);
+
+  db->query_string("UPDATE setting SET value = 'light' WHERE name = 'theme';", [](auto...) { return false; });
+
+  ASSERT_EQ(read_setting("setting", "theme"), "light");
+  ASSERT_EQ(db->get_pinned_loads(), 2);
+
+  // writes from another connection bump the version as well
+  auto other = std::make_shared<MyDatabase>("pinned.db");
+
+  other->query_string("UPDATE setting SET value = 'sepia' WHERE name = 'theme';", [](auto...) { return false; });
+
+  // typed reads are served from the copies
+  ASSERT_EQ(settings.find(std::string{"theme"}).value()["value"], "sepia");
+  ASSERT_EQ(db->get_pinned_loads(), 3);
+
+  other->query_string("UPDATE setting SET value = 'light' WHERE name = 'theme';", [](auto...) { return false; });
+  other.reset();
+
+  try {
+    db->write_transaction([&](Database &writer) {
+      writer.query_string("UPDATE setting SET value = 'blue' WHERE name = 'theme';", [](auto...) { return false; });
+
+      throw std::runtime_error("rollback");
+    });
+  } catch (std::runtime_error const &) {
+  }
+
+  ASSERT_EQ(read_setting("setting", "theme"), "light");
+
+  db.reset();
+  db = std::make_shared<MyDatabase>("pinned.db");
+
+  ASSERT_EQ(read_setting("main.setting", "theme"), "light");
+  ASSERT_EQ(read_setting("temp.setting", "theme"), "light");
+
+  db.reset();
+
+  std::filesystem::remove("pinned.db");
+  std::filesystem::remove("pinned.db-wal");
+  std::filesystem::remove("pinned.db-shm");
+}
+
 int main(int argc, char *argv[]) {
   ::testing::InitGoogleTest(&argc, argv);
 
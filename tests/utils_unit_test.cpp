@@ -49,6 +49,152 @@ TEST_F(jDbSuite, PostAndReturn) {
   });
 }
 
+TEST_F(jDbSuite, ParallelPost) {
+  Scope scope(4);
+  std::atomic<int> arrived{0};
+  std::vector<std::future<int> > results;
+
+  // would never finish if the tasks ran one at a time
+  for (int i = 0; i < 4; i++) {
+    results.push_back(scope.post([&arrived, i]() {
+      arrived++;
+
+      while (arrived < 4) {
+        std::this_thread::yield();
+      }
+
+      return i * i;
+    }));
+  }
+
+  int sum = 0;
+
+  for (auto &result: results) {
+    sum += result.get();
+  }
+
+  ASSERT_EQ(sum, 14);
+
+  auto failure = scope.post([]() { throw std::runtime_error("task failure"); });
+
+  ASSERT_THROW(failure.get(), std::runtime_error);
+}
+
+TEST_F(jDbSuite, OrderedPost) {
+  Scope scope(4);
+  std::vector<int> first;
+  std::vector<int> second;
+  std::vector<std::future<void> > results;
+
+  for (int i = 0; i < 100; i++) {
+    results.push_back(scope.post_ordered(1, [&first, i]() { first.push_back(i); }));
+    results.push_back(scope.post_ordered(2, [&second, i]() { second.push_back(i); }));
+  }
+
+  for (auto &result: results) {
+    result.get();
+  }
+
+  ASSERT_EQ(first.size(), 100);
+  ASSERT_TRUE(std::is_sorted(first.begin(), first.end()));
+  ASSERT_TRUE(std::is_sorted(second.begin(), second.end()));
+
+  // nested posts land on the worker deque and may be stolen by the others
+  auto nested = scope.post([&scope]() {
+    std::vector<std::future<int> > inner;
+
+    for (int i = 0; i < 64; i++) {
+      inner.push_back(scope.post([i]() { return i; }));
+    }
+
+    int total = 0;
+
+    for (auto &item: inner) {
+      total += item.get();
+    }
+
+    return total;
+  });
+
+  ASSERT_EQ(nested.get(), 2016);
+}
+
+TEST_F(jDbSuite, MoveOnlyTask) {
+  auto value = std::make_unique<int>(7);
+  int result = 0;
+  Task small{[value = std::move(value), &result]() { result = *value; }};
+  std::array<char, 256> payload{};
+  Task large{[payload, &result]() { result = static_cast<int>(payload.size()); }};
+
+  ASSERT_TRUE(small.is_inline());
+  ASSERT_FALSE(large.is_inline());
+
+  Task moved = std::move(small);
+
+  ASSERT_FALSE(small);
+
+  moved();
+
+  ASSERT_EQ(result, 7);
+
+  large();
+
+  ASSERT_EQ(result, 256);
+
+  Scope scope(2);
+  auto row = std::make_unique<std::string>("row");
+
+  ASSERT_EQ(scope.post([row = std::move(row)]() { return *row; }).get(), "row");
+}
+
+TEST_F(jDbSuite, BoundedQueue) {
+  std::promise<void> release;
+  std::shared_future<void> gate = release.get_future().share();
+
+  {
+    Scope scope(1, {2, QueueOverflow::Reject});
+
+    scope.post_detached([gate]() { gate.wait(); });
+
+    // the worker may not have taken the first task yet
+    while (scope.get_stats().queued > 0) {
+      std::this_thread::yield();
+    }
+
+    scope.post_detached([]() { });
+    scope.post_detached([]() { });
+
+    ASSERT_THROW(scope.post_detached([]() { }), QueueFullError);
+
+    auto stats = scope.get_stats();
+
+    ASSERT_EQ(stats.queued, 2);
+    ASSERT_EQ(stats.maxQueued, 2);
+    ASSERT_EQ(stats.rejected, 1);
+
+    release.set_value();
+  }
+
+  Scope scope(1, {1, QueueOverflow::RunInline});
+  std::promise<void> block;
+  std::shared_future<void> wait = block.get_future().share();
+
+  scope.post_detached([wait]() { wait.wait(); });
+
+  while (scope.get_stats().queued > 0) {
+    std::this_thread::yield();
+  }
+
+  scope.post_detached([]() { });
+
+  auto caller = std::this_thread::get_id();
+
+  ASSERT_EQ(scope.post([]() { return std::this_thread::get_id(); }).get(), caller);
+  ASSERT_EQ(scope.get_stats().inlined, 1);
+
+  block.set_value();
+}
+
 int main(int argc, char *argv[]) {
   ::testing::InitGoogleTest(&argc, argv);
 